@@ -0,0 +1,399 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+#include "bmpreader.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "utils.h"
+
+
+// msvc lets any function use any intrinsic, gcc and clang have to be told per function:
+
+#ifdef _MSC_VER
+#define SIMDTARGET(isa)
+#else
+#define SIMDTARGET(isa)		__attribute__((target(isa)))
+#endif
+
+
+// which swizzle kernels can run here:
+
+enum SimdLevel
+{
+	SIMD_NONE = 0,
+	SIMD_SSSE3 = 1,
+	SIMD_AVX2 = 2
+};
+
+static const char* SIMDNAMES[] = { "scalar", "SSSE3", "AVX2" };
+
+
+constexpr int BMPROWSPERTASK{ 64 };		// rows swizzled by one ParallelFor( ) task
+
+constexpr int BI_RGB{ 0 };
+constexpr int BI_BITFIELDS{ 3 };
+constexpr int BI_ALPHABITFIELDS{ 6 };
+
+
+static SimdLevel
+DetectSimdLevel()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)		// the os saves the ymm registers
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	bool ssse3 = __builtin_cpu_supports("ssse3") != 0;
+	bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+	if (avx2)
+		return SIMD_AVX2;
+	if (ssse3)
+		return SIMD_SSSE3;
+	return SIMD_NONE;
+}
+
+
+static SimdLevel
+BestSimdLevel()
+{
+	static const SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+
+// the swizzle kernels turn one row of 24-bit BGR or 32-bit BGRA pixels into RGB
+// each one does what it can in whole vector steps and returns the number of pixels done,
+// and never reads or writes past the end of either row (their last stores overlap the next step's,
+// which rewrites those bytes)
+
+static int
+SwizzleRowScalar(const unsigned char* src, unsigned char* dst, int width, int srcBytes, int first)
+{
+	src += first * srcBytes;
+	dst += first * 3;
+	for (int i = first; i < width; i++, src += srcBytes, dst += 3)
+	{
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+	return width;
+}
+
+
+// 4 pixels -> 12 bytes per step:
+
+SIMDTARGET("ssse3") static int
+SwizzleRowSsse3(const unsigned char* src, unsigned char* dst, int width, int srcBytes)
+{
+	const __m128i bgr = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+	const __m128i bgra = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i shuffle = srcBytes == 3 ? bgr : bgra;
+
+	int i = 0;
+	for (; i + 6 <= width; i += 4)		// 16-byte loads and stores stay inside both rows
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(src + i * srcBytes));
+		_mm_storeu_si128((__m128i*)(dst + i * 3), _mm_shuffle_epi8(pixels, shuffle));
+	}
+	return i;
+}
+
+
+// 8 pixels -> 24 bytes per step:
+//	spread the pixels so each 128-bit lane holds 4 of them, shuffle each lane like the SSSE3 kernel,
+//	then squeeze the two 12-byte results back together
+
+SIMDTARGET("avx2") static int
+SwizzleRowAvx2(const unsigned char* src, unsigned char* dst, int width, int srcBytes)
+{
+	const __m256i bgr = _mm256_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1,
+		2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+	const __m256i bgra = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i shuffle = srcBytes == 3 ? bgr : bgra;
+	const __m256i spread = srcBytes == 3 ? _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6) : _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i squeeze = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+	int i = 0;
+	for (; i + 11 <= width; i += 8)		// 32-byte loads and stores stay inside both rows
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(src + i * srcBytes));
+		pixels = _mm256_permutevar8x32_epi32(pixels, spread);
+		pixels = _mm256_shuffle_epi8(pixels, shuffle);
+		_mm256_storeu_si256((__m256i*)(dst + i * 3), _mm256_permutevar8x32_epi32(pixels, squeeze));
+	}
+	return i;
+}
+
+
+static void
+SwizzleRow(const unsigned char* src, unsigned char* dst, int width, int srcBytes, SimdLevel level)
+{
+	int done = 0;
+	if (level >= SIMD_AVX2)
+		done = SwizzleRowAvx2(src, dst, width, srcBytes);
+	else if (level >= SIMD_SSSE3)
+		done = SwizzleRowSsse3(src, dst, width, srcBytes);
+	SwizzleRowScalar(src, dst, width, srcBytes, done);
+}
+
+
+static unsigned int
+ReadLittle32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+static unsigned short
+ReadLittle16(const unsigned char* p)
+{
+	return (unsigned short)(p[0] | (p[1] << 8));
+}
+
+
+// check the headers of a mapped .bmp file and find its pixels
+// returns false (after saying why) if the file cannot be used
+
+bool
+ParseBmpFile(const char* filename, const MappedFile& file, BmpImage* image)
+{
+	const unsigned char* bytes = (const unsigned char*)file.Data();
+	size_t size = file.Size();
+
+	// if bfType is not 0x4d42, the file is not a bmp:
+
+	if (size < 14 + 40 || ReadLittle16(bytes) != 0x4d42)
+	{
+		fprintf(stderr, "File '%s' is the wrong type of file: 0x%0x\n", filename, size >= 2 ? ReadLittle16(bytes) : 0);
+		return false;
+	}
+
+	unsigned int pixelOffset = ReadLittle32(bytes + 10);
+	unsigned int infoSize = ReadLittle32(bytes + 14);
+	int nums = (int)ReadLittle32(bytes + 18);
+	int numt = (int)ReadLittle32(bytes + 22);
+	int bitCount = ReadLittle16(bytes + 28);
+	int compression = (int)ReadLittle32(bytes + 30);
+	unsigned int numColors = ReadLittle32(bytes + 46);
+
+	// a negative height means the rows are stored top-down:
+
+	bool topDown = numt < 0;
+	if (topDown)
+		numt = -numt;
+
+	if (nums <= 0 || numt <= 0 || infoSize < 40)
+	{
+		fprintf(stderr, "Image file '%s' has a bad header\n", filename);
+		return false;
+	}
+	if (bitCount != 8 && bitCount != 24 && bitCount != 32)
+	{
+		fprintf(stderr, "Image file '%s' has %d bits per pixel -- only 8, 24, and 32 are supported\n", filename, bitCount);
+		return false;
+	}
+
+	// we do not support compression, only 32-bit pixels that say they are plain BGRA:
+
+	bool bitfields = bitCount == 32 && (compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS);
+	if (compression != BI_RGB && !bitfields)
+	{
+		fprintf(stderr, "Image file '%s' has the wrong type of image compression: %d\n", filename, compression);
+		return false;
+	}
+	if (bitfields && (size < 14 + 40 + 12 || ReadLittle32(bytes + 54) != 0x00ff0000 ||
+		ReadLittle32(bytes + 58) != 0x0000ff00 || ReadLittle32(bytes + 62) != 0x000000ff))
+	{
+		fprintf(stderr, "Image file '%s' has color masks other than BGRA\n", filename);
+		return false;
+	}
+
+	// every row is padded to a multiple of 4 bytes:
+
+	size_t rowBytes = (((size_t)bitCount * nums + 31) / 32) * 4;
+	if (pixelOffset > size || (size - pixelOffset) / rowBytes < (size_t)numt)
+	{
+		fprintf(stderr, "Image file '%s' is too short for a %d x %d image\n", filename, nums, numt);
+		return false;
+	}
+
+	// 8-bit pixels index a palette of BGRx entries right after the info header:
+
+	memset(image->Palette, 0, sizeof(image->Palette));
+	if (bitCount == 8)
+	{
+		if (numColors == 0 || numColors > 256)
+			numColors = 256;
+		size_t paletteOffset = 14 + (size_t)infoSize;
+		if (paletteOffset + 4 * (size_t)numColors > pixelOffset)
+			numColors = paletteOffset < pixelOffset ? (unsigned int)((pixelOffset - paletteOffset) / 4) : 0;
+		for (unsigned int c = 0; c < numColors; c++)
+		{
+			const unsigned char* entry = bytes + paletteOffset + 4 * c;
+			image->Palette[c][0] = entry[2];
+			image->Palette[c][1] = entry[1];
+			image->Palette[c][2] = entry[0];
+		}
+	}
+
+	image->Width = nums;
+	image->Height = numt;
+	image->BitCount = bitCount;
+	image->TopDown = topDown;
+	image->RowBytes = rowBytes;
+	image->Pixels = bytes + pixelOffset;
+	return true;
+}
+
+
+// expand a parsed file into RGB texels, bottom row first, using swizzle kernels up to level:
+
+static unsigned char*
+DecodeBmpPixels(const BmpImage& image, SimdLevel level)
+{
+	int nums = image.Width;
+	int numt = image.Height;
+	unsigned char* texture = new unsigned char[3 * (size_t)nums * numt];
+	int numTasks = (numt + BMPROWSPERTASK - 1) / BMPROWSPERTASK;
+	ParallelFor(numTasks, [&](int task)
+	{
+		int last = (task + 1) * BMPROWSPERTASK < numt ? (task + 1) * BMPROWSPERTASK : numt;
+		for (int t = task * BMPROWSPERTASK; t < last; t++)
+		{
+			const unsigned char* src = image.Pixels + (size_t)(image.TopDown ? numt - 1 - t : t) * image.RowBytes;
+			unsigned char* dst = texture + (size_t)t * 3 * nums;
+			if (image.BitCount == 8)
+			{
+				for (int s = 0; s < nums; s++, dst += 3)
+					memcpy(dst, image.Palette[src[s]], 3);
+			}
+			else
+			{
+				SwizzleRow(src, dst, nums, image.BitCount / 8, level);
+			}
+		}
+	});
+	return texture;
+}
+
+
+// decode the whole file using swizzle kernels up to level
+// returns NULL (after saying why) if the file cannot be used
+
+static unsigned char*
+DecodeBmpFile(const char* filename, int* width, int* height, SimdLevel level)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		fprintf(stderr, "Cannot open Bmp file '%s'\n", filename);
+		return NULL;
+	}
+
+	BmpImage image;
+	if (!ParseBmpFile(filename, file, &image))
+		return NULL;
+
+	*width = image.Width;
+	*height = image.Height;
+	return DecodeBmpPixels(image, level);
+}
+
+
+// expand a file ParseBmpFile( ) has accepted into a new[ ]'ed array of RGB texels, bottom row first
+// (the file has to stay mapped until this returns)
+
+unsigned char*
+DecodeBmpImage(const BmpImage& image)
+{
+	return DecodeBmpPixels(image, BestSimdLevel());
+}
+
+
+// read a .bmp file into a new[ ]'ed array of RGB texels, bottom row first
+// returns NULL if it cannot be read
+
+unsigned char*
+ReadBmpFile(const char* filename, int* width, int* height)
+{
+	unsigned char* texture = DecodeBmpFile(filename, width, height, BestSimdLevel());
+	if (texture != NULL)
+		fprintf(stderr, "Image size in file '%s' is: %d x %d\n", filename, *width, *height);
+	return texture;
+}
+
+
+// time the original fgetc reader against the mapped reader with every swizzle kernel this cpu has,
+// best of numRuns each, and check they all produce the same texels
+
+void
+BenchmarkBmpReaders(const char* filename, int numRuns)
+{
+	if (numRuns < 1)
+		numRuns = 1;
+
+	int legacyWidth = 0, legacyHeight = 0;
+	unsigned char* legacy = NULL;
+	double legacyMs = 0.;
+	for (int run = 0; run < numRuns; run++)
+	{
+		delete[] legacy;
+		auto t0 = std::chrono::steady_clock::now();
+		legacy = BmpToTextureLegacy((char*)filename, &legacyWidth, &legacyHeight);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		legacyMs = run == 0 || ms < legacyMs ? ms : legacyMs;
+	}
+	if (legacy == NULL)
+		return;
+	fprintf(stderr, "Legacy reader:  %10.3f ms\n", legacyMs);
+
+	for (int level = SIMD_NONE; level <= BestSimdLevel(); level++)
+	{
+		int width = 0, height = 0;
+		unsigned char* texture = NULL;
+		double bestMs = 0.;
+		for (int run = 0; run < numRuns; run++)
+		{
+			delete[] texture;
+			auto t0 = std::chrono::steady_clock::now();
+			texture = DecodeBmpFile(filename, &width, &height, (SimdLevel)level);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+			bestMs = run == 0 || ms < bestMs ? ms : bestMs;
+		}
+		if (texture == NULL)
+			break;
+
+		// (the legacy reader always starts at byte 54 and only knows 24-bit bottom-up files,
+		// so other files are expected not to match it)
+		bool same = width == legacyWidth && height == legacyHeight &&
+			memcmp(texture, legacy, 3 * (size_t)width * height) == 0;
+		fprintf(stderr, "Mapped %-7s  %10.3f ms  (%.1fx)  texels %s\n", SIMDNAMES[level], bestMs, legacyMs / bestMs,
+			same ? "match" : "DO NOT match");
+		delete[] texture;
+	}
+
+	delete[] legacy;
+}
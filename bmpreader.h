@@ -0,0 +1,33 @@
+#ifndef BMPREADER_H
+#define BMPREADER_H
+
+#include <stddef.h>
+
+class MappedFile;
+
+// reading uncompressed .bmp files into tightly packed RGB texels:
+//	8-bit (palette), 24-bit, and 32-bit (BI_RGB or BGRA bitfields) files, bottom-up or top-down
+//	rows always come out bottom-up (the way glTexImage2D( ) wants them) with no padding
+//	the pixel array is mapped in one go and swizzled BGR -> RGB with SSSE3/AVX2 when the cpu has them
+//	(LoadBmpTexture( ) in texture.h skips all of that when GL can take the file's own pixels)
+
+
+// where the pixels of a mapped .bmp file are:
+
+struct BmpImage
+{
+	int			Width, Height;
+	int			BitCount;		// 8, 24, or 32
+	bool			TopDown;		// rows stored top row first
+	size_t			RowBytes;		// including the padding to a multiple of 4 bytes
+	const unsigned char*	Pixels;			// the first stored row, inside the mapped file
+	unsigned char		Palette[256][3];	// RGB, 8-bit files only
+};
+
+
+bool		ParseBmpFile(const char*, const MappedFile&, BmpImage*);
+unsigned char*	DecodeBmpImage(const BmpImage&);
+unsigned char*	ReadBmpFile(const char*, int*, int*);
+void		BenchmarkBmpReaders(const char*, int);
+
+#endif		// #ifndef BMPREADER_H
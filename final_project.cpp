@@ -1,6 +1,12 @@
+#include <chrono>
 #include <ctime>
+#include <functional>
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
 
 #ifdef WIN32
 #include <windows.h>
@@ -11,9 +17,26 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include "glut.h"
+#include "freeglut_ext.h"
 #include "glslprogram.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
 #include <vector>
+#include "bmpreader.h"
+#include "geometrypool.h"
+#include "glstate.h"
+#include "mesh.h"
+#include "meshcache.h"
+#include "meshstream.h"
+#include "objreader.h"
+#include "riverdata.h"
+#include "shadervariants.h"
+#include "texcooker.h"
+#include "texture.h"
+#include "texturemanager.h"
+#include "uniformbuffer.h"
 #include "utils.h"
+#include "virtualtexture.h"
 
 //	The left mouse button does rotation
 //	The middle mouse button does scaling
@@ -30,8 +53,26 @@
 constexpr char* WINDOWTITLE{ "Final Project: River Animated with Flow Tiles -- Joseph Montgomery" };
 constexpr char* GLUITITLE{ "User Interface Window" };
 
+// Terrain model
+// (a binary .rmesh cache of it is kept next to it)
+constexpr char* TERRAIN_OBJ{ "final_project_assets/final_terrain.obj" };
+
+// Textures
+// (texcooker.h can make a compressed .ktx2 of each, which is then used in place of the bmp)
+constexpr char* TERRAIN_BMP{ "final_project_assets/final_terrain_texture_v2_revised_banks.bmp" };
+constexpr char* FLOWMAP_BMP{ "final_project_assets/flow_map.bmp" };
+constexpr char* WATERBASE_BMP{ "final_project_assets/water_base.bmp" };
+constexpr char* WATERNORMALS_BMP{ "final_project_assets/water_normals_2.bmp" };
+constexpr char* RIVERMASK_BMP{ "final_project_assets/river_mask.bmp" };
+// (the river mask and flow map go to the shader baked together in this one, see riverdata.h)
+constexpr char* RIVERDATA_BMP{ "final_project_assets/river_data.bmp" };
+
 // Shader helper class
-GLSLProgram* Pattern;
+// (the river shader is built in the background, one variant for each combination of the features
+// the keyboard toggles, and the fallback drawn until one is ready)
+ShaderVariants RiverShaders;
+GLSLProgram* Pattern;			// the river shader variant drawn with, NULL if none is ready yet
+GLSLProgram* Fallback;
 
 // what the glui package defines as true and false:
 
@@ -91,14 +132,12 @@ enum ButtonVals
 
 const GLfloat BACKGROUND_COLOR[] = { 0., 0., 0., 1. };
 
-// line width for the axes:
-
-constexpr GLfloat AXES_WIDTH{ 3. };
-
 // non-constant global variables:
 
 int		ActiveButton;			// current button that is down
-GLuint	AxesList;				// list to hold the axes
+GLuint	AxesVao, AxesVbo;			// the axes' line segments
+int		AxesNumVertices;
+GLSLProgram* AxesProgram;
 int		AxesOn;					// != 0 means to draw the axes
 int		DebugOn;				// != 0 means to print debugging info
 
@@ -109,10 +148,18 @@ int		WhichProjection;		// ORTHO or PERSP
 int		Xmouse, Ymouse;			// mouse values
 float	Xrot, Yrot;				// rotation angles in degrees
 float Time;
+glm::mat4 ProjectionMatrix, ViewMatrix;	// the camera, worked out at the start of every frame
 
 // River globals
-GLuint TerrainList;
-GLuint TerrainTexture, WaterTexture, WaterNormalMap, FlowMap, RiverMap;
+GeometryPool StaticGeometry;	// every static mesh's vertices and indices, drawn with one call per program
+GpuMesh TerrainMesh;		// in StaticGeometry once it has been loaded
+glm::mat4 TerrainModelView;	// worked out once a frame, for every pass that draws the terrain
+CullView TerrainView;
+DrawList TerrainDraws;		// visible terrain meshlets, refilled every frame
+MeshStream TerrainStream;	// loads the terrain in the background when there is no mesh cache
+GLuint TerrainTexture, WaterTexture, WaterNormalMap, RiverData;
+TextureManager Textures;	// every texture loaded from a file, shared by whoever asks for the same one
+UniformBuffer RiverStatic, RiverFrame;	// river.frag's uniform blocks
 const float BLOCKS = 16.f;
 int totalTerrainWidth;
 int totalTerrainHeight;
@@ -121,18 +168,34 @@ bool AnimateWater;
 bool UseEdgeTransparancy;
 bool ShowWater;
 bool ShinyWater;
+bool CullBackfaces;
+VirtualTexture TerrainVt;	// the terrain texture streamed in tiles, when it has been baked into a .vtex
+bool UseVirtualTerrain;
 
 constexpr int MS_IN_THE_ANIMATION_CYCLE = 10000;
 
+// uniform block binding points:
+constexpr GLuint RIVERSTATICBINDING{ 0 };
+constexpr GLuint RIVERFRAMEBINDING{ 1 };
+
 
 // function prototypes:
 
 void	Animate();
+void	Close();
 void	Display();
 void	DoAxesMenu(int);
 void	DoDebugMenu(int);
 void	DoMainMenu(int);
 void	DoProjectionMenu(int);
+void	DrawTerrain(GLSLProgram*);
+void	SetMatrixUniforms(GLSLProgram*, const glm::mat4&);
+void	BenchmarkUniforms(int);
+bool	InitRiverUniforms();
+bool	HookUpRiverShader(GLSLProgram*);
+unsigned int	RiverVariant();
+GLSLProgram* CurrentRiverShader();
+void	SetRiverUniforms();
 float	ElapsedSeconds();
 void	InitGraphics();
 void	InitLists();
@@ -154,10 +217,83 @@ main(int argc, char* argv[])
 
 	glutInit(&argc, argv);
 
+	// benchmark the obj readers instead of running the program:
+	//	-benchobj [file.obj] [number of synthetic faces, 0 = use the file as is]
+
+	if (argc > 1 && strcmp(argv[1], "-benchobj") == 0)
+	{
+		const char* file = argc > 2 ? argv[2] : "bench_terrain.obj";
+		int faces = argc > 3 ? atoi(argv[3]) : 4000000;
+		BenchmarkObjReaders(file, faces);
+		return 0;
+	}
+
+	// benchmark the bmp readers instead of running the program:
+	//	-benchbmp [file.bmp] [number of runs]
+
+	if (argc > 1 && strcmp(argv[1], "-benchbmp") == 0)
+	{
+		const char* file = argc > 2 ? argv[2] : TERRAIN_BMP;
+		int runs = argc > 3 ? atoi(argv[3]) : 10;
+		BenchmarkBmpReaders(file, runs);
+		return 0;
+	}
+
+	// cook textures into compressed .ktx2 files instead of running the program:
+	//	-cook				all of the project's textures (and bake the river data)
+	//	-cook file.bmp color|normal|flow|mask
+
+	if (argc > 1 && strcmp(argv[1], "-cook") == 0)
+	{
+		if (argc > 3)
+		{
+			const CookRecipe* recipe = FindCookRecipe(argv[3]);
+			if (recipe == NULL)
+			{
+				fprintf(stderr, "Unknown texture kind '%s' (color, normal, flow, or mask)\n", argv[3]);
+				return 1;
+			}
+			return CookTexture(argv[2], CookedTextureName(argv[2]).c_str(), *recipe) ? 0 : 1;
+		}
+
+		struct { const char* file; const CookRecipe* recipe; } cooks[] =
+		{
+			{ TERRAIN_BMP, &COOKCOLOR },
+			{ WATERBASE_BMP, &COOKCOLOR },
+			{ WATERNORMALS_BMP, &COOKNORMALMAP },
+		};
+		bool ok = BakeRiverData(RIVERMASK_BMP, FLOWMAP_BMP, RIVERDATA_BMP);
+		for (auto& cook : cooks)
+			ok = CookTexture(cook.file, CookedTextureName(cook.file).c_str(), *cook.recipe) && ok;
+		return ok ? 0 : 1;
+	}
+
+	// bake a texture into tiles for virtual texturing instead of running the program:
+	//	-bakevt [file.bmp]		(the terrain texture if no file is given)
+
+	if (argc > 1 && strcmp(argv[1], "-bakevt") == 0)
+	{
+		const char* file = argc > 2 ? argv[2] : TERRAIN_BMP;
+		return BakeVirtualTexture(file, VirtualTextureName(file).c_str()) ? 0 : 1;
+	}
+
 	// setup all the graphics stuff:
 
 	InitGraphics();
 
+	// benchmark setting the shader's uniforms instead of running the program (needs the window up):
+	//	-benchuniforms [number of frames]
+
+	if (argc > 1 && strcmp(argv[1], "-benchuniforms") == 0)
+	{
+		while (CurrentRiverShader() == Fallback && !RiverShaders.Building.empty())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));		// the driver is compiling
+		if (Pattern == NULL)
+			return 1;
+		BenchmarkUniforms(argc > 2 ? atoi(argv[2]) : 10000);
+		return 0;
+	}
+
 	// create the display structures that will not change:
 
 	InitLists();
@@ -217,6 +353,7 @@ Display()
 	{
 		fprintf(stderr, "Display\n");
 	}
+	ResetGlStateCounters();
 
 
 	// set which window we want to do the graphics into:
@@ -229,12 +366,7 @@ Display()
 	glDrawBuffer(GL_BACK);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_DEPTH_TEST);
-
-
-	// specify shading to be flat:
-
-	glShadeModel(GL_FLAT);
+	SetCapability(GL_DEPTH_TEST, true);
 
 
 	// set the viewport to a square centered in the window:
@@ -244,122 +376,369 @@ Display()
 	GLsizei v = vx < vy ? vx : vy;			// minimum dimension
 	GLint xl = (vx - v) / 2;
 	GLint yb = (vy - v) / 2;
-	glViewport(xl, yb, v, v);
+	SetViewport(xl, yb, v, v);
 
 
 	// set the viewing volume:
 	// remember that the Z clipping  values are actually
 	// given as DISTANCES IN FRONT OF THE EYE
-	// USE gluOrtho2D( ) IF YOU ARE DOING 2D !
+	// (the matrices are made here and handed to the shaders, there is no fixed-function matrix stack)
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
 	if (WhichProjection == ORTHO)
-		glOrtho(-3., 3., -3., 3., 0.1, 1000.);
+		ProjectionMatrix = glm::ortho(-3.f, 3.f, -3.f, 3.f, 0.1f, 1000.f);
 	else
-		gluPerspective(90., 1., 0.1, 5000.);
+		ProjectionMatrix = glm::perspective(glm::radians(90.f), 1.f, 0.1f, 5000.f);
 
 
 	// place the objects into the scene:
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-
 		// set the eye position, look-at position, and up-vector:
 
-		gluLookAt(0., 0., 3., 0., 0., 0., 0., 1., 0.);
+		ViewMatrix = glm::lookAt(glm::vec3(0., 0., 3.), glm::vec3(0., 0., 0.), glm::vec3(0., 1., 0.));
 
 
 		// rotate the scene:
 
-		glRotatef((GLfloat)Yrot, 0., 1., 0.);
-		glRotatef((GLfloat)Xrot, 1., 0., 0.);
+		ViewMatrix = glm::rotate(ViewMatrix, glm::radians(Yrot), glm::vec3(0., 1., 0.));
+		ViewMatrix = glm::rotate(ViewMatrix, glm::radians(Xrot), glm::vec3(1., 0., 0.));
 
 
 		// uniformly scale the scene:
 
 		if (Scale < MINSCALE)
 			Scale = MINSCALE;
-		glScalef((GLfloat)Scale, (GLfloat)Scale, (GLfloat)Scale);
+		ViewMatrix = glm::scale(ViewMatrix, glm::vec3(Scale, Scale, Scale));
+
+
+	// place the terrain, scaled down since it's pretty big for camera view
+	// (0.3 for the view, 0.5 for the terrain model itself), and find what of it the window's viewport sees
+	// (the virtual texture feedback pass draws into a smaller viewport, but has to pick the same geometry)
+
+	TerrainModelView = glm::scale(ViewMatrix, glm::vec3(0.3f * 0.5f));
+	GetCullView(CullBackfaces, TerrainModelView, ProjectionMatrix, v, &TerrainView);
 
 
 	// possibly draw the axes:
+	// (1 pixel wide: wider lines are deprecated in a core profile)
 
-	if (AxesOn != 0)
+	if (AxesOn != 0 && AxesProgram->IsValid())
 	{
-		GLfloat white[3]{ 1., 1., 1. };
-		glColor3fv(white);
-		glCallList(AxesList);
+		static UniformHandle color = GetUniformHandle("uColor");
+		glm::vec3 white(1., 1., 1.);
+		AxesProgram->Use();
+		SetMatrixUniforms(AxesProgram, ViewMatrix);
+		AxesProgram->SetUniformVariable(color, white);
+		BindVertexArray(AxesVao);
+		glDrawArrays(GL_LINES, 0, AxesNumVertices);
+	}
+
+	// Pick up any terrain that has been streamed in since the last frame
+	UpdateMeshStream(&TerrainStream, &TerrainMesh, &StaticGeometry);
+
+	// Find out which terrain texture tiles this view needs and put in the ones that have arrived
+	// (the feedback is a small extra pass over the same geometry, read back a few frames later)
+	if (UseVirtualTerrain)
+	{
+		RenderVirtualTextureFeedback(&TerrainVt, v, v, [](GLSLProgram* program) { DrawTerrain(program); });
+		UpdateVirtualTexture(&TerrainVt);
+		if (DebugOn != 0)
+			fprintf(stderr, "Virtual terrain: %d tiles uploaded\n", TerrainVt.NumUploaded);
 	}
 
 	// Activate shader and set up uniforms
-	Pattern->Use();
+	// (the fallback's only uniforms are the mesh's)
+	GLSLProgram* river = CurrentRiverShader();
+	river->Use();
+	if (river == Pattern)
+		SetRiverUniforms();
+
+	// Set up river textures/maps
+	// (these stay bound from frame to frame, so after the first frame none of this reaches the GL)
+	BindTexture(0, TerrainTexture);
+	BindTexture(1, RiverData);
+	BindTexture(2, WaterNormalMap);
+	BindTexture(3, WaterTexture);
+
+	if (UseVirtualTerrain && river == Pattern)
+		SetVirtualTextureUniforms(Pattern, TerrainVt, 4, 5, 0.f);
+
+	DrawTerrain(river);
+
+	// the program, vertex array and textures are left bound for the next frame
+	if (DebugOn != 0)
+	{
+		const GlStateCounters& counters = GetGlStateCounters();
+		fprintf(stderr, "GL state: %d calls, %d skipped\n", counters.Submitted, counters.Skipped);
+	}
+
+	// swap the double-buffered framebuffers:
+
+	glutSwapBuffers();
+
+
+	// be sure the graphics buffer has been sent:
+	// note: be sure to use glFlush( ) here, not glFinish( ) !
+
+	glFlush();
+}
+
+
+// river.frag's uniform blocks (std140: see uniformbuffer.h for what keeps these in step with the shader)
+
+struct RiverStaticBlock		// set once the textures are loaded
+{
+	float	Color[3];
+	float	Ka;
+	float	SpecularColor[3];
+	float	Kd;
+	float	Ks;
+	float	Shininess;
+	int	TerrainTextureWidth;
+	int	TerrainTextureHeight;
+};
+
+struct RiverFrameBlock		// every frame, though only sent when something has changed
+{
+	float	Time;
+	float	Pad[3];
+};
+
+
+// make the river shader's uniform blocks and fill in the one that never changes
+// (every build of the shader is hooked up to the same buffers, see HookUpRiverShader( ))
+// returns false if the GL cannot do uniform blocks
+
+bool
+InitRiverUniforms()
+{
+	if (!CreateUniformBuffer(RIVERSTATICBINDING, sizeof(RiverStaticBlock), &RiverStatic) ||
+		!CreateUniformBuffer(RIVERFRAMEBINDING, sizeof(RiverFrameBlock), &RiverFrame))
+		return false;
+
 	//uniform float uKa, uKd, uKs; // coefficients of each type of lighting
 	//uniform vec3 uColor;		// object color
 	//uniform vec3 uSpecularColor; // light color
 	//uniform float uShininess;	// specular exponent
-	Pattern->SetUniformVariable("uKa", 0.1f);
-	Pattern->SetUniformVariable("uKd", 1.0f);
-	Pattern->SetUniformVariable("uKs", 0.1f);
-	Pattern->SetUniformVariable("uColor", 1.0, 1.0, 1.0);
-	Pattern->SetUniformVariable("uSpecularColor", 1.0, 1.0, 1.0);
-	Pattern->SetUniformVariable("uShininess", 1.f);
-	Pattern->SetUniformVariable("uBlocks", BLOCKS);
-	Pattern->SetUniformVariable("uTerrainTextureWidth", totalTerrainWidth);
-	Pattern->SetUniformVariable("uTerrainTextureHeight", totalTerrainHeight);
-	Pattern->SetUniformVariable("uBlockSize", int(totalTerrainHeight/BLOCKS));
-	Pattern->SetUniformVariable("uUseTransparancy",	UseTransparency);
-	Pattern->SetUniformVariable("uUseEdgeTransparancy", UseEdgeTransparancy);
-	Pattern->SetUniformVariable("uShowWater", ShowWater);
-	Pattern->SetUniformVariable("uShinyWater", ShinyWater);
-
-
-	if (AnimateWater) {
-		Pattern->SetUniformVariable("uTime", Time);
-	}
-	else {
-		Pattern->SetUniformVariable("uTime", 0);
+	RiverStaticBlock block = {};
+	block.Ka = 0.1f;
+	block.Kd = 1.0f;
+	block.Ks = 0.1f;
+	block.Color[0] = block.Color[1] = block.Color[2] = 1.f;
+	block.SpecularColor[0] = block.SpecularColor[1] = block.SpecularColor[2] = 1.f;
+	block.Shininess = 1.f;
+	block.TerrainTextureWidth = totalTerrainWidth;
+	block.TerrainTextureHeight = totalTerrainHeight;
+	UpdateUniformBuffer(&RiverStatic, &block, sizeof(block));
+	return true;
+}
+
+
+// does a block the driver says is this many bytes fit its struct?
+// it has to cover the struct's last real member, but drivers differ on rounding it up to 16 bytes,
+// so anything up to the struct's padded size will do
+
+static bool
+BlockFits(int size, size_t used, size_t whole)
+{
+	return size >= (int)used && size <= (int)whole;
+}
+
+
+// hook a newly built river shader up to the uniform blocks and set its texture units
+// (uniforms keep their values, so once is enough)
+// returns false if the shader's blocks do not match
+
+bool
+HookUpRiverShader(GLSLProgram* program)
+{
+	int staticSize = program->BindUniformBlock("RiverStatic", RIVERSTATICBINDING);
+	int frameSize = program->BindUniformBlock("RiverFrame", RIVERFRAMEBINDING);
+	if (!BlockFits(staticSize, offsetof(RiverStaticBlock, TerrainTextureHeight) + sizeof(int), sizeof(RiverStaticBlock))
+		|| !BlockFits(frameSize, offsetof(RiverFrameBlock, Time) + sizeof(float), sizeof(RiverFrameBlock)))
+	{
+		fprintf(stderr, "River shader uniform blocks are %d and %d bytes, expected at most %d and %d\n",
+			staticSize, frameSize, (int)sizeof(RiverStaticBlock), (int)sizeof(RiverFrameBlock));
+		return false;
 	}
 
-	// Set up river textures/maps
-	glActiveTexture( GL_TEXTURE0 );
-	glBindTexture(GL_TEXTURE_2D, TerrainTexture);
-	Pattern->SetUniformVariable("uTerrainTexUnit", 0 );
+	program->SetUniformVariable("uTerrainTexUnit", 0);
+	program->SetUniformVariable("uRiverDataTexUnit", 1);
+	program->SetUniformVariable("uWaterNormalsTexUnit", 2);
+	program->SetUniformVariable("uWaterBaseTexUnit", 3);
+	program->Use(0);
+	return true;
+}
+
+
+// which variant of the river shader the keyboard toggles ask for
+// (bit i is RiverShaders.Flags[i], see InitGraphics( ))
+
+unsigned int
+RiverVariant()
+{
+	return (UseTransparency ? 1 : 0) | (UseEdgeTransparancy ? 2 : 0) | (ShowWater ? 4 : 0) |
+		(ShinyWater ? 8 : 0) | (UseVirtualTerrain ? 16 : 0);
+}
+
+
+// the shader to draw the river with this frame: the variant for the features that are on if it is ready,
+// otherwise the one drawn last time (or the fallback, before any is)
+
+GLSLProgram*
+CurrentRiverShader()
+{
+	Pattern = GetShaderVariant(&RiverShaders, RiverVariant());
+	return Pattern != NULL ? Pattern : Fallback;
+}
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, RiverMap);
-	Pattern->SetUniformVariable("uRiverMapTexUnit", 1);
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, WaterNormalMap);
-	Pattern->SetUniformVariable("uWaterNormalsTexUnit", 2);
+// the river shader's per-frame uniforms, in one buffer update if any of them changed
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, WaterTexture);
-	Pattern->SetUniformVariable("uWaterBaseTexUnit", 3);
+void
+SetRiverUniforms()
+{
+	RiverFrameBlock block = {};
+	block.Time = AnimateWater ? Time : 0.f;
+	UpdateUniformBuffer(&RiverFrame, &block, sizeof(block));
+}
 
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D, FlowMap);
-	Pattern->SetUniformVariable("uFlowMapTexUnit", 4);
 
-	// Scale down model since it's pretty big for camera view
-	glPushMatrix();
-	glScalef(0.3, 0.3, 0.3);
-	glCallList(TerrainList);
-	glPopMatrix();
+// time what the uniforms cost a frame: the ones still set one at a time (the mesh's and the virtual texture's)
+// by name every time through glGetUniformLocation( ) (what a name the old pointer-keyed cache missed cost),
+// by name through the string convenience path, and by handle; and the river's per-frame block,
+// with nothing changing and with the time changing
 
-	// Turn off shader
+void
+BenchmarkUniforms(int frames)
+{
+	struct { const char* name; bool isInt; } uniforms[] =
+	{
+		{ "uOctahedralNormals", true }, { "uVtAtlas", true }, { "uVtPageTable", true },
+		{ "uVtWidth", false }, { "uVtHeight", false }, { "uVtNumLevels", false }, { "uVtLodBias", false },
+	};
+	const int numUniforms = sizeof(uniforms) / sizeof(uniforms[0]);
+	UniformHandle handles[numUniforms];
+	for (int i = 0; i < numUniforms; i++)
+		handles[i] = GetUniformHandle(uniforms[i].name);
+
+	Pattern->Use();
+	GLint program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+
+	auto time = [frames](const char* what, const std::function<void(int)>& frame)
+	{
+		glFinish();
+		auto t0 = std::chrono::steady_clock::now();
+		for (int f = 0; f < frames; f++)
+			frame(f);
+		glFinish();
+		double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+		fprintf(stderr, "%-40s %8.2f us a frame\n", what, us / frames);
+	};
+
+	time("glGetUniformLocation( ) every time", [&](int f)
+	{
+		for (int i = 0; i < numUniforms; i++)
+		{
+			GLint location = glGetUniformLocation(program, uniforms[i].name);
+			if (uniforms[i].isInt)
+				glUniform1i(location, f & 1);
+			else
+				glUniform1f(location, (float)f);
+		}
+	});
+	time("by name", [&](int f)
+	{
+		for (int i = 0; i < numUniforms; i++)
+		{
+			if (uniforms[i].isInt)
+				Pattern->SetUniformVariable((char*)uniforms[i].name, f & 1);
+			else
+				Pattern->SetUniformVariable((char*)uniforms[i].name, (float)f);
+		}
+	});
+	time("by handle", [&](int f)
+	{
+		for (int i = 0; i < numUniforms; i++)
+		{
+			if (uniforms[i].isInt)
+				Pattern->SetUniformVariable(handles[i], f & 1);
+			else
+				Pattern->SetUniformVariable(handles[i], (float)f);
+		}
+	});
+	bool animate = AnimateWater;
+	AnimateWater = true;
+	time("river frame block, unchanged", [&](int)
+	{
+		SetRiverUniforms();
+	});
+	time("river frame block, time changing", [&](int f)
+	{
+		Time = (float)f;
+		SetRiverUniforms();
+	});
+	AnimateWater = animate;
 	Pattern->Use(0);
+}
 
-	// swap the double-buffered framebuffers:
 
-	glutSwapBuffers();
+// the matrices the shaders put vertices through, for a model drawn with the camera as it is this frame
+// (the normal matrix is sent as a mat4, the shaders use its upper 3x3)
 
+void
+SetMatrixUniforms(GLSLProgram* program, const glm::mat4& modelview)
+{
+	static UniformHandle modelViewMatrix = GetUniformHandle("uModelViewMatrix");
+	static UniformHandle modelViewProjectionMatrix = GetUniformHandle("uModelViewProjectionMatrix");
+	static UniformHandle normalMatrix = GetUniformHandle("uNormalMatrix");
+
+	glm::mat4 mv = modelview;
+	glm::mat4 mvp = ProjectionMatrix * modelview;
+	glm::mat4 normal = glm::mat4(glm::transpose(glm::inverse(glm::mat3(modelview))));
+	program->SetUniformVariable(modelViewMatrix, mv);
+	program->SetUniformVariable(modelViewProjectionMatrix, mvp);
+	program->SetUniformVariable(normalMatrix, normal);
+}
 
-	// be sure the graphics buffer has been sent:
-	// note: be sure to use glFlush( ) here, not glFinish( ) !
 
-	glFlush();
+// draw the terrain with a program that is in use:
+// (the main pass and the virtual texture feedback pass)
+
+void
+DrawTerrain(GLSLProgram* program)
+{
+	SetMatrixUniforms(program, TerrainModelView);
+	SetMeshUniforms(program, TerrainMesh);
+
+	// Use a coarser level of detail when the terrain is small on screen,
+	// otherwise only draw the meshlets inside the view (and, with backface culling on, facing the eye)
+	SetCapability(GL_CULL_FACE, CullBackfaces);
+	int lod = SelectMeshLod(TerrainMesh.Lods, TerrainView, TerrainMesh.Bounds);
+	if (TerrainMesh.Meshlets.empty())
+	{
+		// still streaming in
+		DrawMesh(TerrainMesh);
+	}
+	else if (lod > 0)
+	{
+		DrawMeshLod(TerrainMesh, lod);
+		if (DebugOn != 0)
+			fprintf(stderr, "Terrain: level %d, %d triangles\n", lod, (int)TerrainMesh.Lods[lod].IndexCount / 3);
+	}
+	else
+	{
+		int numDraws = CullMeshlets(TerrainMesh.Meshlets, TerrainView, TerrainMesh.IndexType, &TerrainDraws);
+		DrawMeshlets(TerrainMesh, TerrainDraws);
+		if (DebugOn != 0)
+			fprintf(stderr, "Terrain: %d of %d meshlets, %d triangles, %d draws\n",
+				TerrainDraws.NumMeshlets, (int)TerrainMesh.Meshlets.size(), TerrainDraws.NumTriangles, numDraws);
+	}
+
+	// the pooled draws above were only queued
+	int numCalls = FlushPoolDraws(&StaticGeometry);
+	if (DebugOn != 0)
+		fprintf(stderr, "Static geometry: %d draw calls\n", numCalls);
 }
 
 
@@ -381,6 +760,15 @@ DoDebugMenu(int id)
 	glutPostRedisplay();
 }
 
+// window close callback (freeglut exits the program right after):
+
+void
+Close()
+{
+	StopMeshStream(&TerrainStream);
+}
+
+
 // main menu callback:
 
 void
@@ -396,6 +784,8 @@ DoMainMenu(int id)
 		// gracefully close out the graphics:
 		// gracefully close the graphics window:
 		// gracefully exit the program:
+		// (a terrain still streaming in has to be stopped first: its worker thread cannot outlive it)
+		StopMeshStream(&TerrainStream);
 		glutSetWindow(MainWindow);
 		glFinish();
 		glutDestroyWindow(MainWindow);
@@ -479,6 +869,12 @@ InitGraphics()
 
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
 
+	// ask for a core profile context: everything is drawn with shaders, vertex buffers,
+	// and matrices made with glm, so none of the compatibility profile is needed
+
+	glutInitContextVersion(3, 3);
+	glutInitContextProfile(GLUT_CORE_PROFILE);
+
 	// set the initial window configuration:
 
 	glutInitWindowPosition(0, 0);
@@ -502,6 +898,7 @@ InitGraphics()
 	// VisibilityFunc -- handle a change in window visibility
 	// MenuStateFunc -- declare when a pop-up menu is in use
 	// IdleFunc -- what to do when nothing else is going on
+	// CloseFunc -- the window is being closed, and the program with it
 
 	glutSetWindow(MainWindow);
 	glutDisplayFunc(Display);
@@ -511,71 +908,17 @@ InitGraphics()
 	glutMotionFunc(MouseMotion);
 	glutVisibilityFunc(Visibility);
 	glutIdleFunc(Animate);
+	glutCloseFunc(Close);
 
 	srand(time(0));
 
-	// Set up textures
-	unsigned char* TextureArrayTerrain = BmpToTexture("final_project_assets/final_terrain_texture_v2_revised_banks.bmp", &totalTerrainWidth, &totalTerrainHeight);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glGenTextures(1, &TerrainTexture);
-	glBindTexture(GL_TEXTURE_2D, TerrainTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, totalTerrainWidth, totalTerrainHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureArrayTerrain);
-
-	int width, height;
-	unsigned char* TextureArrayFlow = BmpToTexture("final_project_assets/flow_map.bmp", &width, &height);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glGenTextures(1, &FlowMap);
-	glBindTexture(GL_TEXTURE_2D, FlowMap);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureArrayFlow);
-
-	unsigned char* TextureArrayWater = BmpToTexture("final_project_assets/water_base.bmp", &width, &height);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glGenTextures(1, &WaterTexture);
-	glBindTexture(GL_TEXTURE_2D, WaterTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureArrayWater);
-
-	unsigned char* TextureArrayWaterNormals = BmpToTexture("final_project_assets/water_normals_2.bmp", &width, &height);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glGenTextures(1, &WaterNormalMap);
-	glBindTexture(GL_TEXTURE_2D, WaterNormalMap);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureArrayWaterNormals);
-
-	unsigned char* TextureArrayRiverMap = BmpToTexture("final_project_assets/river_mask.bmp", &width, &height);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glGenTextures(1, &RiverMap);
-	glBindTexture(GL_TEXTURE_2D, RiverMap);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureArrayRiverMap);
-
-
 	// init glew (a window must be open to do this):
+	// (before the textures, which use glTexStorage2D( ) when it is there)
 
 #ifdef WIN32
+	glewExperimental = GL_TRUE;		// or glew skips what a core context does not list the old way
 	GLenum err = glewInit();
+	glGetError();				// (which it trips over while looking)
 	if (err != GLEW_OK)
 	{
 		fprintf(stderr, "glewInit Error\n");
@@ -585,20 +928,53 @@ InitGraphics()
 	fprintf(stderr, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
 #endif
 
+	// Set up textures
+	// (the files are read on worker threads while the shaders compile,
+	// then uploaded straight from the mapped bmp or cooked ktx2 files)
+	// the river data is rebaked first if the mask or flow map has changed
+	// the terrain is streamed in tiles instead when it has been baked with -bakevt
+	UpdateRiverData(RIVERMASK_BMP, FLOWMAP_BMP, RIVERDATA_BMP);
+	UseVirtualTerrain = OpenVirtualTexture(TERRAIN_BMP, VTCACHEBYTES, &TerrainVt);
+	std::vector<TextureRequest> textures =
+	{
+		{ WATERBASE_BMP, GL_REPEAT, &WaterTexture, NULL, NULL },
+		{ WATERNORMALS_BMP, GL_REPEAT, &WaterNormalMap, NULL, NULL },
+		{ RIVERDATA_BMP, GL_CLAMP_TO_EDGE, &RiverData, NULL, NULL },
+	};
+	if (UseVirtualTerrain)
+	{
+		totalTerrainWidth = (int)TerrainVt.Image.Header.Width;
+		totalTerrainHeight = (int)TerrainVt.Image.Header.Height;
+	}
+	else
+		textures.push_back({ TERRAIN_BMP, GL_CLAMP_TO_EDGE, &TerrainTexture, &totalTerrainWidth, &totalTerrainHeight });
+	TextureLoads textureLoads;
+	StartTextureLoads(textures.data(), (int)textures.size(), &textureLoads, &Textures);
+
 	// Create shaders
-	Pattern = new GLSLProgram();
-	bool valid = Pattern->Create("final_project_assets/river.vert", "final_project_assets/river.frag");
+	// (the river shader compiles in the background, on the driver's threads when it can,
+	// and the window shows the quick fallback until it is done; see CurrentRiverShader( ))
+	Fallback = new GLSLProgram();
+	bool valid = Fallback->Create("final_project_assets/river.vert", "final_project_assets/fallback.frag");
 
-	if (!valid) {
+	FinishTextureLoads(&textureLoads);
+	ReportTextureMemory(Textures);
+
+	if (!valid || !InitRiverUniforms()) {
 		exit(-10);
 	}
+
+	// the keyboard toggles and the terrain's block layout are compiled into the river shader
+	// (the first variant is built when Display( ) first asks for it)
+	RiverShaders.Files = { "final_project_assets/river.vert", "final_project_assets/river.frag" };
+	RiverShaders.Flags = { "USE_TRANSPARENCY", "USE_EDGE_TRANSPARENCY", "SHOW_WATER", "SHINY_WATER", "VIRTUAL_TERRAIN" };
+	RiverShaders.Constants = { { "BLOCKS", (int)BLOCKS }, { "BLOCK_SIZE", int(totalTerrainHeight/BLOCKS) } };
+	RiverShaders.Prepare = HookUpRiverShader;
 }
 
 
-// initialize the display lists that will not change:
-// (a display list is a way to store opengl commands in
-//  memory so that they can be played back efficiently at a later time
-//  with a call to glCallList( )
+// initialize the geometry that will not change:
+// (in vertex buffers, core profile contexts have no display lists)
 
 void
 InitLists()
@@ -606,21 +982,31 @@ InitLists()
 	glutSetWindow(MainWindow);
 
 	// create the axes:
-	AxesList = glGenLists(1);
-	glNewList(AxesList, GL_COMPILE);
-	glLineWidth(AXES_WIDTH);
-	Axes(1.5);
-	glLineWidth(1.);
-	glEndList();
+	std::vector<float> axes;
+	AxesLines(1.5, &axes);
+	AxesNumVertices = (int)axes.size() / 3;
+	glGenVertexArrays(1, &AxesVao);
+	BindVertexArray(AxesVao);
+	glGenBuffers(1, &AxesVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, AxesVbo);
+	glBufferData(GL_ARRAY_BUFFER, axes.size() * sizeof(float), axes.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (const GLvoid*)0);
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	AxesProgram = new GLSLProgram();
+	if (!AxesProgram->Create("final_project_assets/axes.vert", "final_project_assets/axes.frag"))
+		fprintf(stderr, "Cannot draw the axes\n");
 
 	// Create riverbed model
-	TerrainList = glGenLists(1);
-	glNewList(TerrainList, GL_COMPILE);
-	glPushMatrix();
-	glScalef(0.5, 0.5, 0.5);
-	LoadObjFile("final_project_assets/final_terrain.obj");
-	glPopMatrix();
-	glEndList();
+	// (packed into the static geometry pool rather than a display list)
+	// the binary cache goes straight to the GPU when it is up to date,
+	// otherwise stream the obj in the background (Display( ) draws it as it arrives)
+	// and refresh the cache for next time
+	InitGeometryPool(&StaticGeometry);
+	if (!UploadMeshCache(TERRAIN_OBJ, &TerrainMesh, StaticGeometry.Format, &StaticGeometry))
+		StartMeshStream(TERRAIN_OBJ, &TerrainStream, &TerrainMesh);
 }
 
 // the keyboard callback:
@@ -664,6 +1050,13 @@ Keyboard(unsigned char c, int x, int y)
 	case 's':
 		ShinyWater = !ShinyWater;
 		break;
+	case 'b':
+		CullBackfaces = !CullBackfaces;
+		break;
+	case 'r':
+		fprintf(stderr, "Rebuilding the river shader\n");
+		RebuildShaderVariants(&RiverShaders);
+		break;
 
 	default:
 		fprintf(stderr, "Don't know what to do with keyboard hit: '%c' (0x%0x)\n", c, c);
@@ -791,6 +1184,7 @@ Reset()
 	UseEdgeTransparancy = true;
 	ShowWater = true;
 	ShinyWater = true;
+	CullBackfaces = false;
 }
 
 
@@ -0,0 +1,11 @@
+#version 330 core
+
+uniform vec3 uColor;
+
+out vec4 fFragColor;
+
+void
+main()
+{
+	fFragColor = vec4(uColor, 1.0);
+}
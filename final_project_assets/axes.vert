@@ -0,0 +1,12 @@
+#version 330 core
+// The axes: plain lines (see AxesLines( ) in utils.cpp)
+
+layout(location = 0) in vec3 aPosition;
+
+uniform mat4 uModelViewProjectionMatrix;
+
+void
+main()
+{
+	gl_Position = uModelViewProjectionMatrix * vec4(aPosition, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// Stand-in for river.frag while it is being compiled (see CurrentRiverShader( ) in final_project.cpp):
+// plain lit terrain with no textures or uniforms of its own, so it is quick to build
+
+in vec3 vN;
+in vec3 vL;
+out vec4 fFragColor;
+
+const vec3 TERRAINCOLOR = vec3(0.45, 0.38, 0.28);
+
+void
+main()
+{
+	float diffuse = max(dot(normalize(vN), normalize(vL)), 0.0);
+	fFragColor = vec4(TERRAINCOLOR * (0.2 + 0.8 * diffuse), 1.0);
+}
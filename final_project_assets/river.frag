@@ -1,55 +1,144 @@
-#version 330 compatibility
-uniform float uKa, uKd, uKs; // coefficients of each type of lighting: ambient, diffuse, specular
-uniform vec3 uColor;		// object color
-uniform vec3 uSpecularColor; // Specular highlight color
-uniform float uShininess;	// specular exponent aka shininess
-uniform float uBlocks;	// Texture split up into uBlocks x uBlocks squares
-uniform int uTerrainTextureWidth;
-uniform int uTerrainTextureHeight;
-uniform int uBlockSize; // Pixels per block ie TerrainTextureHeight / uBlocks
-// Flags to toggle features
-uniform bool uUseTransparancy;
-uniform bool uUseEdgeTransparancy;
-uniform bool uShowWater;
-uniform bool uShinyWater;
+#version 330 core
+// Features compiled in (1) or out (0): each combination is a program of its own, see the river's ShaderVariants
+// in final_project.cpp (these defaults are only for compiling the file on its own)
+#ifndef USE_TRANSPARENCY
+#define USE_TRANSPARENCY 1
+#endif
+#ifndef USE_EDGE_TRANSPARENCY
+#define USE_EDGE_TRANSPARENCY 1
+#endif
+#ifndef SHOW_WATER
+#define SHOW_WATER 1
+#endif
+#ifndef SHINY_WATER
+#define SHINY_WATER 1
+#endif
+#ifndef VIRTUAL_TERRAIN
+#define VIRTUAL_TERRAIN 0	// see below
+#endif
+// Texture split up into BLOCKS x BLOCKS squares of BLOCK_SIZE pixels (ie terrain texture height / BLOCKS)
+#ifndef BLOCKS
+#define BLOCKS 16
+#endif
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 512
+#endif
 
-// Textures and time
+// Uniform blocks: std140, and laid out to match RiverStaticBlock and RiverFrameBlock in final_project.cpp
+// Set once
+layout(std140) uniform RiverStatic
+{
+	vec3 uColor;		// object color
+	float uKa;		// coefficients of each type of lighting: ambient, diffuse, specular
+	vec3 uSpecularColor;	// Specular highlight color
+	float uKd;
+	float uKs;
+	float uShininess;	// specular exponent aka shininess
+	int uTerrainTextureWidth;
+	int uTerrainTextureHeight;
+};
+// Changes from frame to frame
+layout(std140) uniform RiverFrame
+{
+	float uTime;
+};
+
+// Textures (the units are set once)
 uniform sampler2D uTerrainTexUnit;
-uniform sampler2D uRiverMapTexUnit;
+uniform sampler2D uRiverDataTexUnit;	// r = water, g = distance to shore, ba = flow (see riverdata.h)
 uniform sampler2D uWaterBaseTexUnit;
 uniform sampler2D uWaterNormalsTexUnit;
-uniform sampler2D uFlowMapTexUnit;
-uniform float uTime;
+
+// Virtual texture terrain (see virtualtexture.h), used instead of uTerrainTexUnit when VIRTUAL_TERRAIN is on
+uniform sampler2D uVtAtlas;		// the tile cache
+uniform sampler2D uVtPageTable;	// per tile of every level: cache slot x and y, level of the tile actually there
+uniform float uVtWidth, uVtHeight;	// virtual texture size in texels
+uniform float uVtNumLevels;
+uniform float uVtLodBias;
 
 // From vertex shader
 in vec2 vST;	// texture coords
 in vec3 vN;		// normal vector
+in vec3 vT;		// tangent (increasing s)
+in vec3 vB;		// bitangent (increasing t)
 in vec3 vL;		// vector from point to sun
 in vec3 vE;		// vector from point to eye
 
+out vec4 fFragColor;
+
+// How river data green stores distances (keep in sync with riverdata.h)
+const float RIVERDATAZERO = 128.0;
+const float RIVERDATADISTANCESCALE = 8.0;
+
+// How the virtual texture tiles are laid out (keep in sync with vtexfile.h)
+const float VTTILESIZE = 128.0;
+const float VTBORDER = 4.0;
+
+// Which level of the virtual texture this pixel wants (needs to be worked out where every pixel runs it)
+float
+VirtualTextureLod(vec2 st)
+{
+	vec2 texel = st * vec2(uVtWidth, uVtHeight);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	return clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + uVtLodBias, 0.0, uVtNumLevels - 1.0);
+}
+
+// One bilinear lookup at one level: the page table says which cache slot has the tile, or its nearest ancestor
+vec3
+VirtualTextureLevel(vec2 st, int level)
+{
+	vec2 texel = clamp(st, 0.0, 1.0) * vec2(uVtWidth, uVtHeight);
+	vec2 levelSize = max(ceil(vec2(uVtWidth, uVtHeight) / exp2(float(level))), 1.0);
+	ivec2 tile = ivec2(min(texel / exp2(float(level)), levelSize - 0.5) / VTTILESIZE);
+	vec4 entry = texelFetch(uVtPageTable, tile, level);
+
+	float residentLevel = entry.b * 255.0;
+	vec2 residentTexel = texel / exp2(residentLevel);
+	vec2 inTile = residentTexel - floor(residentTexel / VTTILESIZE) * VTTILESIZE;
+	vec2 atlasTexel = entry.rg * 255.0 * (VTTILESIZE + 2.0 * VTBORDER) + VTBORDER + inTile;
+	return textureLod(uVtAtlas, atlasTexel / vec2(textureSize(uVtAtlas, 0)), 0.0).rgb;
+}
+
+// Trilinear: blend the two levels either side of lod
+vec3
+VirtualTextureColor(vec2 st, float lod)
+{
+	int level = int(floor(lod));
+	vec3 fine = VirtualTextureLevel(st, level);
+	if (lod == float(level))
+		return fine;
+	return mix(fine, VirtualTextureLevel(st, min(level + 1, int(uVtNumLevels) - 1)), lod - float(level));
+}
+
 void
 main()
 {
 	vec3 Normal;
 	vec3 objectColor;
-	vec3 riverMapValue = texture(uRiverMapTexUnit, vST).rgb;
+#if VIRTUAL_TERRAIN
+	vec3 terrainColor = VirtualTextureColor(vST, VirtualTextureLod(vST));
+#else
+	vec3 terrainColor = texture(uTerrainTexUnit, vST).rgb;
+#endif
+	vec4 riverData = texture(uRiverDataTexUnit, vST);
 	float shinyModifier = 1.0f;
 	float specularModifier = 1.0f;
 	// If water is here, set up the water
-	// River map marks water as blue, anything else as white
-	if(riverMapValue.b - riverMapValue.r > 0.05f){
-		if(uShinyWater){
-			shinyModifier = 10.0f;
-			specularModifier = 5.0f;
-			//shinyModifier = 100.0f;
-			//specularModifier = 2.0f;
-		}
+	// River data red is how much bluer than red the river map is there: the river map marks water as blue, anything else as white
+	if(riverData.r > 0.05f){
+#if SHINY_WATER
+		shinyModifier = 10.0f;
+		specularModifier = 5.0f;
+		//shinyModifier = 100.0f;
+		//specularModifier = 2.0f;
+#endif
 		// Decide what block/tile we're in
-		int blockCol = int(floor(vST.s * uBlocks));
-		int blockRow = int(floor(vST.t * uBlocks));
+		int blockCol = int(floor(vST.s * float(BLOCKS)));
+		int blockRow = int(floor(vST.t * float(BLOCKS)));
 		// Figure out which pixel starts the block
-		int blockStartSPixel = blockCol * uBlockSize;
-		int blockStartTPixel = blockRow * uBlockSize;
+		int blockStartSPixel = blockCol * BLOCK_SIZE;
+		int blockStartTPixel = blockRow * BLOCK_SIZE;
 		
 		// Figure out the actual pixel we're on now
 		int actualTexelS = int(floor(uTerrainTextureWidth * vST.s));
@@ -57,54 +146,51 @@ main()
 		// Map the tile into S, T coordinates
 		// Each tile has its own ST coordinates. We're basically computing the current pixel as a percentage of the tile to get ST coordinates from 0..1
 		// Don't remember why it uses TexelT for BlockS, but if I change them to match the river flows across the bed instead of down it
-		float blockS = float(actualTexelT - blockStartTPixel) / float(uBlockSize);
-		float blockT = float(actualTexelS - blockStartSPixel) / float(uBlockSize);
+		float blockS = float(actualTexelT - blockStartTPixel) / float(BLOCK_SIZE);
+		float blockT = float(actualTexelS - blockStartSPixel) / float(BLOCK_SIZE);
 
 		// Water transparency
 		float alpha = 0.4;
 		// Distance that we're considering "close to land"
-		float offset = 0.002;
+		// (measured straight to the shore, this is the band the old four lookups 0.002 away used to find)
+		float offset = 0.001;
 		// Not quite sure what normal multiplier does. Maybe make lighting slightly weaker for shallow water?
 		float NormalMultiplier = 1.0;
 		// Water speed
 		float speed = 1.0;
 		// Make the water close to land slightly faster and more transparent to mimic shallow water
-		if(uUseEdgeTransparancy){
-			vec2 newSTs[4];
-			// Check above, below, left, and right of the current pixel to see if it's close to land
-			// If so, apply the shallow water settings to the current pixel
-			newSTs[0] = vec2(vST.s + offset, vST.t);
-			newSTs[1] = vec2(vST.s - offset, vST.t);
-			newSTs[2] = vec2(vST.s , vST.t + offset);
-			newSTs[3] = vec2(vST.s, vST.t - offset);
-			for(int i = 0; i < 4; i++){
-				vec3 possibleLand = texture(uRiverMapTexUnit, newSTs[i]).rgb;
-				// Found land, only need 1 section to be land so apply shallow water settings and break out of loop
-				if(possibleLand.b - possibleLand.r < 0.05f){
-					NormalMultiplier = 0.95;
-					speed = 3.0;
-					alpha = 0.2;
-					break;
-				}
-			}
+#if USE_EDGE_TRANSPARENCY
+		// River data green is the distance to the nearest land in texels, baked ahead of time,
+		// so being within offset of land is one compare rather than four more lookups
+		float shoreTexels = (riverData.g * 255.0 - RIVERDATAZERO) / RIVERDATADISTANCESCALE;
+		if(shoreTexels < offset * float(textureSize(uRiverDataTexUnit, 0).x)){
+			NormalMultiplier = 0.95;
+			speed = 3.0;
+			alpha = 0.2;
 		}
+#endif
 		// Scroll the water by varying the T on time
 		vec2 waterST = vec2(blockS, blockT + uTime * speed);
-		Normal = normalize(texture(uWaterNormalsTexUnit, waterST).rgb) * NormalMultiplier;
+		// The water normal map is in tangent space; the tiles run with s along the terrain's t (see blockS above),
+		// so its x axis is the bitangent and its y axis the tangent
+		// (only x and y are read and z is rebuilt, so a cooked two-channel BC5 map works as well as the bmp)
+		vec2 waterXY = texture(uWaterNormalsTexUnit, waterST).rg * 2.0 - 1.0;
+		vec3 waterNormal = vec3(waterXY, sqrt(max(1.0 - dot(waterXY, waterXY), 0.0)));
+		Normal = normalize(mat3(vB, vT, vN) * waterNormal) * NormalMultiplier;
 		// Hide water if requested
-		if(!uShowWater){
-			alpha = 0.0;
-			Normal = normalize(vN);
-		} else if (!uUseTransparancy){
-			// Turn off transparency of water
-			alpha = 1.0;
-		}
+#if !SHOW_WATER
+		alpha = 0.0;
+		Normal = normalize(vN);
+#elif !USE_TRANSPARENCY
+		// Turn off transparency of water
+		alpha = 1.0;
+#endif
 		// Blend the water with the terrain underneath so the riverbed is visible through the water
-		objectColor = alpha*texture(uWaterBaseTexUnit, waterST).rgb + (1 - alpha)*texture(uTerrainTexUnit, vST).rgb;;
+		objectColor = alpha*texture(uWaterBaseTexUnit, waterST).rgb + (1 - alpha)*terrainColor;
 	} else {
 		// No water here so just use terrain texture
 		Normal = normalize(vN);
-		objectColor = texture(uTerrainTexUnit, vST).rgb;
+		objectColor = terrainColor;
 	}
 
 	vec3 Light = normalize(vL);
@@ -129,5 +215,5 @@ main()
 	vec3 specular = uKs * s * uSpecularColor * specularModifier;
 
 	// Is this right?
-	gl_FragColor = vec4((ambient + diffuse) * objectColor + specular, 1.0);
+	fFragColor = vec4((ambient + diffuse) * objectColor + specular, 1.0);
 }
\ No newline at end of file
@@ -1,26 +1,66 @@
-#version 330 compatibility
+#version 330 core
+
+// Mesh vertex attributes (see vertexlayout.h)
+// Packed meshes store positions as 16-bit fractions of the bounding box and normals octahedral-encoded in xy
+// The tangent points along increasing s; its w (position w when packed) says which way the bitangent goes
+layout(location = 0) in vec4 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord0;
+layout(location = 3) in vec4 aTangent;
+
+// Undo the position quantization: object position = aPosition.xyz * aPositionScale + aPositionBias
+// These are per mesh: an instanced array for meshes in a geometry pool, constant attributes otherwise
+layout(location = 4) in vec3 aPositionScale;
+layout(location = 5) in vec3 aPositionBias;
+uniform bool uOctahedralNormals;
+
+// Set from glm on the CPU (see SetMatrixUniforms( ) in final_project.cpp); the normal matrix is in the upper 3x3
+uniform mat4 uModelViewMatrix;
+uniform mat4 uModelViewProjectionMatrix;
+uniform mat4 uNormalMatrix;
 
 out vec2 vST;
 out vec3 vN;
+out vec3 vT;
+out vec3 vB;
 out vec3 vL;
 out vec3 vE;
 
 // The sun
 const vec3 LIGHTPOSITION = vec3(30., 500., -30.);
 
+// Unfold an octahedral-encoded normal back onto the unit sphere
+vec3
+OctDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void
 main()
 {
-	// Coordinate from texture 0. OUTDATED: Apparently should be replaced with vertex attribute
-	vST = gl_MultiTexCoord0.st;
-	
+	vST = aTexCoord0;
+
+	vec4 position = vec4(aPosition.xyz * aPositionScale + aPositionBias, 1.0);
+	vec3 normal = uOctahedralNormals ? OctDecode(aNormal.xy) : aNormal;
+	// Still-streaming meshes have no tangents yet, so leave these unnormalized (zero) rather than NaN
+	vec3 tangent = uOctahedralNormals ? OctDecode(aTangent.xy) : aTangent.xyz;
+	float handedness = uOctahedralNormals ? aPosition.w * 2.0 - 1.0 : aTangent.w;
+
 	// Vertex in eye coordinates
-	vec4 ECposition = gl_ModelViewMatrix * gl_Vertex;
-	vN = normalize(gl_NormalMatrix * gl_Normal);
+	vec4 ECposition = uModelViewMatrix * position;
+	mat3 normalMatrix = mat3(uNormalMatrix);
+	vN = normalize(normalMatrix * normal);
+	vT = normalMatrix * tangent;
+	vB = cross(vN, vT) * handedness;
 	// Vector from vertex to sun
 	vL = LIGHTPOSITION - ECposition.xyz;
 	// Vector from vertex to eye position (origin)
 	vE = vec3(0., 0., 0.) - ECposition.xyz;
 
-	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+	gl_Position = uModelViewProjectionMatrix * position;
 }
\ No newline at end of file
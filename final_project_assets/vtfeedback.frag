@@ -0,0 +1,27 @@
+#version 330 core
+// Virtual texture feedback: which tile, at which level, each pixel of the terrain wants (see virtualtexture.h)
+// Packed so the CPU can read it back as plain bytes: r and g are the low 8 bits of the tile's x and y,
+// b holds their next 4 bits (x in the low half), and a is the level + 1 (0 where nothing was drawn)
+uniform float uVtWidth, uVtHeight;	// virtual texture size in texels
+uniform float uVtNumLevels;
+uniform float uVtLodBias;		// makes up for the feedback framebuffer being smaller than the window
+
+in vec2 vST;
+out vec4 fFragColor;
+
+const float VTTILESIZE = 128.0;	// keep in sync with vtexfile.h
+
+void
+main()
+{
+	vec2 texel = clamp(vST, 0.0, 1.0) * vec2(uVtWidth, uVtHeight);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + uVtLodBias, 0.0, uVtNumLevels - 1.0);
+
+	// The finer of the two levels a trilinear lookup blends; the streamer asks for its ancestors too
+	int level = int(floor(lod));
+	vec2 levelSize = max(ceil(vec2(uVtWidth, uVtHeight) / exp2(float(level))), 1.0);
+	ivec2 tile = ivec2(min(texel / exp2(float(level)), levelSize - 0.5) / VTTILESIZE);
+	fFragColor = vec4(float(tile.x & 255), float(tile.y & 255), float(((tile.x >> 8) & 15) | (((tile.y >> 8) & 15) << 4)), float(level + 1)) / 255.0;
+}
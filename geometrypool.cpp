@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+#include <string.h>
+
+#include "geometrypool.h"
+#include "glslprogram.h"
+#include "glstate.h"
+
+
+// make sure buffer (bound to target) can hold needed bytes, keeping the first used bytes
+// returns true if it had to be replaced by a bigger one
+
+bool
+GrowBuffer(GLenum target, GLuint* buffer, size_t* capacity, size_t used, size_t needed, size_t minimum)
+{
+	if (needed <= *capacity)
+		return false;
+
+	size_t newCapacity = *capacity * 2 > minimum ? *capacity * 2 : minimum;
+	if (newCapacity < needed)
+		newCapacity = needed;
+
+	GLuint bigger;
+	glGenBuffers(1, &bigger);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+	glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, NULL, GL_STATIC_DRAW);
+	if (used > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+	}
+	glDeleteBuffers(1, buffer);
+
+	*buffer = bigger;
+	*capacity = newCapacity;
+	glBindBuffer(target, bigger);
+	return true;
+}
+
+
+// the first free range big enough for count elements
+// returns false if there is none
+
+static bool
+FindRange(RangeAllocator* ranges, size_t count, size_t* first)
+{
+	for (auto free = ranges->Free.begin(); free != ranges->Free.end(); ++free)
+	{
+		if (free->second < count)
+			continue;
+
+		*first = free->first;
+		size_t rest = free->second - count;
+		ranges->Free.erase(free);
+		if (rest > 0)
+			ranges->Free[*first + count] = rest;
+		return true;
+	}
+	return false;
+}
+
+
+// give a range back, merging it with the free ranges on either side:
+
+static void
+FreeRange(RangeAllocator* ranges, size_t first, size_t count)
+{
+	if (count == 0)
+		return;
+
+	auto next = ranges->Free.lower_bound(first);
+	if (next != ranges->Free.end() && first + count == next->first)
+	{
+		count += next->second;
+		next = ranges->Free.erase(next);
+	}
+	if (next != ranges->Free.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == first)
+		{
+			previous->second += count;
+			return;
+		}
+	}
+	ranges->Free[first] = count;
+}
+
+
+// count elements of a pool buffer (bound to target), which grows when no free range is big enough
+// returns true if the buffer was replaced (and anything pointing at it has to be set up again)
+
+static bool
+AllocateRange(RangeAllocator* ranges, GLenum target, GLuint* buffer, size_t elementSize, size_t count, size_t minimum, size_t* first)
+{
+	if (FindRange(ranges, count, first))
+		return false;
+
+	size_t used = ranges->Capacity * elementSize;
+	size_t capacity = used;
+	GrowBuffer(target, buffer, &capacity, used, used + count * elementSize, minimum * elementSize);
+	FreeRange(ranges, ranges->Capacity, capacity / elementSize - ranges->Capacity);
+	ranges->Capacity = capacity / elementSize;
+	FindRange(ranges, count, first);
+	return true;
+}
+
+
+// point the vertex array at the pool's vertex buffer (bound to GL_ARRAY_BUFFER):
+
+static void
+SetupVertexAttributes(const GeometryPool& pool)
+{
+	if (pool.Format == VERTEXFORMAT_PACKED)
+		PackedVertexLayout::Setup();
+	else
+		MeshVertexLayout::Setup();
+}
+
+
+// the instanced attributes, one entry per mesh, from the buffer bound to GL_ARRAY_BUFFER:
+
+static void
+SetupMeshAttributes()
+{
+	PoolMeshLayout::Setup();
+	glVertexAttribDivisor(ATTRIB_POSITIONSCALE, 1);
+	glVertexAttribDivisor(ATTRIB_POSITIONBIAS, 1);
+}
+
+
+void
+InitGeometryPool(GeometryPool* pool, VertexFormat format)
+{
+	pool->Format = format;
+	pool->Vbo = pool->Ibo = pool->MeshBuffer = pool->IndirectBuffer = 0;
+	pool->MeshBufferCapacity = pool->IndirectCapacity = 0;
+	pool->Vertices = RangeAllocator();
+	pool->Indices = RangeAllocator();
+	pool->Meshes.clear();
+	pool->Commands.clear();
+	glGenVertexArrays(1, &pool->Vao);
+
+	// glMultiDrawElementsIndirect( ) only picks each draw's mesh entry with base instance support
+	pool->CanDoMultiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+	if (pool->CanDoMultiDrawIndirect)
+		glGenBuffers(1, &pool->IndirectBuffer);
+	else
+		fprintf(stderr, "No multi draw indirect, static geometry is drawn with glMultiDrawElementsBaseVertex( )\n");
+}
+
+
+// copy a mesh into the pool, the way UploadMeshBuffers( ) would into buffers of its own
+// (the vertices are stored in the pool's format, the indices as 32-bit whatever indexType says they are)
+// gpu shares the pool's vertex array object and is drawn by queueing its draws
+
+bool
+AddPoolMesh(GeometryPool* pool, const MeshVertex* vertices, size_t numVertices, const float bounds[6],
+	const void* indices, size_t numIndices, GLenum indexType, GpuMesh* gpu)
+{
+	gpu->Vao = pool->Vao;
+	gpu->Vbo = gpu->Ibo = 0;
+	gpu->NumIndices = (GLsizei)numIndices;
+	gpu->IndexType = GL_UNSIGNED_INT;
+	gpu->Format = pool->Format;
+	gpu->Pool = pool;
+	gpu->PoolSlot = -1;
+	for (int i = 0; i < 3; i++)
+	{
+		gpu->PositionScale[i] = 1.f;
+		gpu->PositionBias[i] = 0.f;
+	}
+	memcpy(gpu->Bounds, bounds, sizeof(gpu->Bounds));
+
+	if (numIndices == 0)
+		return false;
+
+	int slot = 0;
+	while (slot < (int)pool->Meshes.size() && pool->Meshes[slot].InUse)
+		slot++;
+	if (slot == (int)pool->Meshes.size())
+		pool->Meshes.push_back(PoolMesh());
+
+	BindVertexArray(pool->Vao);
+
+	// the vertices:
+	size_t vertexSize = pool->Format == VERTEXFORMAT_PACKED ? sizeof(PackedVertex) : sizeof(MeshVertex);
+	size_t firstVertex;
+	glBindBuffer(GL_ARRAY_BUFFER, pool->Vbo);
+	if (AllocateRange(&pool->Vertices, GL_ARRAY_BUFFER, &pool->Vbo, vertexSize, numVertices, POOLMINVERTICES, &firstVertex))
+		SetupVertexAttributes(*pool);
+	if (pool->Format == VERTEXFORMAT_PACKED)
+	{
+		std::vector<PackedVertex> packed(numVertices);
+		QuantizeVertices(vertices, numVertices, bounds, packed.data(), gpu->PositionScale, gpu->PositionBias);
+		glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, numVertices * vertexSize, packed.data());
+	}
+	else
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, numVertices * vertexSize, vertices);
+	}
+
+	// the indices:
+	size_t firstIndex;
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->Ibo);
+	AllocateRange(&pool->Indices, GL_ELEMENT_ARRAY_BUFFER, &pool->Ibo, sizeof(unsigned int), numIndices, POOLMININDICES, &firstIndex);
+	if (indexType == GL_UNSIGNED_SHORT)
+	{
+		const unsigned short* shortIndices = (const unsigned short*)indices;
+		std::vector<unsigned int> longIndices(shortIndices, shortIndices + numIndices);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(unsigned int), numIndices * sizeof(unsigned int), longIndices.data());
+	}
+	else
+	{
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(unsigned int), numIndices * sizeof(unsigned int), indices);
+	}
+
+	PoolMesh& mesh = pool->Meshes[slot];
+	mesh.InUse = true;
+	mesh.FirstVertex = firstVertex;
+	mesh.NumVertices = numVertices;
+	mesh.FirstIndex = firstIndex;
+	mesh.NumIndices = numIndices;
+	memcpy(mesh.PositionScale, gpu->PositionScale, sizeof(mesh.PositionScale));
+	memcpy(mesh.PositionBias, gpu->PositionBias, sizeof(mesh.PositionBias));
+
+	// its entry in the instanced attributes (without base instances the scale and bias are set per draw instead):
+	if (pool->CanDoMultiDrawIndirect)
+	{
+		size_t entrySize = PoolMeshLayout::Stride;
+		glBindBuffer(GL_ARRAY_BUFFER, pool->MeshBuffer);
+		if (GrowBuffer(GL_ARRAY_BUFFER, &pool->MeshBuffer, &pool->MeshBufferCapacity,
+			pool->MeshBufferCapacity, (slot + 1) * entrySize, 16 * entrySize))
+			SetupMeshAttributes();
+		float entry[6];
+		memcpy(entry, mesh.PositionScale, sizeof(mesh.PositionScale));
+		memcpy(entry + 3, mesh.PositionBias, sizeof(mesh.PositionBias));
+		glBufferSubData(GL_ARRAY_BUFFER, slot * entrySize, entrySize, entry);
+	}
+	gpu->PoolSlot = slot;
+
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	CheckGlErrors("AddPoolMesh");
+	return true;
+}
+
+
+// give a mesh's ranges back to the pool
+// (it must not have draws queued)
+
+void
+RemovePoolMesh(GeometryPool* pool, int slot)
+{
+	if (slot < 0 || slot >= (int)pool->Meshes.size() || !pool->Meshes[slot].InUse)
+		return;
+
+	PoolMesh& mesh = pool->Meshes[slot];
+	FreeRange(&pool->Vertices, mesh.FirstVertex, mesh.NumVertices);
+	FreeRange(&pool->Indices, mesh.FirstIndex, mesh.NumIndices);
+	mesh.InUse = false;
+}
+
+
+// queue count indices of a mesh, starting at first (relative to the mesh):
+
+void
+QueuePoolDraw(GeometryPool* pool, int slot, GLuint first, GLuint count)
+{
+	if (count == 0)
+		return;
+
+	const PoolMesh& mesh = pool->Meshes[slot];
+	DrawElementsIndirectCommand command = { count, 1, (GLuint)mesh.FirstIndex + first, (GLint)mesh.FirstVertex, (GLuint)slot };
+	pool->Commands.push_back(command);
+}
+
+
+// draw everything queued since last time with the program in use
+// returns the number of GL draw calls that took
+
+int
+FlushPoolDraws(GeometryPool* pool)
+{
+	const std::vector<DrawElementsIndirectCommand>& commands = pool->Commands;
+	if (commands.empty())
+		return 0;
+
+	BindVertexArray(pool->Vao);
+	int numCalls = 0;
+	if (pool->CanDoMultiDrawIndirect)
+	{
+		// a fresh buffer every time (the feedback pass flushes too), so this never waits for the GL
+		// to be done with the draws that went before
+		size_t bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+		if (bytes > pool->IndirectCapacity)
+			pool->IndirectCapacity = std::max(bytes, 2 * pool->IndirectCapacity);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pool->IndirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, pool->IndirectCapacity, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, commands.data());
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)0, (GLsizei)commands.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		numCalls = 1;
+	}
+	else
+	{
+		std::vector<GLsizei> counts;
+		std::vector<const GLvoid*> offsets;
+		std::vector<GLint> baseVertices;
+		for (size_t first = 0; first < commands.size(); )
+		{
+			GLuint slot = commands[first].BaseInstance;
+			glVertexAttrib3fv(ATTRIB_POSITIONSCALE, pool->Meshes[slot].PositionScale);
+			glVertexAttrib3fv(ATTRIB_POSITIONBIAS, pool->Meshes[slot].PositionBias);
+
+			counts.clear();
+			offsets.clear();
+			baseVertices.clear();
+			size_t next = first;
+			for (; next < commands.size() && commands[next].BaseInstance == slot; next++)
+			{
+				counts.push_back(commands[next].Count);
+				offsets.push_back((const GLvoid*)(commands[next].FirstIndex * sizeof(unsigned int)));
+				baseVertices.push_back(commands[next].BaseVertex);
+			}
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+				(GLsizei)counts.size(), baseVertices.data());
+			numCalls++;
+			first = next;
+		}
+	}
+
+	pool->Commands.clear();
+	return numCalls;
+}
+
+
+void
+DeleteGeometryPool(GeometryPool* pool)
+{
+	DeleteVertexArray(pool->Vao);
+	glDeleteBuffers(1, &pool->Vbo);
+	glDeleteBuffers(1, &pool->Ibo);
+	glDeleteBuffers(1, &pool->MeshBuffer);
+	glDeleteBuffers(1, &pool->IndirectBuffer);
+	pool->Vao = pool->Vbo = pool->Ibo = pool->MeshBuffer = pool->IndirectBuffer = 0;
+	pool->MeshBufferCapacity = pool->IndirectCapacity = 0;
+	pool->Vertices = RangeAllocator();
+	pool->Indices = RangeAllocator();
+	pool->Meshes.clear();
+	pool->Commands.clear();
+}
@@ -0,0 +1,88 @@
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include <map>
+#include <stddef.h>
+#include <vector>
+
+#include "glew.h"
+#include "mesh.h"
+
+// static meshes packed into a few big buffers and drawn with one call per program:
+//	a pool has one vertex format, one vertex buffer, and one 32-bit index buffer (grown by copying when full),
+//	and hands every mesh a range of each (first fit, freed ranges merged with their neighbors)
+//	a mesh's indices stay relative to its own first vertex, which each draw passes as its base vertex
+//	the per-mesh position scale and bias (packed vertices) come from an instanced attribute buffer,
+//	one entry per mesh, picked by the draw's base instance
+//	draws are queued (see DrawMeshLod( ) and DrawMeshlets( ) for pooled meshes) and FlushPoolDraws( )
+//	puts them in an indirect buffer and issues a single glMultiDrawElementsIndirect( )
+//
+// without GL 4.3 (or the multi draw indirect and base instance extensions) the queued draws go out with one
+// glMultiDrawElementsBaseVertex( ) per run of draws from the same mesh, its scale and bias set as constant attributes
+
+
+constexpr size_t POOLMINVERTICES{ 64 * 1024 };		// first allocation of each buffer
+constexpr size_t POOLMININDICES{ 256 * 1024 };
+
+
+// what glMultiDrawElementsIndirect( ) reads for every draw:
+
+struct DrawElementsIndirectCommand
+{
+	GLuint	Count;
+	GLuint	InstanceCount;
+	GLuint	FirstIndex;
+	GLint	BaseVertex;
+	GLuint	BaseInstance;		// the mesh's entry in the instanced attribute buffer
+};
+
+
+// the free ranges of a buffer, in elements (first -> count):
+
+struct RangeAllocator
+{
+	std::map<size_t, size_t>	Free;
+	size_t				Capacity;
+};
+
+
+// one mesh in the pool, and its entry in the instanced attribute buffer:
+
+struct PoolMesh
+{
+	bool	InUse;
+	size_t	FirstVertex, NumVertices;
+	size_t	FirstIndex, NumIndices;
+	float	PositionScale[3];
+	float	PositionBias[3];
+};
+
+typedef VertexLayout<	Attr<ATTRIB_POSITIONSCALE, 3, GL_FLOAT>,
+			Attr<ATTRIB_POSITIONBIAS, 3, GL_FLOAT> >	PoolMeshLayout;
+
+
+struct GeometryPool
+{
+	VertexFormat			Format;
+	GLuint				Vao;
+	GLuint				Vbo, Ibo;
+	GLuint				MeshBuffer;		// PoolMeshLayout, one per entry of Meshes
+	GLuint				IndirectBuffer;
+	size_t				MeshBufferCapacity;	// bytes
+	size_t				IndirectCapacity;	// bytes
+	RangeAllocator			Vertices, Indices;
+	std::vector<PoolMesh>		Meshes;
+	std::vector<DrawElementsIndirectCommand>	Commands;	// queued since the last FlushPoolDraws( )
+	bool				CanDoMultiDrawIndirect;
+};
+
+
+bool	AddPoolMesh(GeometryPool*, const MeshVertex*, size_t, const float[6], const void*, size_t, GLenum, GpuMesh*);
+void	DeleteGeometryPool(GeometryPool*);
+int	FlushPoolDraws(GeometryPool*);
+bool	GrowBuffer(GLenum, GLuint*, size_t*, size_t, size_t, size_t);
+void	InitGeometryPool(GeometryPool*, VertexFormat = VERTEXFORMAT_PACKED);
+void	QueuePoolDraw(GeometryPool*, int, GLuint, GLuint);
+void	RemovePoolMesh(GeometryPool*, int);
+
+#endif		// #ifndef GEOMETRYPOOL_H
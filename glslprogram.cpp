@@ -3,8 +3,33 @@
 #include "glm/ext.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "glstate.h"
+#include "utils.h"
+#include <string>
+#include <vector>
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
 #define NVIDIA_SHADER_BINARY	0x00008e21		// nvidia binary enum
 
+// the program binary cache: one file per set of shader sources, GL driver, and GPU,
+// named for the hash of all of them (see BinaryCacheKey( ))
+// (NULL turns it off)
+static const char* BinaryCacheDirectory = "shadercache";
+constexpr unsigned int BINARYCACHEVERSION{ 1 };
+
+struct BinaryCacheHeader
+{
+	char			Magic[4];		// "GLPB"
+	unsigned int		Version;		// BINARYCACHEVERSION
+	unsigned long long	Key;
+	unsigned int		Format;			// from glGetProgramBinary( )
+	unsigned int		Length;			// bytes of binary after the header
+};
+
 struct GLshadertype
 {
 	char* extension;
@@ -62,13 +87,25 @@ GLSLProgram::GLSLProgram()
 	InputTopology = GL_TRIANGLES;
 	OutputTopology = GL_TRIANGLE_STRIP;
 
-	CanDoComputeShaders = IsExtensionSupported("GL_ARB_compute_shader");
-	CanDoVertexShaders = IsExtensionSupported("GL_ARB_vertex_shader");
-	CanDoTessControlShaders = IsExtensionSupported("GL_ARB_tessellation_shader");
+	// (a core profile context need not list what its version has built in, so that counts too)
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	glGetError();					// (from a GL too old to know its version this way)
+	int version = 10 * major + minor;
+
+	CanDoComputeShaders = version >= 43 || IsExtensionSupported("GL_ARB_compute_shader");
+	CanDoVertexShaders = version >= 20 || IsExtensionSupported("GL_ARB_vertex_shader");
+	CanDoTessControlShaders = version >= 40 || IsExtensionSupported("GL_ARB_tessellation_shader");
 	CanDoTessEvaluationShaders = CanDoTessControlShaders;
-	CanDoGeometryShaders = IsExtensionSupported("GL_EXT_geometry_shader4");
-	CanDoFragmentShaders = IsExtensionSupported("GL_ARB_fragment_shader");
-	CanDoBinaryFiles = IsExtensionSupported("GL_ARB_get_program_binary");
+	CanDoGeometryShaders = version >= 32 || IsExtensionSupported("GL_EXT_geometry_shader4");
+	CanDoFragmentShaders = version >= 20 || IsExtensionSupported("GL_ARB_fragment_shader");
+	CanDoBinaryFiles = version >= 41 || IsExtensionSupported("GL_ARB_get_program_binary");
+	CanDoParallelCompile = IsExtensionSupported("GL_KHR_parallel_shader_compile") ||
+		IsExtensionSupported("GL_ARB_parallel_shader_compile");
+	Status = BUILD_FAILED;
+	BuildCacheable = false;
+	BuildCacheKey = 0;
 
 	fprintf(stderr, "Can do: ");
 	if (CanDoComputeShaders)		fprintf(stderr, "compute shaders, ");
@@ -77,6 +114,7 @@ GLSLProgram::GLSLProgram()
 	if (CanDoTessEvaluationShaders)	fprintf(stderr, "tess evaluation shaders, ");
 	if (CanDoGeometryShaders)		fprintf(stderr, "geometry shaders, ");
 	if (CanDoFragmentShaders)		fprintf(stderr, "fragment shaders, ");
+	if (CanDoParallelCompile)		fprintf(stderr, "parallel compiles, ");
 	if (CanDoBinaryFiles)			fprintf(stderr, "binary shader files ");
 	fprintf(stderr, "\n");
 }
@@ -99,15 +137,87 @@ GLSLProgram::Create(char* file0, char* file1, char* file2, char* file3, char* fi
 bool
 GLSLProgram::CreateHelper(char* file0, ...)
 {
-	GLsizei n = 0;
-	GLchar* buf;
+	// This is a little dicey
+	// There is no way, using var args, to know how many arguments were passed
+	// I am depending on the caller passing in a NULL as the final argument.
+	// If they don't, bad things will happen.
+
+	std::vector<char*> files;
+	va_list args;
+	va_start(args, file0);
+	for (char* file = file0; file != NULL; file = va_arg(args, char*))
+		files.push_back(file);
+	va_end(args);
+
+	return Build(files, true);
+}
+
+
+// start building the program without waiting for the driver to finish compiling and linking it
+// (which it does on threads of its own with GL_KHR_parallel_shader_compile)
+// PollBuild( ) says when it is done; until then the program must not be used
+// returns false if it failed before it got to the driver (a file is missing, say)
+
+bool
+GLSLProgram::CreateAsync(char* file0, char* file1, char* file2, char* file3, char* file4, char* file5)
+{
+	std::vector<char*> files;
+	char* all[] = { file0, file1, file2, file3, file4, file5 };
+	for (char* file : all)
+	{
+		if (file == NULL)
+			break;
+		files.push_back(file);
+	}
+
+	return Build(files, false);
+}
+
+
+// how a CreateAsync( ) is coming along: once the driver has finished (or right away, blocking until
+// it has, without GL_KHR_parallel_shader_compile) the compile and link results are checked,
+// with the same messages as Create( )
+
+GLSLProgram::BuildStatus
+GLSLProgram::PollBuild()
+{
+	if (Status != BUILD_PENDING)
+		return Status;
+
+	if (CanDoParallelCompile)
+	{
+		GLint done = GL_FALSE;
+		glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &done);
+		if (done == GL_FALSE)
+			return BUILD_PENDING;
+	}
+
+	for (auto& pending : PendingShaders)
+		FinishShader(pending.first, pending.second.c_str(), true);
+	PendingShaders.clear();
+
+	bool linked = FinishLink(false);
+	Status = linked && Valid ? BUILD_READY : BUILD_FAILED;
+	return Status;
+}
+
+
+// build the program from files, waiting for the driver or not (see CreateAsync( ))
+// returns whether it is valid (so far, when not waiting)
+
+bool
+GLSLProgram::Build(const std::vector<char*>& files, bool wait)
+{
 	Valid = true;
 
 	IncludeGstap = false;
 	Cshader = Vshader = TCshader = TEshader = Gshader = Fshader = 0;
 	Program = 0;
 	AttributeLocs.clear();
-	UniformLocs.clear();
+	ActiveUniforms.clear();
+	UniformSlots.clear();
+	PendingShaders.clear();
+	EnableParallelCompile();
 
 	if (Program == 0)
 	{
@@ -115,18 +225,48 @@ GLSLProgram::CreateHelper(char* file0, ...)
 		CheckGlErrors("glCreateProgram");
 	}
 
-	va_list args;
-	va_start(args, file0);
+	// a binary of this exact program from an earlier run skips compiling and linking altogether:
 
-	// This is a little dicey
-	// There is no way, using var args, to know how many arguments were passed
-	// I am depending on the caller passing in a NULL as the final argument.
-	// If they don't, bad things will happen.
+	BuildCacheable = BinaryCacheKey(files, &BuildCacheKey);
+	if (BuildCacheable && LoadBinaryCache(BuildCacheKey))
+	{
+		EnumerateUniforms();
+		Status = BUILD_READY;
+		return Valid;
+	}
+
+	CompileStages(files, wait);
+
+	// link the entire shader program:
+	// (asking to be able to read it back afterwards, for the cache)
+
+	if (BuildCacheable)
+		glProgramParameteri(Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(Program);
+	CheckGlErrors("Link Shader 1");
 
-	char* file = file0;
+	if (!wait)
+	{
+		Status = BUILD_PENDING;
+		return Valid;
+	}
+	bool linked = FinishLink(true);
+	Status = linked && Valid ? BUILD_READY : BUILD_FAILED;
+	return Valid;
+}
+
+
+// read and compile every stage, checking each one as it goes if wait is set
+// (otherwise they are attached as they are and checked by PollBuild( ))
+
+void
+GLSLProgram::CompileStages(const std::vector<char*>& files, bool wait)
+{
+	GLchar* buf;
 	int type;
-	while (file != NULL)
+	for (size_t fileIndex = 0; fileIndex < files.size(); fileIndex++)
 	{
+		char* file = files[fileIndex];
 		int maxBinaryTypes = sizeof(BinaryTypes) / sizeof(struct GLbinarytype);
 		type = -1;
 		char* extension = GetExtension(file);
@@ -269,7 +409,6 @@ GLSLProgram::CreateHelper(char* file0, ...)
 		{
 			FILE* in;
 			int length;
-			FILE* logfile;
 
 			in = fopen(file, "rb");
 			if (in == NULL)
@@ -290,77 +429,79 @@ GLSLProgram::CreateHelper(char* file0, ...)
 				buf[length] = '\0';
 				fclose(in);
 
-				GLchar* strings[2];
+				// the Gstap prelude and the defines go in after the #version line (which has to come first),
+				// then a #line puts the line numbers in error messages back to where they are in the file:
+
+				GLchar* strings[4];
+				GLint lengths[4];
 				int n = 0;
+				GLchar* body = buf;
+				std::string prelude;
 
-				if (IncludeGstap)
+				if (IncludeGstap || !Defines.empty())
 				{
-					strings[n] = Gstap;
+					int line = 1;
+					if (strncmp(buf, "#version", 8) == 0)
+					{
+						body = strchr(buf, '\n');
+						body = body != NULL ? body + 1 : buf + length;
+						strings[n] = buf;
+						lengths[n] = (GLint)(body - buf);
+						n++;
+						line = 2;
+					}
+
+					if (IncludeGstap)
+					{
+						strings[n] = Gstap;
+						lengths[n] = -1;
+						n++;
+					}
+
+					prelude = Defines + "#line " + std::to_string(line) + "\n";
+					strings[n] = (GLchar*)prelude.c_str();
+					lengths[n] = -1;
 					n++;
 				}
 
-				strings[n] = buf;
+				strings[n] = body;
+				lengths[n] = -1;
 				n++;
 
 				// Tell GL about the source:
 
-				glShaderSource(shader, n, (const GLchar**)strings, NULL);
+				glShaderSource(shader, n, (const GLchar**)strings, lengths);
 				delete[] buf;
 				CheckGlErrors("Shader Source");
 
 				// compile:
+				// (when not waiting, the status is checked once the build is done; see PollBuild( ))
 
 				glCompileShader(shader);
-				GLint infoLogLen;
-				GLint compileStatus;
 				CheckGlErrors("CompileShader:");
-				glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-
-				if (compileStatus == 0)
-				{
-					fprintf(stderr, "Shader '%s' did not compile.\n", file);
-					glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLen);
-					if (infoLogLen > 0)
-					{
-						GLchar* infoLog = new GLchar[infoLogLen + 1];
-						glGetShaderInfoLog(shader, infoLogLen, NULL, infoLog);
-						infoLog[infoLogLen] = '\0';
-						logfile = fopen("glsllog.txt", "w");
-						if (logfile != NULL)
-						{
-							fprintf(logfile, "\n%s\n", infoLog);
-							fclose(logfile);
-						}
-						fprintf(stderr, "\n%s\n", infoLog);
-						delete[] infoLog;
-					}
-					glDeleteShader(shader);
-					Valid = false;
-				}
+				if (wait)
+					FinishShader(shader, file, false);
 				else
 				{
-					if (Verbose)
-						fprintf(stderr, "Shader '%s' compiled.\n", file);
-
 					glAttachShader(this->Program, shader);
+					PendingShaders.push_back({ shader, file });
 				}
 			}
 		}
 
 
 
-		// go to the next vararg file:
-
-		file = va_arg(args, char*);
 	}
 
-	va_end(args);
+}
 
-	// link the entire shader program:
 
-	glLinkProgram(Program);
-	CheckGlErrors("Link Shader 1");
+// check how the link went (and validate the program, if asked -- it waits on the driver)
+// returns false if it did not link
 
+bool
+GLSLProgram::FinishLink(bool validate)
+{
 	GLchar* infoLog;
 	GLint infoLogLen;
 	GLint linkStatus;
@@ -381,12 +522,17 @@ GLSLProgram::CreateHelper(char* file0, ...)
 
 		}
 		glDeleteProgram(Program);
+		Program = 0;
 		Valid = false;
+		return false;
 	}
-	else
+
+	if (Verbose)
+		fprintf(stderr, "Shader Program linked.\n");
+	EnumerateUniforms();
+
+	if (validate)
 	{
-		if (Verbose)
-			fprintf(stderr, "Shader Program linked.\n");
 		// validate the program:
 
 		GLint status;
@@ -396,15 +542,251 @@ GLSLProgram::CreateHelper(char* file0, ...)
 		{
 			fprintf(stderr, "Program is invalid.\n");
 			Valid = false;
+			return true;
 		}
-		else
+		if (Verbose)
+			fprintf(stderr, "Shader Program validated.\n");
+	}
+	if (BuildCacheable && Valid)
+		SaveBinaryCache(BuildCacheKey);
+	return true;
+}
+
+
+// check how one stage compiled: attach it if it did (unless it already is), print the log if not
+
+void
+GLSLProgram::FinishShader(GLuint shader, const char* file, bool attached)
+{
+	GLint infoLogLen;
+	GLint compileStatus;
+	FILE* logfile;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+
+	if (compileStatus == 0)
+	{
+		fprintf(stderr, "Shader '%s' did not compile.\n", file);
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLen);
+		if (infoLogLen > 0)
 		{
-			if (Verbose)
-				fprintf(stderr, "Shader Program validated.\n");
+			GLchar* infoLog = new GLchar[infoLogLen + 1];
+			glGetShaderInfoLog(shader, infoLogLen, NULL, infoLog);
+			infoLog[infoLogLen] = '\0';
+			logfile = fopen("glsllog.txt", "w");
+			if (logfile != NULL)
+			{
+				fprintf(logfile, "\n%s\n", infoLog);
+				fclose(logfile);
+			}
+			fprintf(stderr, "\n%s\n", infoLog);
+			delete[] infoLog;
 		}
+		glDeleteShader(shader);
+		Valid = false;
 	}
+	else
+	{
+		if (Verbose)
+			fprintf(stderr, "Shader '%s' compiled.\n", file);
 
-	return Valid;
+		if (!attached)
+			glAttachShader(this->Program, shader);
+	}
+}
+
+
+// give the program back to the GL (when replacing it with a rebuilt one):
+
+void
+GLSLProgram::DeleteProgram()
+{
+	if (CurrentProgram == (int)Program)
+		Use(0);
+	if (Program != 0)
+		glDeleteProgram(Program);
+	Program = 0;
+	Valid = false;
+	Status = BUILD_FAILED;
+	PendingShaders.clear();
+}
+
+
+// have the driver compile on as many threads as it likes, if it can (once for all programs):
+
+void
+GLSLProgram::EnableParallelCompile()
+{
+	static bool enabled = false;
+	if (!CanDoParallelCompile || enabled)
+		return;
+	enabled = true;
+
+	typedef void (GLAPIENTRY* MaxShaderCompilerThreadsProc)(GLuint);
+	MaxShaderCompilerThreadsProc maxThreads = NULL;
+#ifdef WIN32
+	maxThreads = (MaxShaderCompilerThreadsProc)wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	if (maxThreads == NULL)
+		maxThreads = (MaxShaderCompilerThreadsProc)wglGetProcAddress("glMaxShaderCompilerThreadsARB");
+#endif
+	if (maxThreads != NULL)
+		maxThreads(0xffffffff);
+}
+
+
+// where (and whether) programs are cached; NULL turns the cache off
+
+void
+GLSLProgram::SetBinaryCacheDirectory(const char* directory)
+{
+	BinaryCacheDirectory = directory;
+}
+
+
+static std::string
+BinaryCacheFile(unsigned long long key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.glpb", key);
+	return std::string(BinaryCacheDirectory) + name;
+}
+
+
+// what identifies a built program: every stage's source (and which stage it is), the Gstap prelude
+// if it goes in, the defines, and the GL vendor, renderer, and version, since a binary only suits the driver that made it
+// returns false if the program cannot be cached (no cache, no binary support, or a file is not source)
+
+bool
+GLSLProgram::BinaryCacheKey(const std::vector<char*>& files, unsigned long long* key)
+{
+	if (BinaryCacheDirectory == NULL || !CanDoBinaryFiles || GetOSU(GL_NUM_PROGRAM_BINARY_FORMATS) <= 0)
+		return false;
+
+	unsigned long long h = BINARYCACHEVERSION;
+	for (char* file : files)
+	{
+		char* extension = GetExtension(file);
+		bool isSource = false;
+		for (auto& shaderType : ShaderTypes)
+			isSource = isSource || (extension != NULL && strcmp(extension, shaderType.extension) == 0);
+		if (!isSource)
+			return false;
+
+		FILE* in = fopen(file, "rb");
+		if (in == NULL)
+			return false;
+		std::vector<char> source;
+		char block[4096];
+		size_t n;
+		while ((n = fread(block, 1, sizeof(block), in)) > 0)
+			source.insert(source.end(), block, block + n);
+		fclose(in);
+
+		h = HashBytes(extension, strlen(extension), h);
+		h = HashBytes(source.data(), source.size(), h);
+	}
+	if (IncludeGstap)
+		h = HashBytes(Gstap, strlen(Gstap), h);
+	h = HashBytes(Defines.data(), Defines.size(), h);
+
+	GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : driverStrings)
+	{
+		const char* value = (const char*)glGetString(name);
+		if (value != NULL)
+			h = HashBytes(value, strlen(value), h);
+	}
+	*key = h;
+	return true;
+}
+
+
+// load the cached binary for key into the program, if there is one and the driver takes it
+// (if it does not, the program is started over so it can be built from source)
+
+bool
+GLSLProgram::LoadBinaryCache(unsigned long long key)
+{
+	std::string fileName = BinaryCacheFile(key);
+	FILE* fpin = fopen(fileName.c_str(), "rb");
+	if (fpin == NULL)
+		return false;
+
+	BinaryCacheHeader header;
+	std::vector<GLubyte> binary;
+	bool ok = fread(&header, sizeof(header), 1, fpin) == 1 && memcmp(header.Magic, "GLPB", 4) == 0 &&
+		header.Version == BINARYCACHEVERSION && header.Key == key;
+	if (ok)
+	{
+		binary.resize(header.Length);
+		ok = fread(binary.data(), 1, binary.size(), fpin) == binary.size();
+	}
+	fclose(fpin);
+
+	GLint success = 0;
+	if (ok)
+	{
+		glProgramBinary(this->Program, header.Format, binary.data(), header.Length);
+		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+	}
+	if (!success)
+	{
+		fprintf(stderr, "Binary cache file '%s' not usable, building from source\n", fileName.c_str());
+		glDeleteProgram(Program);
+		Program = glCreateProgram();
+		return false;
+	}
+
+	if (Verbose)
+		fprintf(stderr, "Shader Program loaded from binary cache file '%s'.\n", fileName.c_str());
+	return true;
+}
+
+
+// write the linked program's binary to the cache under key
+
+void
+GLSLProgram::SaveBinaryCache(unsigned long long key)
+{
+	GLint length = 0;
+	glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	BinaryCacheHeader header;
+	memcpy(header.Magic, "GLPB", 4);
+	header.Version = BINARYCACHEVERSION;
+	header.Key = key;
+	header.Length = (unsigned int)length;
+	std::vector<GLubyte> binary(length);
+	GLenum format;
+	glGetProgramBinary(this->Program, length, NULL, &format, binary.data());
+	header.Format = format;
+
+#ifdef WIN32
+	_mkdir(BinaryCacheDirectory);
+#else
+	mkdir(BinaryCacheDirectory, 0777);
+#endif
+	std::string fileName = BinaryCacheFile(key);
+	std::string tempName = fileName + ".tmp";
+	FILE* fpout = fopen(tempName.c_str(), "wb");
+	if (fpout == NULL)
+	{
+		fprintf(stderr, "Cannot create binary cache file '%s'\n", tempName.c_str());
+		return;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fpout) == 1 && fwrite(binary.data(), 1, binary.size(), fpout) == binary.size();
+	ok = fclose(fpout) == 0 && ok;
+	remove(fileName.c_str());
+	if (!ok || rename(tempName.c_str(), fileName.c_str()) != 0)
+	{
+		fprintf(stderr, "Cannot write binary cache file '%s'\n", fileName.c_str());
+		remove(tempName.c_str());
+		return;
+	}
+
+	if (Verbose)
+		fprintf(stderr, "Shader Program saved to binary cache file '%s'.\n", fileName.c_str());
 }
 
 
@@ -447,11 +829,8 @@ GLSLProgram::Use()
 void
 GLSLProgram::Use(GLuint p)
 {
-	if (p != CurrentProgram)
-	{
-		glUseProgram(p);
-		CurrentProgram = p;
-	}
+	UseProgram(p);
+	CurrentProgram = p;
 };
 
 
@@ -572,40 +951,189 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 
-	int
-		GLSLProgram::GetUniformLocation(char* name)
+	// every name that has been given a handle, by handle:
+
+	static std::vector<std::string>&
+		UniformNames()
 	{
-		std::map<char*, int>::iterator pos;
+		static std::vector<std::string> names;
+		return names;
+	}
+
+
+	// the handle for a uniform name, giving it one the first time it is seen
+	// (a hash lookup, so keep the result rather than calling this every frame)
+
+	UniformHandle
+		GetUniformHandle(const char* name)
+	{
+		static std::unordered_map<std::string, int> ids;
+		auto found = ids.find(name);
+		if (found != ids.end())
+			return UniformHandle{ found->second };
+
+		int id = (int)UniformNames().size();
+		UniformNames().push_back(name);
+		ids[name] = id;
+		return UniformHandle{ id };
+	}
+
 
-		pos = UniformLocs.find(name);
-		//if( Verbose )
-			//fprintf( stderr, "Uniform: pos = 0x%016x ; size = %d ; end = 0x%016x\n", pos, UniformLocs.size(), UniformLocs.end() );
-		if (pos == UniformLocs.end())
+	// read back the name, type, and location of every active uniform once the program has linked
+	// (arrays are listed as "name[0]", so they are found by their plain name too)
+
+	void
+		GLSLProgram::EnumerateUniforms()
+	{
+		ActiveUniforms.clear();
+		UniformSlots.clear();
+
+		GLint numUniforms = 0, maxLength = 0;
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &numUniforms);
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> name(maxLength + 1);
+		for (GLint i = 0; i < numUniforms; i++)
 		{
-			GLuint loc = glGetUniformLocation(this->Program, name);
-			UniformLocs[name] = loc;
+			ActiveUniform uniform;
+			GLsizei length = 0;
+			glGetActiveUniform(this->Program, (GLuint)i, (GLsizei)name.size(), &length, &uniform.Size, &uniform.Type, name.data());
+			name[length] = '\0';
+			uniform.Location = glGetUniformLocation(this->Program, name.data());
+			if (uniform.Location < 0)
+				continue;		// in a uniform block
+
+			std::string uniformName(name.data(), length);
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+				uniformName.resize(uniformName.size() - 3);
+			ActiveUniforms[uniformName] = uniform;
 			if (Verbose)
-				fprintf(stderr, "Location of '%s' in Program %d = %d\n", name, this->Program, loc);
+				fprintf(stderr, "Uniform '%s' in Program %d: location %d, type 0x%04x, size %d\n",
+					uniformName.c_str(), this->Program, uniform.Location, uniform.Type, uniform.Size);
 		}
-		else
+	}
+
+
+	int
+		GLSLProgram::GetNumActiveUniforms()
+	{
+		return (int)ActiveUniforms.size();
+	}
+
+
+	// have the program read uniform block name from binding point binding (see uniformbuffer.h)
+	// returns the block's size in bytes, or -1 if the program has no such block
+
+	int
+		GLSLProgram::BindUniformBlock(char* name, GLuint binding)
+	{
+		GLuint index = glGetUniformBlockIndex(this->Program, name);
+		if (index == GL_INVALID_INDEX)
 		{
 			if (Verbose)
+				fprintf(stderr, "Program %d has no uniform block '%s'\n", this->Program, name);
+			return -1;
+		}
+
+		GLint size;
+		glUniformBlockBinding(this->Program, index, binding);
+		glGetActiveUniformBlockiv(this->Program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+		return size;
+	}
+
+
+	// where to put a new value for the uniform, unless the program already has that value
+	// returns false if there is nothing to do (the value is unchanged, or the program has no such uniform)
+
+	bool
+		GLSLProgram::UniformChanged(UniformHandle handle, const void* value, size_t size, GLint* location)
+	{
+		if (handle.Id >= (int)UniformSlots.size())
+		{
+			// first time this program has seen these handles:
+			size_t first = UniformSlots.size();
+			UniformSlots.resize(UniformNames().size());
+			for (size_t id = first; id < UniformSlots.size(); id++)
 			{
-				fprintf(stderr, "Location = %d\n", UniformLocs[name]);
-				if (UniformLocs[name] == -1)
-					fprintf(stderr, "Location of uniform variable '%s' is -1\n", name);
+				auto found = ActiveUniforms.find(UniformNames()[id]);
+				UniformSlots[id].Location = found != ActiveUniforms.end() ? found->second.Location : -1;
+				UniformSlots[id].Known = false;
+				if (Verbose && UniformSlots[id].Location < 0)
+					fprintf(stderr, "Program %d has no uniform variable '%s'\n", this->Program, UniformNames()[id].c_str());
 			}
 		}
 
-		return UniformLocs[name];
+		UniformSlot& slot = UniformSlots[handle.Id];
+		if (slot.Location < 0)
+			return false;
+		if (size <= sizeof(slot.Value))
+		{
+			if (slot.Known && memcmp(slot.Value, value, size) == 0)
+				return false;
+			memcpy(slot.Value, value, size);
+			slot.Known = true;
+		}
+		*location = slot.Location;
+		return true;
+	}
+
+
+	// the slow way, by name:
+
+	int
+		GLSLProgram::GetUniformLocation(char* name)
+	{
+		auto found = ActiveUniforms.find(name);
+		return found != ActiveUniforms.end() ? found->second.Location : -1;
 	};
 
 
 	void
 		GLSLProgram::SetUniformVariable(char* name, int val)
 	{
-		int loc;
-		if ((loc = GetUniformLocation(name)) >= 0)
+		SetUniformVariable(GetUniformHandle(name), val);
+	};
+
+
+	void
+		GLSLProgram::SetUniformVariable(char* name, float val)
+	{
+		SetUniformVariable(GetUniformHandle(name), val);
+	};
+
+
+	void
+		GLSLProgram::SetUniformVariable(char* name, float val0, float val1, float val2)
+	{
+		SetUniformVariable(GetUniformHandle(name), val0, val1, val2);
+	};
+
+
+	void
+		GLSLProgram::SetUniformVariable(char* name, float vals[3])
+	{
+		SetUniformVariable(GetUniformHandle(name), vals);
+	};
+
+	void
+	GLSLProgram::SetUniformVariable(char* name, glm::mat4& matrix)
+	{
+		SetUniformVariable(GetUniformHandle(name), matrix);
+	};
+
+	void
+		GLSLProgram::SetUniformVariable(char* name, glm::vec3& vec)
+	{
+		SetUniformVariable(GetUniformHandle(name), vec);
+	};
+
+
+	// the fast way, by handle:
+
+	void
+		GLSLProgram::SetUniformVariable(UniformHandle handle, int val)
+	{
+		GLint loc;
+		if (UniformChanged(handle, &val, sizeof(val), &loc))
 		{
 			this->Use();
 			glUniform1i(loc, val);
@@ -614,11 +1142,10 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 	void
-		GLSLProgram::SetUniformVariable(char* name, float val)
+		GLSLProgram::SetUniformVariable(UniformHandle handle, float val)
 	{
-		int loc;
-		
-		if ((loc = GetUniformLocation(name)) >= 0)
+		GLint loc;
+		if (UniformChanged(handle, &val, sizeof(val), &loc))
 		{
 			this->Use();
 			glUniform1f(loc, val);
@@ -627,10 +1154,11 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 	void
-		GLSLProgram::SetUniformVariable(char* name, float val0, float val1, float val2)
+		GLSLProgram::SetUniformVariable(UniformHandle handle, float val0, float val1, float val2)
 	{
-		int loc;
-		if ((loc = GetUniformLocation(name)) >= 0)
+		GLint loc;
+		float vals[3] = { val0, val1, val2 };
+		if (UniformChanged(handle, vals, sizeof(vals), &loc))
 		{
 			this->Use();
 			glUniform3f(loc, val0, val1, val2);
@@ -639,47 +1167,39 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 
 
 	void
-		GLSLProgram::SetUniformVariable(char* name, float vals[3])
+		GLSLProgram::SetUniformVariable(UniformHandle handle, float vals[3])
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		GLint loc;
+		if (UniformChanged(handle, vals, 3 * sizeof(float), &loc))
 		{
 			this->Use();
-			glUniform3fv(loc, 3, vals);
+			glUniform3fv(loc, 1, vals);
 		}
 	};
 
 	void
-	GLSLProgram::SetUniformVariable(char* name, glm::mat4& matrix)
+	GLSLProgram::SetUniformVariable(UniformHandle handle, glm::mat4& matrix)
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		GLint loc;
+		if (UniformChanged(handle, value_ptr(matrix), sizeof(matrix), &loc))
 		{
 			this->Use();
-			//fprintf(stderr, "%s mat4\n", name);
-			//glUniformMatrix4fv(loc, 16, true, &matrix[0][0]);
 			glUniformMatrix4fv(loc, 1, false, value_ptr(matrix));
 		}
 	};
 
 	void
-		GLSLProgram::SetUniformVariable(char* name, glm::vec3& vec)
+		GLSLProgram::SetUniformVariable(UniformHandle handle, glm::vec3& vec)
 	{
-		int loc;
-
-		if ((loc = GetUniformLocation(name)) >= 0)
+		GLint loc;
+		if (UniformChanged(handle, value_ptr(vec), sizeof(vec), &loc))
 		{
 			this->Use();
-			//fprintf(stderr, "%s vec3\n", name);
 			glUniform3fv(loc, 1, value_ptr(vec) );
 		}
 	};
 
-	
-	
-	
+
 
 
 
@@ -719,9 +1239,27 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 		if (where != 0)
 			return false;
 
-		// get the full list of extensions:
+		// a core profile context only lists them one at a time:
+
+		if (glGetStringi != NULL)
+		{
+			GLint numExtensions = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+			for (GLint i = 0; i < numExtensions; i++)
+			{
+				const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+				if (name != NULL && strcmp(name, extension) == 0)
+					return true;
+			}
+			if (numExtensions > 0)
+				return false;
+		}
+
+		// otherwise get the full list of extensions:
 
 		const GLubyte* extensions = glGetString(GL_EXTENSIONS);
+		if (extensions == NULL)
+			return false;
 
 		for (const GLubyte* start = extensions; ; )
 		{
@@ -844,6 +1382,16 @@ GLSLProgram::SetAttributeVariable(char* name, VertexBufferObject& vb, GLenum whi
 	}
 
 
+	// add a #define to the top of every stage (call before Create( ))
+	// each different set of defines is a program of its own, and an entry of its own in the binary cache
+
+	void
+		GLSLProgram::Define(const char* name, int value)
+	{
+		Defines += "#define " + std::string(name) + " " + std::to_string(value) + "\n";
+	}
+
+
 	const char *tmp =
 	{
 	"#ifndef GSTAP_H\n\
@@ -17,11 +17,20 @@
 #include "glm/glm.hpp"
 #include <map>
 #include <stdarg.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifndef GL_COMPUTE_SHADER
 #define GL_COMPUTE_SHADER	0x91B9
 #endif
 
+// GL_KHR_parallel_shader_compile (newer than the glew here):
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR	0x91B0
+#define GL_COMPLETION_STATUS_KHR		0x91B1
+#endif
+
 
 inline int GetOSU(int flag)
 {
@@ -34,9 +43,30 @@ inline int GetOSU(int flag)
 void	CheckGlErrors(const char*);
 
 
+// a uniform's name turned into a small number once (usually into a static at startup),
+// so setting it is an array lookup instead of a search by name
+// the same name gets the same handle in every program
+
+struct UniformHandle
+{
+	int	Id;
+};
+
+UniformHandle	GetUniformHandle(const char*);
+
+
 
 class GLSLProgram
 {
+public:
+	// how a build started with CreateAsync( ) is going:
+	enum BuildStatus
+	{
+		BUILD_PENDING,
+		BUILD_READY,
+		BUILD_FAILED
+	};
+
 private:
 	std::map<char*, int>	AttributeLocs;
 	char* Cfile;
@@ -46,6 +76,7 @@ private:
 	char* Gfile;
 	GLuint			Gshader;
 	bool			IncludeGstap;
+	std::string		Defines;		// #define lines put in after the #version line
 	GLenum			InputTopology;
 	GLenum			OutputTopology;
 	GLuint			Program;
@@ -53,7 +84,6 @@ private:
 	GLuint			TCshader;
 	char* TEfile;
 	GLuint			TEshader;
-	std::map<char*, int>	UniformLocs;
 	bool			Valid;
 	char* Vfile;
 	GLuint			Vshader;
@@ -69,16 +99,57 @@ private:
 	bool	CanDoTessControlShaders;
 	bool	CanDoTessEvaluationShaders;
 	bool	CanDoVertexShaders;
+	bool	CanDoParallelCompile;
 	int	CompileShader(GLuint);
 	bool	CreateHelper(char*, ...);
 	int	GetAttributeLocation(char*);
 	int	GetUniformLocation(char*);
 
+	// every active uniform, read back once the program links:
+	struct ActiveUniform
+	{
+		GLint	Location;
+		GLenum	Type;
+		GLint	Size;			// array elements
+	};
+	std::unordered_map<std::string, ActiveUniform>	ActiveUniforms;
+
+	// by handle: where it is and what it was last set to, so setting it again to the same value costs nothing
+	struct UniformSlot
+	{
+		GLint		Location;	// -1 if the program has no such uniform
+		bool		Known;		// Value is what the program has
+		unsigned char	Value[64];
+	};
+	std::vector<UniformSlot>	UniformSlots;
+
+	void	EnumerateUniforms();
+
+	bool	BinaryCacheKey(const std::vector<char*>&, unsigned long long*);
+	bool	LoadBinaryCache(unsigned long long);
+	void	SaveBinaryCache(unsigned long long);
+	bool	UniformChanged(UniformHandle, const void*, size_t, GLint*);
+
+	// the build in progress (or done):
+	BuildStatus					Status;
+	bool						BuildCacheable;
+	unsigned long long				BuildCacheKey;
+	std::vector<std::pair<GLuint, std::string>>	PendingShaders;		// compiled but not checked yet, with their files
+
+	bool	Build(const std::vector<char*>&, bool);
+	void	CompileStages(const std::vector<char*>&, bool);
+	void	EnableParallelCompile();
+	bool	FinishLink(bool);
+	void	FinishShader(GLuint, const char*, bool);
+
 
 public:
 	GLSLProgram();
 
 	bool	Create(char*, char* = NULL, char* = NULL, char* = NULL, char* = NULL, char* = NULL);
+	bool	CreateAsync(char*, char* = NULL, char* = NULL, char* = NULL, char* = NULL, char* = NULL);
+	BuildStatus	PollBuild();
+	void	DeleteProgram();
 	void	DispatchCompute(GLuint, GLuint = 1, GLuint = 1);
 	bool	IsExtensionSupported(const char*);
 	bool	IsNotValid();
@@ -101,6 +172,7 @@ public:
 	void	SetAttributeVariable(char*, VertexBufferObject&, GLenum);
 #endif
 	void	SetGstap(bool);
+	void	Define(const char*, int = 1);
 	void	SetInputTopology(GLenum);
 	void	SetOutputTopology(GLenum);
 	void	SetUniformVariable(char*, int);
@@ -109,8 +181,17 @@ public:
 	void	SetUniformVariable(char*, float[3]);
 	void	SetUniformVariable(char*, glm::mat4 &);
 	void	SetUniformVariable(char*, glm::vec3 &);
+	void	SetUniformVariable(UniformHandle, int);
+	void	SetUniformVariable(UniformHandle, float);
+	void	SetUniformVariable(UniformHandle, float, float, float);
+	void	SetUniformVariable(UniformHandle, float[3]);
+	void	SetUniformVariable(UniformHandle, glm::mat4 &);
+	void	SetUniformVariable(UniformHandle, glm::vec3 &);
+	int	GetNumActiveUniforms();
+	int	BindUniformBlock(char*, GLuint);
 
 	void	SetVerbose(bool);
+	static void	SetBinaryCacheDirectory(const char*);
 	void	Use();
 	void	Use(GLuint);
 	void	UseFixedFunction();
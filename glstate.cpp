@@ -0,0 +1,221 @@
+#include <string.h>
+
+#include "glstate.h"
+
+
+constexpr GLuint UNKNOWN{ 0xffffffff };		// not a name the GL hands out
+
+// the capabilities that are tracked (any other goes straight through):
+static const GLenum Capabilities[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE };
+constexpr int NUMCAPABILITIES{ sizeof(Capabilities) / sizeof(Capabilities[0]) };
+
+static struct
+{
+	GLuint		ActiveUnit;
+	GLuint		Textures[GLSTATEMAXUNITS];
+	GLuint		Program;
+	GLuint		Vao;
+	int		Enabled[NUMCAPABILITIES];	// -1 if unknown
+	GLenum		BlendSrc, BlendDst;		// UNKNOWN if unknown
+	int		DepthMask;			// -1 if unknown
+	bool		ViewportKnown;
+	GLint		Viewport[4];
+} State;
+
+static GlStateCounters Counters;
+static bool Initialized = false;
+
+
+// counts the call, and returns whether it has to go to the GL:
+
+static bool
+Changes(bool changes)
+{
+	if (changes)
+		Counters.Submitted++;
+	else
+		Counters.Skipped++;
+	return changes;
+}
+
+
+static void
+Initialize()
+{
+	if (!Initialized)
+		InvalidateGlState();
+}
+
+
+void
+InvalidateGlState()
+{
+	Initialized = true;
+	State.ActiveUnit = UNKNOWN;
+	for (GLuint& texture : State.Textures)
+		texture = UNKNOWN;
+	State.Program = UNKNOWN;
+	State.Vao = UNKNOWN;
+	for (int& enabled : State.Enabled)
+		enabled = -1;
+	State.BlendSrc = State.BlendDst = UNKNOWN;
+	State.DepthMask = -1;
+	State.ViewportKnown = false;
+}
+
+
+// bind a 2D texture to a unit (the only kind of texture there is here)
+// (units past GLSTATEMAXUNITS are not tracked)
+
+void
+BindTexture(int unit, GLuint texture)
+{
+	Initialize();
+	bool tracked = unit >= 0 && unit < GLSTATEMAXUNITS;
+	if (tracked && !Changes(State.Textures[unit] != texture))
+		return;
+
+	if (Changes(State.ActiveUnit != (GLuint)unit))
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		State.ActiveUnit = unit;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if (tracked)
+		State.Textures[unit] = texture;
+	else
+		Counters.Submitted++;
+}
+
+
+void
+UseProgram(GLuint program)
+{
+	Initialize();
+	if (!Changes(State.Program != program))
+		return;
+	glUseProgram(program);
+	State.Program = program;
+}
+
+
+void
+BindVertexArray(GLuint vao)
+{
+	Initialize();
+	if (!Changes(State.Vao != vao))
+		return;
+	glBindVertexArray(vao);
+	State.Vao = vao;
+}
+
+
+void
+SetCapability(GLenum capability, bool enabled)
+{
+	Initialize();
+	int which = 0;
+	while (which < NUMCAPABILITIES && Capabilities[which] != capability)
+		which++;
+	if (which < NUMCAPABILITIES && !Changes(State.Enabled[which] != (int)enabled))
+		return;
+	if (which == NUMCAPABILITIES)
+		Counters.Submitted++;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+	if (which < NUMCAPABILITIES)
+		State.Enabled[which] = enabled;
+}
+
+
+void
+SetBlendFunc(GLenum src, GLenum dst)
+{
+	Initialize();
+	if (!Changes(State.BlendSrc != src || State.BlendDst != dst))
+		return;
+	glBlendFunc(src, dst);
+	State.BlendSrc = src;
+	State.BlendDst = dst;
+}
+
+
+void
+SetDepthMask(bool write)
+{
+	Initialize();
+	if (!Changes(State.DepthMask != (int)write))
+		return;
+	glDepthMask(write ? GL_TRUE : GL_FALSE);
+	State.DepthMask = write;
+}
+
+
+void
+SetViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	Initialize();
+	GLint viewport[4] = { x, y, width, height };
+	if (!Changes(!State.ViewportKnown || memcmp(State.Viewport, viewport, sizeof(viewport)) != 0))
+		return;
+	glViewport(x, y, width, height);
+	memcpy(State.Viewport, viewport, sizeof(viewport));
+	State.ViewportKnown = true;
+}
+
+
+// the viewport, from the copy when there is one (no round trip to the GL)
+
+void
+GetViewport(GLint viewport[4])
+{
+	Initialize();
+	if (!State.ViewportKnown)
+	{
+		glGetIntegerv(GL_VIEWPORT, State.Viewport);
+		State.ViewportKnown = true;
+	}
+	memcpy(viewport, State.Viewport, sizeof(State.Viewport));
+}
+
+
+// deleting a texture unbinds it from every unit, and its name may come back for a new one:
+
+void
+DeleteTexture(GLuint texture)
+{
+	Initialize();
+	glDeleteTextures(1, &texture);
+	for (GLuint& bound : State.Textures)
+	{
+		if (bound == texture)
+			bound = 0;
+	}
+}
+
+
+void
+DeleteVertexArray(GLuint vao)
+{
+	Initialize();
+	glDeleteVertexArrays(1, &vao);
+	if (State.Vao == vao)
+		State.Vao = 0;
+}
+
+
+const GlStateCounters&
+GetGlStateCounters()
+{
+	return Counters;
+}
+
+
+void
+ResetGlStateCounters()
+{
+	Counters.Submitted = Counters.Skipped = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "glew.h"
+
+// a copy of the GL state that gets set over and over, so setting something to what it already is
+// makes no GL call at all:
+//	the 2D texture bound to each unit and the active unit, the program, the vertex array object,
+//	blending, depth testing and writes, backface culling, and the viewport
+// everything that changes these has to do it through here or the copy goes wrong, deleting textures and
+// vertex array objects included (InvalidateGlState( ) forgets it all, for after code that does not)
+// textures are bound to unit 0 to be filled in or changed, and left there
+// the counters say how many calls went to the GL and how many were skipped, since ResetGlStateCounters( )
+
+
+constexpr int GLSTATEMAXUNITS{ 16 };
+
+
+struct GlStateCounters
+{
+	int	Submitted;
+	int	Skipped;
+};
+
+
+void	BindTexture(int, GLuint);
+void	UseProgram(GLuint);
+void	BindVertexArray(GLuint);
+void	SetCapability(GLenum, bool);
+void	SetBlendFunc(GLenum, GLenum);
+void	SetDepthMask(bool);
+void	SetViewport(GLint, GLint, GLsizei, GLsizei);
+void	GetViewport(GLint[4]);
+void	DeleteTexture(GLuint);
+void	DeleteVertexArray(GLuint);
+void	InvalidateGlState();
+
+const GlStateCounters&	GetGlStateCounters();
+void	ResetGlStateCounters();
+
+#endif		// #ifndef GLSTATE_H
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ktx2.h"
+#include "mappedfile.h"
+
+
+static const unsigned char KTX2IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+constexpr size_t KTX2HEADERBYTES{ 80 };			// identifier, header, and index
+constexpr size_t KTX2LEVELINDEXBYTES{ 24 };		// per level: offset, length, uncompressed length
+
+// data format descriptor values (Khronos Data Format spec):
+
+constexpr unsigned int KHR_DF_MODEL_BC1A{ 128 };
+constexpr unsigned int KHR_DF_MODEL_BC4{ 131 };
+constexpr unsigned int KHR_DF_MODEL_BC5{ 132 };
+constexpr unsigned int KHR_DF_PRIMARIES_BT709{ 1 };
+constexpr unsigned int KHR_DF_TRANSFER_LINEAR{ 1 };
+constexpr unsigned int KHR_DF_TRANSFER_SRGB{ 2 };
+
+
+static unsigned int
+Read32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+static unsigned long long
+Read64(const unsigned char* p)
+{
+	return Read32(p) | ((unsigned long long)Read32(p + 4) << 32);
+}
+
+
+static void
+Put32(std::vector<unsigned char>* bytes, size_t offset, unsigned int value)
+{
+	for (int i = 0; i < 4; i++)
+		(*bytes)[offset + i] = (unsigned char)(value >> (8 * i));
+}
+
+
+static void
+Put64(std::vector<unsigned char>* bytes, size_t offset, unsigned long long value)
+{
+	Put32(bytes, offset, (unsigned int)value);
+	Put32(bytes, offset + 4, (unsigned int)(value >> 32));
+}
+
+
+// bytes per 4x4 block, or 0 if this is not a format the cooker writes:
+
+int
+Ktx2BlockBytes(unsigned int vkFormat)
+{
+	switch (vkFormat)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return 16;
+	}
+	return 0;
+}
+
+
+// check the headers of a mapped .ktx2 file and find its mip levels
+// returns false (after saying why) if the file cannot be used
+
+bool
+ParseKtx2File(const char* filename, const MappedFile& file, Ktx2Image* image)
+{
+	const unsigned char* bytes = (const unsigned char*)file.Data();
+	size_t size = file.Size();
+
+	if (size < KTX2HEADERBYTES || memcmp(bytes, KTX2IDENTIFIER, sizeof(KTX2IDENTIFIER)) != 0)
+	{
+		fprintf(stderr, "File '%s' is not a KTX2 file\n", filename);
+		return false;
+	}
+
+	image->VkFormat = Read32(bytes + 12);
+	unsigned int typeSize = Read32(bytes + 16);
+	image->Width = (int)Read32(bytes + 20);
+	image->Height = (int)Read32(bytes + 24);
+	unsigned int depth = Read32(bytes + 28);
+	unsigned int layers = Read32(bytes + 32);
+	unsigned int faces = Read32(bytes + 36);
+	image->NumLevels = (int)Read32(bytes + 40);
+	unsigned int supercompression = Read32(bytes + 44);
+	unsigned int kvdOffset = Read32(bytes + 56);
+	unsigned int kvdBytes = Read32(bytes + 60);
+
+	if (Ktx2BlockBytes(image->VkFormat) == 0 || typeSize != 1)
+	{
+		fprintf(stderr, "KTX2 file '%s' has format %u, which is not one of the cooker's\n", filename, image->VkFormat);
+		return false;
+	}
+	if (image->Width <= 0 || image->Height <= 0 || depth != 0 || layers > 1 || faces != 1 || supercompression != 0 ||
+		image->NumLevels < 1 || image->NumLevels > KTX2MAXLEVELS)
+	{
+		fprintf(stderr, "KTX2 file '%s' is not a plain 2D texture\n", filename);
+		return false;
+	}
+	if (KTX2HEADERBYTES + KTX2LEVELINDEXBYTES * image->NumLevels > size)
+	{
+		fprintf(stderr, "KTX2 file '%s' is too short\n", filename);
+		return false;
+	}
+
+	// every level has to be all there:
+
+	int blockBytes = Ktx2BlockBytes(image->VkFormat);
+	for (int level = 0; level < image->NumLevels; level++)
+	{
+		const unsigned char* entry = bytes + KTX2HEADERBYTES + KTX2LEVELINDEXBYTES * level;
+		unsigned long long offset = Read64(entry);
+		unsigned long long length = Read64(entry + 8);
+
+		int w = image->Width >> level > 0 ? image->Width >> level : 1;
+		int h = image->Height >> level > 0 ? image->Height >> level : 1;
+		unsigned long long needed = (unsigned long long)((w + 3) / 4) * ((h + 3) / 4) * blockBytes;
+		if (offset > size || length > size - offset || length != needed)
+		{
+			fprintf(stderr, "KTX2 file '%s' has a bad mip level %d\n", filename, level);
+			return false;
+		}
+		image->Levels[level] = bytes + offset;
+		image->LevelBytes[level] = (size_t)length;
+	}
+
+	// look for KTXswizzle in the key/value data:
+
+	strcpy(image->Swizzle, "rgba");
+	if (kvdOffset <= size && kvdBytes <= size - kvdOffset)
+	{
+		const unsigned char* kv = bytes + kvdOffset;
+		const unsigned char* end = kv + kvdBytes;
+		while (end - kv >= 4)
+		{
+			unsigned int length = Read32(kv);
+			const char* key = (const char*)kv + 4;
+			if (length > (size_t)(end - kv) - 4)
+				break;
+			if (length == sizeof("KTXswizzle") + 5 && memcmp(key, "KTXswizzle", sizeof("KTXswizzle")) == 0)
+			{
+				memcpy(image->Swizzle, key + sizeof("KTXswizzle"), 4);
+				image->Swizzle[4] = '\0';
+			}
+			kv += 4 + ((length + 3) & ~3u);
+		}
+	}
+
+	return true;
+}
+
+
+// append one key/value entry (both strings, stored with their terminating nulls):
+
+static void
+AddKeyValue(std::vector<unsigned char>* kvd, const char* key, const char* value)
+{
+	size_t keyBytes = strlen(key) + 1;
+	size_t valueBytes = strlen(value) + 1;
+	size_t start = kvd->size();
+	kvd->resize(start + 4 + ((keyBytes + valueBytes + 3) & ~(size_t)3), 0);
+	Put32(kvd, start, (unsigned int)(keyBytes + valueBytes));
+	memcpy(kvd->data() + start + 4, key, keyBytes);
+	memcpy(kvd->data() + start + 4 + keyBytes, value, valueBytes);
+}
+
+
+// the basic data format descriptor for one of the cooker's block formats:
+
+static std::vector<unsigned char>
+MakeDataFormatDescriptor(unsigned int vkFormat)
+{
+	unsigned int model = KHR_DF_MODEL_BC1A;
+	if (vkFormat == VK_FORMAT_BC4_UNORM_BLOCK)
+		model = KHR_DF_MODEL_BC4;
+	if (vkFormat == VK_FORMAT_BC5_UNORM_BLOCK)
+		model = KHR_DF_MODEL_BC5;
+	unsigned int transfer = vkFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR;
+	int numSamples = vkFormat == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+	unsigned int blockSize = 24 + 16 * numSamples;
+
+	std::vector<unsigned char> dfd(4 + blockSize, 0);
+	Put32(&dfd, 0, 4 + blockSize);					// total size
+	Put32(&dfd, 4, 0);						// vendor 0 (Khronos), descriptor type 0 (basic)
+	Put32(&dfd, 8, 2 | (blockSize << 16));				// version 2
+	Put32(&dfd, 12, model | (KHR_DF_PRIMARIES_BT709 << 8) | (transfer << 16));
+	Put32(&dfd, 16, 3 | (3 << 8));					// 4x4 texel blocks (stored minus one)
+	Put32(&dfd, 20, Ktx2BlockBytes(vkFormat));			// bytes in plane 0
+
+	// one 64-bit sample per channel (BC5 has red then green):
+	for (int s = 0; s < numSamples; s++)
+	{
+		size_t sample = 28 + 16 * s;
+		Put32(&dfd, sample, (64 * s) | (63 << 16) | (s << 24));	// bit offset, bit length - 1, channel
+		Put32(&dfd, sample + 4, 0);					// sample position
+		Put32(&dfd, sample + 8, 0);					// lower
+		Put32(&dfd, sample + 12, 0xffffffff);				// upper
+	}
+	return dfd;
+}
+
+
+// write a .ktx2 file with levels[0] as the full size image and each later level half the size
+// of the one before (swizzle may be NULL)
+// returns false if the file cannot be written
+
+bool
+WriteKtx2File(const char* filename, unsigned int vkFormat, int width, int height,
+	const std::vector<std::vector<unsigned char>>& levels, const char* swizzle)
+{
+	int numLevels = (int)levels.size();
+	int blockBytes = Ktx2BlockBytes(vkFormat);
+	if (blockBytes == 0 || numLevels < 1 || numLevels > KTX2MAXLEVELS)
+	{
+		fprintf(stderr, "Cannot write KTX2 file '%s': format %u with %d levels\n", filename, vkFormat, numLevels);
+		return false;
+	}
+
+	std::vector<unsigned char> dfd = MakeDataFormatDescriptor(vkFormat);
+	std::vector<unsigned char> kvd;
+	if (swizzle != NULL)
+		AddKeyValue(&kvd, "KTXswizzle", swizzle);
+	AddKeyValue(&kvd, "KTXwriter", "river texture cooker");
+
+	size_t dfdOffset = KTX2HEADERBYTES + KTX2LEVELINDEXBYTES * numLevels;
+	size_t kvdOffset = dfdOffset + dfd.size();
+
+	// the levels go smallest first, each on a block boundary:
+	std::vector<size_t> levelOffsets(numLevels);
+	size_t end = kvdOffset + kvd.size();
+	for (int level = numLevels - 1; level >= 0; level--)
+	{
+		end = (end + blockBytes - 1) / blockBytes * blockBytes;
+		levelOffsets[level] = end;
+		end += levels[level].size();
+	}
+
+	std::vector<unsigned char> bytes(end, 0);
+	memcpy(bytes.data(), KTX2IDENTIFIER, sizeof(KTX2IDENTIFIER));
+	Put32(&bytes, 12, vkFormat);
+	Put32(&bytes, 16, 1);				// type size
+	Put32(&bytes, 20, width);
+	Put32(&bytes, 24, height);
+	Put32(&bytes, 28, 0);				// depth
+	Put32(&bytes, 32, 0);				// layers
+	Put32(&bytes, 36, 1);				// faces
+	Put32(&bytes, 40, numLevels);
+	Put32(&bytes, 44, 0);				// no supercompression
+	Put32(&bytes, 48, (unsigned int)dfdOffset);
+	Put32(&bytes, 52, (unsigned int)dfd.size());
+	Put32(&bytes, 56, (unsigned int)kvdOffset);
+	Put32(&bytes, 60, (unsigned int)kvd.size());
+	Put64(&bytes, 64, 0);				// no supercompression global data
+	Put64(&bytes, 72, 0);
+
+	for (int level = 0; level < numLevels; level++)
+	{
+		size_t entry = KTX2HEADERBYTES + KTX2LEVELINDEXBYTES * level;
+		Put64(&bytes, entry, levelOffsets[level]);
+		Put64(&bytes, entry + 8, levels[level].size());
+		Put64(&bytes, entry + 16, levels[level].size());
+		memcpy(bytes.data() + levelOffsets[level], levels[level].data(), levels[level].size());
+	}
+	memcpy(bytes.data() + dfdOffset, dfd.data(), dfd.size());
+	memcpy(bytes.data() + kvdOffset, kvd.data(), kvd.size());
+
+	FILE* fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot create KTX2 file '%s'\n", filename);
+		return false;
+	}
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		fprintf(stderr, "Cannot write KTX2 file '%s'\n", filename);
+	return ok;
+}
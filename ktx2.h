@@ -0,0 +1,41 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <stddef.h>
+#include <vector>
+
+class MappedFile;
+
+// just enough of the KTX2 container for the texture cooker's output:
+//	one 2D image with a full mip chain, block-compressed, no supercompression
+//	an optional KTXswizzle entry (e.g. "rg01") saying how the stored channels map to rgba
+
+
+// the formats the cooker writes, as KTX2 stores them (Vulkan format numbers):
+
+constexpr unsigned int VK_FORMAT_BC1_RGB_UNORM_BLOCK{ 131 };
+constexpr unsigned int VK_FORMAT_BC1_RGB_SRGB_BLOCK{ 132 };
+constexpr unsigned int VK_FORMAT_BC4_UNORM_BLOCK{ 139 };
+constexpr unsigned int VK_FORMAT_BC5_UNORM_BLOCK{ 141 };
+
+constexpr int KTX2MAXLEVELS{ 16 };
+
+
+// where the pieces of a mapped .ktx2 file are:
+
+struct Ktx2Image
+{
+	unsigned int		VkFormat;
+	int			Width, Height;
+	int			NumLevels;
+	const unsigned char*	Levels[KTX2MAXLEVELS];		// level 0 is the full size image, inside the mapped file
+	size_t			LevelBytes[KTX2MAXLEVELS];
+	char			Swizzle[5];			// "rgba" if the file does not say
+};
+
+
+int	Ktx2BlockBytes(unsigned int);
+bool	ParseKtx2File(const char*, const MappedFile&, Ktx2Image*);
+bool	WriteKtx2File(const char*, unsigned int, int, int, const std::vector<std::vector<unsigned char>>&, const char*);
+
+#endif		// #ifndef KTX2_H
@@ -0,0 +1,157 @@
+#include <stdio.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+
+MappedFile::MappedFile()
+{
+	Bytes = NULL;
+	Length = 0;
+#ifdef WIN32
+	File = INVALID_HANDLE_VALUE;
+	Mapping = NULL;
+#else
+	Fd = -1;
+#endif
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+// map the whole file read-only
+// an empty file opens successfully but has no data
+
+bool
+MappedFile::Open(const char* filename)
+{
+	Close();
+
+#ifdef WIN32
+	File = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Cannot open file '%s' for mapping\n", filename);
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(File, &size) || (unsigned long long)size.QuadPart > (size_t)-1)
+	{
+		fprintf(stderr, "Cannot map file '%s': bad size\n", filename);
+		Close();
+		return false;
+	}
+	Length = (size_t)size.QuadPart;
+
+	if (Length == 0)
+		return true;
+
+	Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Mapping == NULL)
+	{
+		fprintf(stderr, "Cannot create file mapping for '%s'\n", filename);
+		Close();
+		return false;
+	}
+
+	Bytes = (const char*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (Bytes == NULL)
+	{
+		fprintf(stderr, "Cannot map view of file '%s'\n", filename);
+		Close();
+		return false;
+	}
+#else
+	Fd = open(filename, O_RDONLY);
+	if (Fd < 0)
+	{
+		fprintf(stderr, "Cannot open file '%s' for mapping\n", filename);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(Fd, &st) != 0)
+	{
+		fprintf(stderr, "Cannot map file '%s': bad size\n", filename);
+		Close();
+		return false;
+	}
+	Length = (size_t)st.st_size;
+
+	if (Length == 0)
+		return true;
+
+	void* p = mmap(NULL, Length, PROT_READ, MAP_PRIVATE, Fd, 0);
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map file '%s'\n", filename);
+		Close();
+		return false;
+	}
+	Bytes = (const char*)p;
+	madvise(p, Length, MADV_SEQUENTIAL);
+#endif
+
+	return true;
+}
+
+
+void
+MappedFile::Close()
+{
+#ifdef WIN32
+	if (Bytes != NULL)
+		UnmapViewOfFile(Bytes);
+	if (Mapping != NULL)
+		CloseHandle(Mapping);
+	if (File != INVALID_HANDLE_VALUE)
+		CloseHandle(File);
+	Mapping = NULL;
+	File = INVALID_HANDLE_VALUE;
+#else
+	if (Bytes != NULL)
+		munmap((void*)Bytes, Length);
+	if (Fd >= 0)
+		close(Fd);
+	Fd = -1;
+#endif
+	Bytes = NULL;
+	Length = 0;
+}
+
+
+const char*
+MappedFile::Data() const
+{
+	return Bytes;
+}
+
+
+bool
+MappedFile::IsOpen() const
+{
+#ifdef WIN32
+	return File != INVALID_HANDLE_VALUE;
+#else
+	return Fd >= 0;
+#endif
+}
+
+
+size_t
+MappedFile::Size() const
+{
+	return Length;
+}
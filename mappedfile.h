@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+
+// read-only view of an entire file mapped into memory
+// (the bytes are NOT null-terminated -- always stop at Data( ) + Size( ))
+
+class MappedFile
+{
+private:
+	const char*		Bytes;
+	size_t			Length;
+#ifdef WIN32
+	HANDLE			File;
+	HANDLE			Mapping;
+#else
+	int			Fd;
+#endif
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool		Open(const char*);
+	void		Close();
+	const char*	Data() const;
+	bool		IsOpen() const;
+	size_t		Size() const;
+};
+
+#endif		// #ifndef MAPPEDFILE_H
@@ -0,0 +1,463 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "geometrypool.h"
+#include "glm/gtc/packing.hpp"
+#include "glslprogram.h"
+#include "glstate.h"
+#include "mesh.h"
+#include "objreader.h"
+#include "threadpool.h"
+#include "utils.h"
+
+
+// identifies one unique mesh vertex
+// (corners without an obj normal share vertices too -- ComputeTangentFrames( ) gives them smooth normals later)
+
+struct CornerKey
+{
+	int	v, t, n;
+
+	bool operator==(const CornerKey& other) const
+	{
+		return v == other.v && t == other.t && n == other.n;
+	}
+};
+
+
+struct CornerKeyHash
+{
+	size_t operator()(const CornerKey& key) const
+	{
+		size_t h = (size_t)key.v * 0x9E3779B1u;
+		h ^= (size_t)key.t * 0x85EBCA77u + (h << 6) + (h >> 2);
+		h ^= (size_t)key.n * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+		return h;
+	}
+};
+
+
+// every vertex the builder has made so far, by what it was made from:
+
+struct CornerTable : public std::unordered_map<CornerKey, unsigned int, CornerKeyHash>
+{
+};
+
+
+MeshBuilder::MeshBuilder(Mesh* mesh)
+{
+	Target = mesh;
+	Unique = new CornerTable;
+}
+
+
+MeshBuilder::~MeshBuilder()
+{
+	delete Unique;
+}
+
+
+// get ready for about this many vertices in all:
+
+void
+MeshBuilder::Reserve(size_t numVertices)
+{
+	Unique->reserve(numVertices);
+}
+
+
+// add the triangles in obj.Corners[ firstCorner .. firstCorner+numCorners ), merging identical corners
+// (every vertex, normal, and texture coord they use has to be in obj already)
+
+void
+MeshBuilder::AddTriangles(const ObjData& obj, size_t firstCorner, size_t numCorners)
+{
+	Mesh* mesh = Target;
+
+	size_t lastCorner = firstCorner + numCorners;
+	for (size_t it = firstCorner; it + 2 < lastCorner; it += 3)
+	{
+		const struct face* vertices = &obj.Corners[it];
+
+		// get the planar normal, in case vertex normals are not defined
+		// (only used until ComputeTangentFrames( ) runs, e.g. while the mesh is streaming in):
+
+		const struct Vertex* v0 = &obj.Vertices[vertices[0].v - 1];
+		const struct Vertex* v1 = &obj.Vertices[vertices[1].v - 1];
+		const struct Vertex* v2 = &obj.Vertices[vertices[2].v - 1];
+
+		float v01[3], v02[3], norm[3];
+		v01[0] = v1->x - v0->x;
+		v01[1] = v1->y - v0->y;
+		v01[2] = v1->z - v0->z;
+		v02[0] = v2->x - v0->x;
+		v02[1] = v2->y - v0->y;
+		v02[2] = v2->z - v0->z;
+		Cross(v01, v02, norm);
+		Unit(norm, norm);
+
+		for (int vtx = 0; vtx < 3; vtx++)
+		{
+			CornerKey key;
+			key.v = vertices[vtx].v;
+			key.t = vertices[vtx].t;
+			key.n = vertices[vtx].n;
+
+			auto found = Unique->find(key);
+			if (found != Unique->end())
+			{
+				mesh->Indices.push_back(found->second);
+				continue;
+			}
+
+			MeshVertex mv;
+			const struct Vertex* vp = &obj.Vertices[key.v - 1];
+			mv.x = vp->x;
+			mv.y = vp->y;
+			mv.z = vp->z;
+
+			if (key.n != 0)
+			{
+				const struct Normal* np = &obj.Normals[key.n - 1];
+				mv.nx = np->nx;
+				mv.ny = np->ny;
+				mv.nz = np->nz;
+				mv.tw = 1.f;
+			}
+			else
+			{
+				// a stand-in until the smooth normal gets made:
+				mv.nx = norm[0];
+				mv.ny = norm[1];
+				mv.nz = norm[2];
+				mv.tw = 0.f;
+			}
+			mv.tx = mv.ty = mv.tz = 0.f;
+
+			mv.s = mv.t = 0.f;
+			if (key.t != 0)
+			{
+				const struct TextureCoord* tp = &obj.TextureCoords[key.t - 1];
+				mv.s = tp->s;
+				mv.t = tp->t;
+			}
+
+			unsigned int index = (unsigned int)mesh->Vertices.size();
+			mesh->Vertices.push_back(mv);
+			mesh->Indices.push_back(index);
+			Unique->emplace(key, index);
+		}
+	}
+}
+
+
+// turn the obj corners into an indexed mesh, merging identical corners:
+
+void
+BuildMesh(const ObjData& obj, Mesh* mesh)
+{
+	mesh->Vertices.clear();
+	mesh->Indices.clear();
+	mesh->xmin = obj.xmin;	mesh->ymin = obj.ymin;	mesh->zmin = obj.zmin;
+	mesh->xmax = obj.xmax;	mesh->ymax = obj.ymax;	mesh->zmax = obj.zmax;
+
+	mesh->Vertices.reserve(obj.Corners.size() / 4);
+	mesh->Indices.reserve(obj.Corners.size());
+
+	MeshBuilder builder(mesh);
+	builder.Reserve(obj.Corners.size() / 4);
+	builder.AddTriangles(obj, 0, obj.Corners.size());
+
+	fprintf(stderr, "Mesh: %d triangles, %d corners -> %d unique vertices\n",
+		(int)obj.Corners.size() / 3, (int)obj.Corners.size(), (int)mesh->Vertices.size());
+}
+
+
+static float
+Clamp(float value, float low, float high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+
+// octahedral normal encoding: fold the unit sphere onto the |x|+|y|+|z| = 1 octahedron
+// and unfold the lower half over the corners of the upper half's square
+
+static void
+OctEncode(float nx, float ny, float nz, short* ex, short* ey)
+{
+	float l1 = fabsf(nx) + fabsf(ny) + fabsf(nz);
+	if (l1 == 0.f)
+	{
+		*ex = *ey = 0;
+		return;
+	}
+
+	float u = nx / l1;
+	float v = ny / l1;
+	if (nz < 0.f)
+	{
+		float fu = (1.f - fabsf(v)) * (u >= 0.f ? 1.f : -1.f);
+		float fv = (1.f - fabsf(u)) * (v >= 0.f ? 1.f : -1.f);
+		u = fu;
+		v = fv;
+	}
+
+	*ex = (short)lroundf(Clamp(u, -1.f, 1.f) * 32767.f);
+	*ey = (short)lroundf(Clamp(v, -1.f, 1.f) * 32767.f);
+}
+
+
+// what the GPU gets back out (same as OctDecode( ) in river.vert):
+
+static void
+OctDecode(short ex, short ey, float n[3])
+{
+	n[0] = fmaxf(ex / 32767.f, -1.f);
+	n[1] = fmaxf(ey / 32767.f, -1.f);
+	n[2] = 1.f - fabsf(n[0]) - fabsf(n[1]);
+	float t = fmaxf(-n[2], 0.f);
+	n[0] += n[0] >= 0.f ? -t : t;
+	n[1] += n[1] >= 0.f ? -t : t;
+	Unit(n, n);
+}
+
+
+// pack float vertices, quantizing positions inside bounds (xmin, ymin, zmin, xmax, ymax, zmax)
+// scale and bias get what the vertex shader needs to undo the quantization
+
+void
+QuantizeVertices(const MeshVertex* vertices, size_t numVertices, const float bounds[6], PackedVertex* packed, float scale[3], float bias[3])
+{
+	float toUnorm[3];
+	for (int i = 0; i < 3; i++)
+	{
+		float extent = bounds[3 + i] - bounds[i];
+		bias[i] = bounds[i];
+		scale[i] = extent / 65535.f;
+		toUnorm[i] = extent > 0.f ? 65535.f / extent : 0.f;
+	}
+
+	const size_t BLOCKSIZE = 64 * 1024;
+	int numBlocks = (int)((numVertices + BLOCKSIZE - 1) / BLOCKSIZE);
+	ParallelFor(numBlocks, [=](int block)
+	{
+		size_t first = (size_t)block * BLOCKSIZE;
+		size_t last = first + BLOCKSIZE < numVertices ? first + BLOCKSIZE : numVertices;
+		for (size_t i = first; i < last; i++)
+		{
+			const MeshVertex& v = vertices[i];
+			PackedVertex& p = packed[i];
+			p.x = (unsigned short)lroundf(Clamp((v.x - bias[0]) * toUnorm[0], 0.f, 65535.f));
+			p.y = (unsigned short)lroundf(Clamp((v.y - bias[1]) * toUnorm[1], 0.f, 65535.f));
+			p.z = (unsigned short)lroundf(Clamp((v.z - bias[2]) * toUnorm[2], 0.f, 65535.f));
+			p.w = v.tw < 0.f ? 0 : 65535;
+			OctEncode(v.nx, v.ny, v.nz, &p.nx, &p.ny);
+			p.s = glm::packHalf1x16(v.s);
+			p.t = glm::packHalf1x16(v.t);
+			OctEncode(v.tx, v.ty, v.tz, &p.tx, &p.ty);
+		}
+	});
+}
+
+
+// compare the packed vertices against the float ones and print the worst errors
+// (positions relative to the bounding box size, normals in degrees, texture coords absolute)
+
+void
+CheckQuantizedMesh(const Mesh& mesh)
+{
+	float bounds[6] = { mesh.xmin, mesh.ymin, mesh.zmin, mesh.xmax, mesh.ymax, mesh.zmax };
+	std::vector<PackedVertex> packed(mesh.Vertices.size());
+	float scale[3], bias[3];
+	QuantizeVertices(mesh.Vertices.data(), mesh.Vertices.size(), bounds, packed.data(), scale, bias);
+
+	float maxPosition = 0.f, maxAngle = 0.f, maxTexCoord = 0.f;
+	for (size_t i = 0; i < packed.size(); i++)
+	{
+		const MeshVertex& v = mesh.Vertices[i];
+		const PackedVertex& p = packed[i];
+
+		float dx = p.x * scale[0] + bias[0] - v.x;
+		float dy = p.y * scale[1] + bias[1] - v.y;
+		float dz = p.z * scale[2] + bias[2] - v.z;
+		maxPosition = fmaxf(maxPosition, sqrtf(dx * dx + dy * dy + dz * dz));
+
+		float n[3], vn[3] = { v.nx, v.ny, v.nz };
+		OctDecode(p.nx, p.ny, n);
+		if (Unit(vn, vn) > 0.f)		// degenerate triangles have no normal to compare
+		{
+			float cosine = Clamp(n[0] * vn[0] + n[1] * vn[1] + n[2] * vn[2], -1.f, 1.f);
+			maxAngle = fmaxf(maxAngle, acosf(cosine));
+		}
+
+		float tangent[3], vt[3] = { v.tx, v.ty, v.tz };
+		OctDecode(p.tx, p.ty, tangent);
+		if (Unit(vt, vt) > 0.f)
+		{
+			float cosine = Clamp(tangent[0] * vt[0] + tangent[1] * vt[1] + tangent[2] * vt[2], -1.f, 1.f);
+			maxAngle = fmaxf(maxAngle, acosf(cosine));
+		}
+
+		maxTexCoord = fmaxf(maxTexCoord, fabsf(glm::unpackHalf1x16(p.s) - v.s));
+		maxTexCoord = fmaxf(maxTexCoord, fabsf(glm::unpackHalf1x16(p.t) - v.t));
+	}
+
+	float dx = mesh.xmax - mesh.xmin, dy = mesh.ymax - mesh.ymin, dz = mesh.zmax - mesh.zmin;
+	float diagonal = sqrtf(dx * dx + dy * dy + dz * dz);
+	fprintf(stderr, "Packed vertices: %d -> %d bytes each, max error: position %.2g of the box, normal/tangent %.3f degrees, texture %.2g\n",
+		(int)sizeof(MeshVertex), (int)sizeof(PackedVertex),
+		diagonal > 0.f ? maxPosition / diagonal : 0.f, maxAngle * (180.f / 3.14159265f), maxTexCoord);
+}
+
+
+// copy a mesh into a vertex buffer, an index buffer, and a vertex array object
+// the vertices are stored in the given format (packed ones are quantized inside bounds)
+// and feed the generic attributes at ATTRIB_POSITION, ATTRIB_NORMAL and ATTRIB_TEXCOORD
+// (indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT and says what the indices array holds)
+// given a pool, the mesh goes into that instead, in the pool's format
+
+bool
+UploadMeshBuffers(const MeshVertex* vertices, size_t numVertices, const float bounds[6],
+	const void* indices, size_t numIndices, GLenum indexType, VertexFormat format, GpuMesh* gpu, GeometryPool* pool)
+{
+	if (pool != NULL)
+		return AddPoolMesh(pool, vertices, numVertices, bounds, indices, numIndices, indexType, gpu);
+
+	gpu->Vao = gpu->Vbo = gpu->Ibo = 0;
+	gpu->Pool = NULL;
+	gpu->PoolSlot = -1;
+	gpu->NumIndices = (GLsizei)numIndices;
+	gpu->IndexType = indexType;
+	gpu->Format = format;
+	for (int i = 0; i < 3; i++)
+	{
+		gpu->PositionScale[i] = 1.f;
+		gpu->PositionBias[i] = 0.f;
+	}
+	memcpy(gpu->Bounds, bounds, sizeof(gpu->Bounds));
+
+	if (numIndices == 0)
+		return false;
+
+	glGenVertexArrays(1, &gpu->Vao);
+	BindVertexArray(gpu->Vao);
+
+	glGenBuffers(1, &gpu->Vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gpu->Vbo);
+	if (format == VERTEXFORMAT_PACKED)
+	{
+		std::vector<PackedVertex> packed(numVertices);
+		QuantizeVertices(vertices, numVertices, bounds, packed.data(), gpu->PositionScale, gpu->PositionBias);
+		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+		PackedVertexLayout::Setup();
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(MeshVertex), vertices, GL_STATIC_DRAW);
+		MeshVertexLayout::Setup();
+	}
+
+	size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+	glGenBuffers(1, &gpu->Ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu->Ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, indices, GL_STATIC_DRAW);
+
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	CheckGlErrors("UploadMeshBuffers");
+	return true;
+}
+
+
+// use 16-bit indices whenever they are big enough:
+
+bool
+UploadMesh(const Mesh& mesh, GpuMesh* gpu, VertexFormat format, GeometryPool* pool)
+{
+	float bounds[6] = { mesh.xmin, mesh.ymin, mesh.zmin, mesh.xmax, mesh.ymax, mesh.zmax };
+	gpu->Meshlets = mesh.Meshlets;
+	gpu->Lods = mesh.Lods;
+	if (mesh.Vertices.size() <= 65536)
+	{
+		std::vector<unsigned short> shortIndices(mesh.Indices.begin(), mesh.Indices.end());
+		return UploadMeshBuffers(mesh.Vertices.data(), mesh.Vertices.size(), bounds,
+			shortIndices.data(), shortIndices.size(), GL_UNSIGNED_SHORT, format, gpu, pool);
+	}
+
+	return UploadMeshBuffers(mesh.Vertices.data(), mesh.Vertices.size(), bounds,
+		mesh.Indices.data(), mesh.Indices.size(), GL_UNSIGNED_INT, format, gpu, pool);
+}
+
+
+// tell the (active) program how to unpack this mesh's vertices
+// (the position scale and bias are constant attributes, which a pool's vertex array replaces with its per-mesh ones)
+
+void
+SetMeshUniforms(GLSLProgram* program, const GpuMesh& gpu)
+{
+	static const UniformHandle uOctahedralNormals = GetUniformHandle("uOctahedralNormals");
+	glVertexAttrib3fv(ATTRIB_POSITIONSCALE, gpu.PositionScale);
+	glVertexAttrib3fv(ATTRIB_POSITIONBIAS, gpu.PositionBias);
+	program->SetUniformVariable(uOctahedralNormals, gpu.Format == VERTEXFORMAT_PACKED ? 1 : 0);
+}
+
+
+void
+DrawMesh(const GpuMesh& gpu)
+{
+	DrawMeshLod(gpu, 0);
+}
+
+
+// draw one level of detail (a mesh without levels only has level 0, all of its indices):
+
+void
+DrawMeshLod(const GpuMesh& gpu, int lod)
+{
+	if (gpu.Vao == 0)
+		return;
+
+	GLsizei count = gpu.NumIndices;
+	size_t first = 0;
+	if (lod >= 0 && lod < (int)gpu.Lods.size())
+	{
+		count = gpu.Lods[lod].IndexCount;
+		first = gpu.Lods[lod].FirstIndex;
+	}
+
+	if (gpu.Pool != NULL)
+	{
+		QueuePoolDraw(gpu.Pool, gpu.PoolSlot, (GLuint)first, (GLuint)count);
+		return;
+	}
+
+	size_t indexSize = (gpu.IndexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+	BindVertexArray(gpu.Vao);
+	glDrawElements(GL_TRIANGLES, count, gpu.IndexType, (const GLvoid*)(first * indexSize));
+}
+
+
+void
+DeleteMesh(GpuMesh* gpu)
+{
+	if (gpu->Pool != NULL)
+		RemovePoolMesh(gpu->Pool, gpu->PoolSlot);
+	else
+	{
+		DeleteVertexArray(gpu->Vao);
+		glDeleteBuffers(1, &gpu->Vbo);
+		glDeleteBuffers(1, &gpu->Ibo);
+	}
+	gpu->Vao = gpu->Vbo = gpu->Ibo = 0;
+	gpu->Pool = NULL;
+	gpu->PoolSlot = -1;
+	gpu->NumIndices = 0;
+	gpu->Meshlets.clear();
+	gpu->Lods.clear();
+}
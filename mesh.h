@@ -0,0 +1,141 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <vector>
+
+#include "glew.h"
+#include "meshlet.h"
+#include "simplify.h"
+#include "vertexlayout.h"
+
+class GLSLProgram;
+struct GeometryPool;
+struct ObjData;
+
+
+// bump this whenever BuildMesh( ) starts producing different output,
+// so stale binary mesh caches get thrown away:
+
+constexpr unsigned int MESHLOADERVERSION{ 5 };
+
+
+// one interleaved vertex, laid out exactly the way it is uploaded
+// the tangent points along increasing s, and tw is the handedness of the bitangent (+1 or -1)
+// before ComputeTangentFrames( ) has run, tw = 0 marks vertices whose obj corners had no normal
+
+struct MeshVertex
+{
+	float x, y, z;
+	float nx, ny, nz;
+	float s, t;
+	float tx, ty, tz, tw;
+};
+
+typedef VertexLayout<	Attr<ATTRIB_POSITION, 3, GL_FLOAT>,
+			Attr<ATTRIB_NORMAL, 3, GL_FLOAT>,
+			Attr<ATTRIB_TEXCOORD, 2, GL_FLOAT>,
+			Attr<ATTRIB_TANGENT, 4, GL_FLOAT> >		MeshVertexLayout;
+
+static_assert(sizeof(MeshVertex) == MeshVertexLayout::Stride, "MeshVertex does not match its layout");
+
+
+// the same vertex in 20 bytes instead of 48:
+//	position	16-bit unorm inside the mesh bounding box (w is the handedness, 0 = -1, 1 = +1)
+//	normal		octahedral encoding, 2 x 16-bit snorm
+//	texture coords	2 x half float
+//	tangent		octahedral encoding, 2 x 16-bit snorm
+
+struct PackedVertex
+{
+	unsigned short	x, y, z, w;
+	short		nx, ny;
+	unsigned short	s, t;
+	short		tx, ty;
+};
+
+typedef VertexLayout<	Attr<ATTRIB_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE>,
+			Attr<ATTRIB_NORMAL, 2, GL_SHORT, GL_TRUE>,
+			Attr<ATTRIB_TEXCOORD, 2, GL_HALF_FLOAT>,
+			Attr<ATTRIB_TANGENT, 2, GL_SHORT, GL_TRUE> >	PackedVertexLayout;
+
+static_assert(sizeof(PackedVertex) == PackedVertexLayout::Stride, "PackedVertex does not match its layout");
+
+
+enum VertexFormat
+{
+	VERTEXFORMAT_FLOAT,		// MeshVertex
+	VERTEXFORMAT_PACKED		// PackedVertex
+};
+
+
+// an indexed triangle mesh (3 indices per triangle)
+// every unique (v,t,n) corner of the obj file becomes one vertex
+
+struct Mesh
+{
+	std::vector<MeshVertex>		Vertices;
+	std::vector<unsigned int>	Indices;
+	std::vector<Meshlet>		Meshlets;	// cover the level 0 indices in order, once BuildMeshlets( ) has run
+	std::vector<MeshLod>		Lods;		// once BuildMeshLods( ) has run (the coarser levels follow level 0 in Indices)
+
+	float	xmin, ymin, zmin;
+	float	xmax, ymax, zmax;
+};
+
+
+// a mesh that lives in GPU buffers, its own or a range of a pool's
+// (a pooled mesh shares the pool's vertex array object, and drawing it only queues its draws: see geometrypool.h)
+
+struct GpuMesh
+{
+	GLuint	Vao;
+	GLuint	Vbo;			// 0 when pooled
+	GLuint	Ibo;
+	GeometryPool*	Pool;		// NULL if the mesh has buffers of its own
+	int		PoolSlot;
+	GLsizei	NumIndices;
+	GLenum	IndexType;		// GL_UNSIGNED_SHORT when every index fits, else GL_UNSIGNED_INT
+
+	VertexFormat	Format;
+	float		PositionScale[3];	// object position = attribute * scale + bias
+	float		PositionBias[3];
+	float		Bounds[6];		// xmin, ymin, zmin, xmax, ymax, zmax
+
+	std::vector<Meshlet>	Meshlets;
+	std::vector<MeshLod>	Lods;
+};
+
+
+// turns obj triangles into an indexed mesh a batch at a time, so a mesh can be
+// built while its obj file is still being read (BuildMesh( ) does it all at once)
+
+class MeshBuilder
+{
+private:
+	Mesh*			Target;
+	struct CornerTable*	Unique;
+
+	MeshBuilder(const MeshBuilder&) = delete;
+	MeshBuilder& operator=(const MeshBuilder&) = delete;
+
+public:
+	MeshBuilder(Mesh*);
+	~MeshBuilder();
+
+	void	AddTriangles(const ObjData&, size_t, size_t);
+	void	Reserve(size_t);
+};
+
+
+void	BuildMesh(const ObjData&, Mesh*);
+void	CheckQuantizedMesh(const Mesh&);
+void	DeleteMesh(GpuMesh*);
+void	DrawMesh(const GpuMesh&);
+void	DrawMeshLod(const GpuMesh&, int);
+void	QuantizeVertices(const MeshVertex*, size_t, const float[6], PackedVertex*, float[3], float[3]);
+void	SetMeshUniforms(GLSLProgram*, const GpuMesh&);
+bool	UploadMesh(const Mesh&, GpuMesh*, VertexFormat = VERTEXFORMAT_PACKED, GeometryPool* = NULL);
+bool	UploadMeshBuffers(const MeshVertex*, size_t, const float[6], const void*, size_t, GLenum, VertexFormat, GpuMesh*,
+		GeometryPool* = NULL);
+
+#endif		// #ifndef MESH_H
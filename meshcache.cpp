@@ -0,0 +1,335 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "glew.h"
+#include "mappedfile.h"
+#include "mesh.h"
+#include "meshcache.h"
+#include "utils.h"
+
+
+// the vertex format this build writes and expects to read:
+
+static int
+DescribeMeshVertex(RmeshAttribute attributes[RMESHMAXATTRIBUTES])
+{
+	static_assert(MeshVertexLayout::NumAttributes <= RMESHMAXATTRIBUTES, "too many vertex attributes for an rmesh");
+
+	memset(attributes, 0, RMESHMAXATTRIBUTES * sizeof(RmeshAttribute));
+	MeshVertexLayout::Describe(attributes);
+	return MeshVertexLayout::NumAttributes;
+}
+
+
+// "final_project_assets/final_terrain.obj" -> "final_project_assets/final_terrain.rmesh":
+
+std::string
+MeshCacheName(const char* objName)
+{
+	return ChangeExtension(objName, ".rmesh");
+}
+
+
+// whether count items of size bytes starting at offset all lie inside a file of fileSize bytes
+// (without overflowing on made-up offsets and counts)
+
+static bool
+InsideFile(unsigned long long offset, unsigned long long count, unsigned long long size, unsigned long long fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+
+// map the cache for objName and check that it is still good
+// *staleTime is set to the obj's modification time if the header's is out of date but the contents
+// are the same (see RefreshMeshCache( )), otherwise to -1
+// returns the header (pointing into file) or NULL
+
+static const RmeshHeader*
+OpenMeshCache(const char* objName, MappedFile* file, long long* staleTime)
+{
+	*staleTime = -1;
+
+	std::string cacheName = MeshCacheName(objName);
+
+	struct stat st;
+	if (stat(cacheName.c_str(), &st) != 0)
+		return NULL;
+
+	if (!file->Open(cacheName.c_str()))
+		return NULL;
+
+	const RmeshHeader* header = (const RmeshHeader*)file->Data();
+	if (file->Size() < sizeof(RmeshHeader) || memcmp(header->Magic, "RMSH", 4) != 0)
+	{
+		fprintf(stderr, "Mesh cache '%s' is not an rmesh file\n", cacheName.c_str());
+		return NULL;
+	}
+
+	if (header->FormatVersion != RMESHFORMATVERSION || header->LoaderVersion != MESHLOADERVERSION)
+	{
+		fprintf(stderr, "Mesh cache '%s' is from an older loader\n", cacheName.c_str());
+		return NULL;
+	}
+
+	RmeshAttribute attributes[RMESHMAXATTRIBUTES];
+	int numAttributes = DescribeMeshVertex(attributes);
+	if ((int)header->NumAttributes != numAttributes || header->VertexStride != sizeof(MeshVertex) ||
+		memcmp(header->Attributes, attributes, sizeof(attributes)) != 0)
+	{
+		fprintf(stderr, "Mesh cache '%s' has a different vertex format\n", cacheName.c_str());
+		return NULL;
+	}
+
+	if ((header->IndexSize != 2 && header->IndexSize != 4) || header->MeshletSize != sizeof(Meshlet))
+		return NULL;
+
+	unsigned long long fileSize = file->Size();
+	if (!InsideFile(header->VertexOffset, header->NumVertices, header->VertexStride, fileSize) ||
+		!InsideFile(header->IndexOffset, header->NumIndices, header->IndexSize, fileSize) ||
+		!InsideFile(header->MeshletOffset, header->NumMeshlets, sizeof(Meshlet), fileSize) ||
+		!InsideFile(header->LodOffset, header->NumLods, sizeof(MeshLod), fileSize))
+	{
+		fprintf(stderr, "Mesh cache '%s' is truncated\n", cacheName.c_str());
+		return NULL;
+	}
+
+	// the meshlets and levels of detail have to stay inside the index blob:
+	const Meshlet* meshlets = (const Meshlet*)(file->Data() + header->MeshletOffset);
+	for (unsigned int i = 0; i < header->NumMeshlets; i++)
+	{
+		if (meshlets[i].FirstIndex > header->NumIndices || meshlets[i].IndexCount > header->NumIndices - meshlets[i].FirstIndex)
+		{
+			fprintf(stderr, "Mesh cache '%s' has a meshlet outside its indices\n", cacheName.c_str());
+			return NULL;
+		}
+	}
+	const MeshLod* lods = (const MeshLod*)(file->Data() + header->LodOffset);
+	for (unsigned int i = 0; i < header->NumLods; i++)
+	{
+		if (lods[i].FirstIndex > header->NumIndices || lods[i].IndexCount > header->NumIndices - lods[i].FirstIndex)
+		{
+			fprintf(stderr, "Mesh cache '%s' has a level of detail outside its indices\n", cacheName.c_str());
+			return NULL;
+		}
+	}
+
+
+	// the same size and modification time means the hash in the header is still right,
+	// otherwise the obj has to be hashed again to see if the contents really changed:
+
+	unsigned long long sourceSize;
+	long long sourceTime = FileTime(objName, &sourceSize);
+	if (sourceTime < 0)
+	{
+		fprintf(stderr, "Source '%s' is missing, using mesh cache '%s' as is\n", objName, cacheName.c_str());
+		return header;
+	}
+
+	if (sourceSize != header->SourceSize)
+		return NULL;
+
+	if (sourceTime != header->SourceTime)
+	{
+		unsigned long long hash;
+		if (!HashFile(objName, &hash) || hash != header->SourceHash)
+			return NULL;
+		*staleTime = sourceTime;
+	}
+
+	return header;
+}
+
+
+// after a cache has been found good by hashing its obj again, save the obj's new modification time
+// in it so the next run does not have to hash it too
+// (the cache must not be mapped any more: Windows will not write to a mapped file)
+
+static void
+RefreshMeshCache(const char* objName, long long sourceTime)
+{
+	if (sourceTime < 0)
+		return;
+
+	std::string cacheName = MeshCacheName(objName);
+	FILE* fp = fopen(cacheName.c_str(), "r+b");
+	if (fp == NULL)
+		return;
+	if (fseek(fp, (long)offsetof(RmeshHeader, SourceTime), SEEK_SET) != 0 ||
+		fwrite(&sourceTime, sizeof(sourceTime), 1, fp) != 1)
+		fprintf(stderr, "Cannot update the source time in mesh cache '%s'\n", cacheName.c_str());
+	fclose(fp);
+}
+
+
+// fill *mesh from the cache for objName
+// returns false if there is no usable cache
+
+bool
+LoadMeshCache(const char* objName, Mesh* mesh)
+{
+	MappedFile file;
+	long long staleTime;
+	const RmeshHeader* header = OpenMeshCache(objName, &file, &staleTime);
+	if (header == NULL)
+		return false;
+
+	mesh->xmin = header->Bounds[0];	mesh->ymin = header->Bounds[1];	mesh->zmin = header->Bounds[2];
+	mesh->xmax = header->Bounds[3];	mesh->ymax = header->Bounds[4];	mesh->zmax = header->Bounds[5];
+
+	const MeshVertex* vertices = (const MeshVertex*)(file.Data() + header->VertexOffset);
+	mesh->Vertices.assign(vertices, vertices + header->NumVertices);
+
+	mesh->Indices.resize(header->NumIndices);
+	if (header->IndexSize == 2)
+	{
+		const unsigned short* indices = (const unsigned short*)(file.Data() + header->IndexOffset);
+		for (unsigned int i = 0; i < header->NumIndices; i++)
+			mesh->Indices[i] = indices[i];
+	}
+	else
+	{
+		memcpy(mesh->Indices.data(), file.Data() + header->IndexOffset, header->NumIndices * sizeof(unsigned int));
+	}
+
+	const Meshlet* meshlets = (const Meshlet*)(file.Data() + header->MeshletOffset);
+	mesh->Meshlets.assign(meshlets, meshlets + header->NumMeshlets);
+	const MeshLod* lods = (const MeshLod*)(file.Data() + header->LodOffset);
+	mesh->Lods.assign(lods, lods + header->NumLods);
+
+	file.Close();
+	RefreshMeshCache(objName, staleTime);
+	return true;
+}
+
+
+// upload the cache for objName straight from the mapped file into GPU buffers
+// (packed vertices are quantized on the way; given a pool, the mesh goes into that in the pool's format)
+// returns false if there is no usable cache
+
+bool
+UploadMeshCache(const char* objName, GpuMesh* gpu, VertexFormat format, GeometryPool* pool)
+{
+	MappedFile file;
+	long long staleTime;
+	const RmeshHeader* header = OpenMeshCache(objName, &file, &staleTime);
+	if (header == NULL)
+		return false;
+
+	fprintf(stderr, "Using mesh cache '%s': %d vertices, %d triangles\n",
+		MeshCacheName(objName).c_str(), header->NumVertices, header->NumIndices / 3);
+
+	if (!UploadMeshBuffers((const MeshVertex*)(file.Data() + header->VertexOffset), header->NumVertices, header->Bounds,
+		file.Data() + header->IndexOffset, header->NumIndices,
+		header->IndexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, format, gpu, pool))
+		return false;
+
+	const Meshlet* meshlets = (const Meshlet*)(file.Data() + header->MeshletOffset);
+	gpu->Meshlets.assign(meshlets, meshlets + header->NumMeshlets);
+	const MeshLod* lods = (const MeshLod*)(file.Data() + header->LodOffset);
+	gpu->Lods.assign(lods, lods + header->NumLods);
+
+	file.Close();
+	RefreshMeshCache(objName, staleTime);
+	return true;
+}
+
+
+// write the cache for objName
+// (written to a temporary file first so a crash can't leave a half-written cache behind)
+
+bool
+SaveMeshCache(const char* objName, const Mesh& mesh)
+{
+	RmeshHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "RMSH", 4);
+	header.FormatVersion = RMESHFORMATVERSION;
+	header.LoaderVersion = MESHLOADERVERSION;
+	header.NumAttributes = DescribeMeshVertex(header.Attributes);
+
+	header.SourceTime = FileTime(objName, &header.SourceSize);
+	if (header.SourceTime < 0 || !HashFile(objName, &header.SourceHash))
+	{
+		fprintf(stderr, "Cannot hash '%s', not writing a mesh cache\n", objName);
+		return false;
+	}
+
+	header.Bounds[0] = mesh.xmin;	header.Bounds[1] = mesh.ymin;	header.Bounds[2] = mesh.zmin;
+	header.Bounds[3] = mesh.xmax;	header.Bounds[4] = mesh.ymax;	header.Bounds[5] = mesh.zmax;
+
+	header.VertexStride = sizeof(MeshVertex);
+	header.NumVertices = (unsigned int)mesh.Vertices.size();
+	header.IndexSize = mesh.Vertices.size() <= 65536 ? 2 : 4;
+	header.NumIndices = (unsigned int)mesh.Indices.size();
+	header.MeshletSize = sizeof(Meshlet);
+	header.NumMeshlets = (unsigned int)mesh.Meshlets.size();
+	header.NumLods = (unsigned int)mesh.Lods.size();
+
+	// keep all the blobs 16-byte aligned:
+
+	unsigned long long vertexBytes = (unsigned long long)header.NumVertices * header.VertexStride;
+	unsigned long long indexBytes = (unsigned long long)header.NumIndices * header.IndexSize;
+	header.VertexOffset = (sizeof(RmeshHeader) + 15) & ~15ull;
+	header.IndexOffset = (header.VertexOffset + vertexBytes + 15) & ~15ull;
+	header.MeshletOffset = (header.IndexOffset + indexBytes + 15) & ~15ull;
+	header.LodOffset = header.MeshletOffset + header.NumMeshlets * sizeof(Meshlet);
+
+	std::string cacheName = MeshCacheName(objName);
+	std::string tempName = cacheName + ".tmp";
+	FILE* fp = fopen(tempName.c_str(), "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot create mesh cache '%s'\n", tempName.c_str());
+		return false;
+	}
+
+	static const char zeros[16] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(zeros, 1, (size_t)(header.VertexOffset - sizeof(header)), fp) == header.VertexOffset - sizeof(header);
+	if (vertexBytes > 0)
+		ok = ok && fwrite(mesh.Vertices.data(), (size_t)vertexBytes, 1, fp) == 1;
+	size_t pad = (size_t)(header.IndexOffset - header.VertexOffset - vertexBytes);
+	ok = ok && fwrite(zeros, 1, pad, fp) == pad;
+
+	if (header.IndexSize == 2)
+	{
+		std::vector<unsigned short> shortIndices(mesh.Indices.begin(), mesh.Indices.end());
+		if (!shortIndices.empty())
+			ok = ok && fwrite(shortIndices.data(), shortIndices.size() * sizeof(unsigned short), 1, fp) == 1;
+	}
+	else if (!mesh.Indices.empty())
+	{
+		ok = ok && fwrite(mesh.Indices.data(), mesh.Indices.size() * sizeof(unsigned int), 1, fp) == 1;
+	}
+
+	pad = (size_t)(header.MeshletOffset - header.IndexOffset - indexBytes);
+	ok = ok && fwrite(zeros, 1, pad, fp) == pad;
+	if (!mesh.Meshlets.empty())
+		ok = ok && fwrite(mesh.Meshlets.data(), mesh.Meshlets.size() * sizeof(Meshlet), 1, fp) == 1;
+	if (!mesh.Lods.empty())
+		ok = ok && fwrite(mesh.Lods.data(), mesh.Lods.size() * sizeof(MeshLod), 1, fp) == 1;
+
+	fclose(fp);
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot write mesh cache '%s'\n", tempName.c_str());
+		remove(tempName.c_str());
+		return false;
+	}
+
+	remove(cacheName.c_str());
+	if (rename(tempName.c_str(), cacheName.c_str()) != 0)
+	{
+		fprintf(stderr, "Cannot rename '%s' to '%s'\n", tempName.c_str(), cacheName.c_str());
+		remove(tempName.c_str());
+		return false;
+	}
+
+	fprintf(stderr, "Wrote mesh cache '%s'\n", cacheName.c_str());
+	return true;
+}
@@ -0,0 +1,61 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+
+#include "mesh.h"
+#include "vertexlayout.h"
+
+// binary mesh cache (.rmesh) written next to the obj file it came from
+//
+// layout:	RmeshHeader
+//		vertex blob	(NumVertices * VertexStride bytes, at VertexOffset)
+//		index blob	(NumIndices * IndexSize bytes, at IndexOffset)
+//		meshlet blob	(NumMeshlets Meshlet structs, at MeshletOffset)
+//		lod blob	(NumLods MeshLod structs, at LodOffset)
+//
+// a cache is only used when its loader version and vertex format match this build
+// and the obj file it was made from still has the same contents
+
+
+constexpr unsigned int RMESHFORMATVERSION{ 3 };
+constexpr int RMESHMAXATTRIBUTES{ 8 };
+
+
+// the vertex blob's attributes, as VertexLayout::Describe( ) writes them:
+
+typedef VertexAttribute		RmeshAttribute;
+
+
+struct RmeshHeader
+{
+	char			Magic[4];		// "RMSH"
+	unsigned int		FormatVersion;		// RMESHFORMATVERSION
+	unsigned int		LoaderVersion;		// MESHLOADERVERSION
+	unsigned int		NumAttributes;
+	unsigned long long	SourceHash;
+	unsigned long long	SourceSize;
+	long long		SourceTime;		// modification time of the obj when the hash was taken
+	float			Bounds[6];		// xmin, ymin, zmin, xmax, ymax, zmax
+	RmeshAttribute		Attributes[RMESHMAXATTRIBUTES];
+	unsigned int		VertexStride;
+	unsigned int		NumVertices;
+	unsigned int		IndexSize;		// 2 or 4
+	unsigned int		NumIndices;
+	unsigned long long	VertexOffset;
+	unsigned long long	IndexOffset;
+	unsigned int		MeshletSize;		// sizeof(Meshlet)
+	unsigned int		NumMeshlets;
+	unsigned long long	MeshletOffset;
+	unsigned int		NumLods;
+	unsigned int		Padding;
+	unsigned long long	LodOffset;
+};
+
+
+std::string	MeshCacheName(const char*);
+bool		LoadMeshCache(const char*, Mesh*);
+bool		SaveMeshCache(const char*, const Mesh&);
+bool		UploadMeshCache(const char*, GpuMesh*, VertexFormat = VERTEXFORMAT_PACKED, GeometryPool* = NULL);
+
+#endif		// #ifndef MESHCACHE_H
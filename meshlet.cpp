@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "geometrypool.h"
+#include "glm/glm.hpp"
+#include "glstate.h"
+#include "mesh.h"
+#include "meshlet.h"
+
+
+static void
+TriangleNormal(const MeshVertex& a, const MeshVertex& b, const MeshVertex& c, float n[3])
+{
+	float ab[3] = { b.x - a.x, b.y - a.y, b.z - a.z };
+	float ac[3] = { c.x - a.x, c.y - a.y, c.z - a.z };
+	n[0] = ab[1] * ac[2] - ab[2] * ac[1];
+	n[1] = ab[2] * ac[0] - ab[0] * ac[2];
+	n[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+
+// bounding box, sphere, and normal cone of the triangles in indices[first .. first+count):
+
+static void
+ComputeMeshletBounds(const Mesh& mesh, Meshlet* meshlet)
+{
+	const unsigned int* indices = &mesh.Indices[meshlet->FirstIndex];
+
+	for (int i = 0; i < 3; i++)
+	{
+		meshlet->Min[i] = 1.e30f;
+		meshlet->Max[i] = -1.e30f;
+	}
+
+	float axis[3] = { 0.f, 0.f, 0.f };
+	for (unsigned int i = 0; i < meshlet->IndexCount; i += 3)
+	{
+		const MeshVertex& a = mesh.Vertices[indices[i + 0]];
+		const MeshVertex& b = mesh.Vertices[indices[i + 1]];
+		const MeshVertex& c = mesh.Vertices[indices[i + 2]];
+		for (const MeshVertex* v : { &a, &b, &c })
+		{
+			const float p[3] = { v->x, v->y, v->z };
+			for (int k = 0; k < 3; k++)
+			{
+				meshlet->Min[k] = std::min(meshlet->Min[k], p[k]);
+				meshlet->Max[k] = std::max(meshlet->Max[k], p[k]);
+			}
+		}
+
+		// area-weighted, so slivers don't swing the axis around:
+		float n[3];
+		TriangleNormal(a, b, c, n);
+		axis[0] += n[0];
+		axis[1] += n[1];
+		axis[2] += n[2];
+	}
+
+	for (int k = 0; k < 3; k++)
+		meshlet->Center[k] = 0.5f * (meshlet->Min[k] + meshlet->Max[k]);
+
+	float radius2 = 0.f;
+	for (unsigned int i = 0; i < meshlet->IndexCount; i++)
+	{
+		const MeshVertex& v = mesh.Vertices[indices[i]];
+		float dx = v.x - meshlet->Center[0], dy = v.y - meshlet->Center[1], dz = v.z - meshlet->Center[2];
+		radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+	}
+	meshlet->Radius = sqrtf(radius2);
+
+
+	// the cone is only good for culling if every triangle faces roughly the same way:
+
+	float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	meshlet->ConeCutoff = 1.f;
+	meshlet->ConeAxis[0] = meshlet->ConeAxis[1] = meshlet->ConeAxis[2] = 0.f;
+	if (length == 0.f)
+		return;
+
+	for (int k = 0; k < 3; k++)
+		meshlet->ConeAxis[k] = axis[k] / length;
+
+	float minDot = 1.f;
+	for (unsigned int i = 0; i < meshlet->IndexCount; i += 3)
+	{
+		float n[3];
+		TriangleNormal(mesh.Vertices[indices[i]], mesh.Vertices[indices[i + 1]], mesh.Vertices[indices[i + 2]], n);
+		float nlength = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (nlength == 0.f)
+			continue;
+		float d = (n[0] * meshlet->ConeAxis[0] + n[1] * meshlet->ConeAxis[1] + n[2] * meshlet->ConeAxis[2]) / nlength;
+		minDot = std::min(minDot, d);
+	}
+
+	if (minDot > 0.1f)
+		meshlet->ConeCutoff = sqrtf(1.f - minDot * minDot);
+}
+
+
+// regroup the triangles into meshlets and store them in mesh->Meshlets
+// each meshlet is grown greedily from the first unused triangle (so meshlets follow the existing triangle
+// order), always adding the neighbor that brings in the fewest new vertices and is closest to the meshlet
+// within a meshlet the triangles keep their existing (vertex cache friendly) order
+
+void
+BuildMeshlets(Mesh* mesh)
+{
+	std::vector<unsigned int>& indices = mesh->Indices;
+	unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+	unsigned int numVertices = (unsigned int)mesh->Vertices.size();
+	mesh->Meshlets.clear();
+	if (numTriangles == 0)
+		return;
+
+
+	// triangles around each vertex:
+
+	std::vector<unsigned int> adjacencyStart(numVertices + 1, 0);
+	for (unsigned int index : indices)
+		adjacencyStart[index + 1]++;
+	for (unsigned int v = 0; v < numVertices; v++)
+		adjacencyStart[v + 1] += adjacencyStart[v];
+
+	std::vector<unsigned int> adjacency(indices.size());
+	std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (unsigned int i = 0; i < (unsigned int)indices.size(); i++)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+
+	std::vector<unsigned char> used(numTriangles, 0);
+	std::vector<unsigned int> vertexStamp(numVertices, ~0u);		// meshlet the vertex is in
+	std::vector<unsigned int> candidateStamp(numTriangles, ~0u);		// meshlet that lists the triangle as a candidate
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> triangles;
+	std::vector<unsigned int> newIndices;
+	newIndices.reserve(indices.size());
+
+	unsigned int seed = 0;
+	while (seed < numTriangles)
+	{
+		unsigned int id = (unsigned int)mesh->Meshlets.size();
+		int numMeshletVertices = 0;
+		float sum[3] = { 0.f, 0.f, 0.f };
+		candidates.clear();
+		triangles.clear();
+
+		unsigned int triangle = seed;
+		while (true)
+		{
+			// add the triangle:
+
+			used[triangle] = 1;
+			triangles.push_back(triangle);
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[3 * triangle + k];
+				if (vertexStamp[v] != id)
+				{
+					vertexStamp[v] = id;
+					numMeshletVertices++;
+					sum[0] += mesh->Vertices[v].x;
+					sum[1] += mesh->Vertices[v].y;
+					sum[2] += mesh->Vertices[v].z;
+				}
+
+				for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v + 1]; a++)
+				{
+					unsigned int neighbor = adjacency[a];
+					if (!used[neighbor] && candidateStamp[neighbor] != id)
+					{
+						candidateStamp[neighbor] = id;
+						candidates.push_back(neighbor);
+					}
+				}
+			}
+
+			if ((int)triangles.size() == MESHLETMAXTRIANGLES)
+				break;
+
+
+			// pick the next one (and drop candidates that got used or can no longer fit):
+
+			float center[3] = { sum[0] / numMeshletVertices, sum[1] / numMeshletVertices, sum[2] / numMeshletVertices };
+			int bestNew = 4;
+			float bestDistance = 0.f;
+			unsigned int best = ~0u;
+			size_t kept = 0;
+			for (size_t c = 0; c < candidates.size(); c++)
+			{
+				unsigned int t = candidates[c];
+				if (used[t])
+					continue;
+
+				const unsigned int* tv = &indices[3 * t];
+				int numNew = (vertexStamp[tv[0]] != id) + (vertexStamp[tv[1]] != id) + (vertexStamp[tv[2]] != id);
+				if (numMeshletVertices + numNew > MESHLETMAXVERTICES)
+					continue;
+				candidates[kept++] = t;
+
+				float dx = 0.f, dy = 0.f, dz = 0.f;
+				for (int k = 0; k < 3; k++)
+				{
+					const MeshVertex& p = mesh->Vertices[tv[k]];
+					dx += p.x;
+					dy += p.y;
+					dz += p.z;
+				}
+				dx = dx / 3.f - center[0];
+				dy = dy / 3.f - center[1];
+				dz = dz / 3.f - center[2];
+				float distance = dx * dx + dy * dy + dz * dz;
+
+				if (numNew < bestNew || (numNew == bestNew && distance < bestDistance))
+				{
+					bestNew = numNew;
+					bestDistance = distance;
+					best = t;
+				}
+			}
+			candidates.resize(kept);
+
+			if (best == ~0u)
+				break;
+			triangle = best;
+		}
+
+
+		// write the meshlet's triangles out in their old order:
+
+		std::sort(triangles.begin(), triangles.end());
+
+		Meshlet meshlet;
+		meshlet.FirstIndex = (unsigned int)newIndices.size();
+		meshlet.IndexCount = 3 * (unsigned int)triangles.size();
+		for (unsigned int t : triangles)
+			newIndices.insert(newIndices.end(), &indices[3 * t], &indices[3 * t] + 3);
+		mesh->Meshlets.push_back(meshlet);
+
+		while (seed < numTriangles && used[seed])
+			seed++;
+	}
+
+	indices.swap(newIndices);
+
+	for (Meshlet& meshlet : mesh->Meshlets)
+		ComputeMeshletBounds(*mesh, &meshlet);
+
+	fprintf(stderr, "Meshlets: %d, %.1f triangles each\n",
+		(int)mesh->Meshlets.size(), (float)numTriangles / (float)mesh->Meshlets.size());
+}
+
+
+// get the frustum planes and eye position in object coordinates from the matrices
+// (the same modelview matrix the mesh will be drawn with, and the height in pixels of the viewport it is for)
+
+void
+GetCullView(bool cullBackfaces, const glm::mat4& mv, const glm::mat4& p, int viewportHeight, CullView* view)
+{
+	glm::mat4 clip = p * mv;
+
+
+	// each plane is the 4th row of the matrix plus or minus one of the other rows:
+
+	for (int i = 0; i < 6; i++)
+	{
+		int row = i / 2;
+		float sign = (i % 2 == 0) ? 1.f : -1.f;
+		glm::vec4 plane;
+		for (int c = 0; c < 4; c++)
+			plane[c] = clip[c][3] + sign * clip[c][row];
+
+		float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.f)
+			plane /= length;
+		for (int c = 0; c < 4; c++)
+			view->Planes[i][c] = plane[c];
+	}
+
+	glm::mat4 inverse = glm::inverse(mv);
+	glm::vec4 eye = inverse * glm::vec4(0.f, 0.f, 0.f, 1.f);
+	glm::vec3 dir = glm::normalize(glm::vec3(inverse * glm::vec4(0.f, 0.f, -1.f, 0.f)));
+	for (int c = 0; c < 3; c++)
+	{
+		view->Eye[c] = eye[c];
+		view->ViewDir[c] = dir[c];
+	}
+
+	// a perspective projection puts -z into w, an orthographic one leaves w alone:
+	view->Perspective = p[2][3] != 0.f;
+
+	// perspective sizes shrink with eye distance, and the modelview scale cancels out of that,
+	// orthographic ones only depend on the scale:
+	view->PixelScale = 0.5f * viewportHeight * p[1][1];
+	if (!view->Perspective)
+		view->PixelScale *= glm::length(glm::vec3(mv[0]));
+	view->CullBackfaces = cullBackfaces;
+}
+
+
+static bool
+MeshletVisible(const Meshlet& meshlet, const CullView& view)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float* plane = view.Planes[i];
+		float distance = plane[0] * meshlet.Center[0] + plane[1] * meshlet.Center[1] + plane[2] * meshlet.Center[2] + plane[3];
+		if (distance < -meshlet.Radius)
+			return false;
+	}
+
+	if (!view.CullBackfaces || meshlet.ConeCutoff >= 1.f)
+		return true;
+
+	// backfacing when the whole bounding sphere is outside the cone that opens the other way along the axis:
+
+	if (view.Perspective)
+	{
+		float d[3] = { meshlet.Center[0] - view.Eye[0], meshlet.Center[1] - view.Eye[1], meshlet.Center[2] - view.Eye[2] };
+		float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		float along = d[0] * meshlet.ConeAxis[0] + d[1] * meshlet.ConeAxis[1] + d[2] * meshlet.ConeAxis[2];
+		return along < meshlet.ConeCutoff * length + meshlet.Radius;
+	}
+
+	float along = view.ViewDir[0] * meshlet.ConeAxis[0] + view.ViewDir[1] * meshlet.ConeAxis[1] + view.ViewDir[2] * meshlet.ConeAxis[2];
+	return along < meshlet.ConeCutoff;
+}
+
+
+// fill draws with the visible meshlets (neighbors in the index buffer are merged into one range)
+// returns the number of draws
+
+int
+CullMeshlets(const std::vector<Meshlet>& meshlets, const CullView& view, GLenum indexType, DrawList* draws)
+{
+	size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+
+	draws->Counts.clear();
+	draws->Offsets.clear();
+	draws->NumMeshlets = 0;
+	draws->NumTriangles = 0;
+
+	unsigned int rangeEnd = ~0u;
+	for (const Meshlet& meshlet : meshlets)
+	{
+		if (!MeshletVisible(meshlet, view))
+			continue;
+
+		draws->NumMeshlets++;
+		draws->NumTriangles += meshlet.IndexCount / 3;
+
+		if (meshlet.FirstIndex == rangeEnd)
+		{
+			draws->Counts.back() += meshlet.IndexCount;
+		}
+		else
+		{
+			draws->Counts.push_back(meshlet.IndexCount);
+			draws->Offsets.push_back((const GLvoid*)(meshlet.FirstIndex * indexSize));
+		}
+		rangeEnd = meshlet.FirstIndex + meshlet.IndexCount;
+	}
+
+	return (int)draws->Counts.size();
+}
+
+
+void
+DrawMeshlets(const GpuMesh& gpu, const DrawList& draws)
+{
+	if (gpu.Vao == 0 || draws.Counts.empty())
+		return;
+
+	if (gpu.Pool != NULL)
+	{
+		for (size_t i = 0; i < draws.Counts.size(); i++)
+			QueuePoolDraw(gpu.Pool, gpu.PoolSlot, (GLuint)((size_t)draws.Offsets[i] / sizeof(unsigned int)), draws.Counts[i]);
+		return;
+	}
+
+	BindVertexArray(gpu.Vao);
+	glMultiDrawElements(GL_TRIANGLES, draws.Counts.data(), gpu.IndexType, draws.Offsets.data(), (GLsizei)draws.Counts.size());
+}
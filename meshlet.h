@@ -0,0 +1,66 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+
+#include "glew.h"
+#include "glm/glm.hpp"
+
+struct GpuMesh;
+struct Mesh;
+
+// meshlets: the index buffer cut into small clusters of neighboring triangles,
+// each with bounds that let the CPU skip the clusters the camera can't see
+
+
+constexpr int MESHLETMAXTRIANGLES{ 128 };
+constexpr int MESHLETMAXVERTICES{ 128 };
+
+
+// one cluster, a contiguous range of the mesh's index buffer:
+
+struct Meshlet
+{
+	unsigned int	FirstIndex;
+	unsigned int	IndexCount;
+
+	float		Min[3], Max[3];		// bounding box
+	float		Center[3];		// bounding sphere
+	float		Radius;
+
+	float		ConeAxis[3];		// average facing direction
+	float		ConeCutoff;		// sin of the widest angle between the axis and a triangle normal
+						// (1 when the triangles face too many ways to ever be all backfacing)
+};
+
+
+// what the camera sees, in the mesh's object coordinates:
+
+struct CullView
+{
+	float	Planes[6][4];		// frustum planes, normalized, pointing inwards
+	float	Eye[3];			// eye position (perspective)
+	float	ViewDir[3];		// viewing direction (orthographic)
+	float	PixelScale;		// pixels per object unit (perspective: at a distance of 1)
+	bool	Perspective;
+	bool	CullBackfaces;		// use the normal cones too (only right when GL_CULL_FACE is on)
+};
+
+
+// the ranges of visible meshlets, ready for glMultiDrawElements( ):
+
+struct DrawList
+{
+	std::vector<GLsizei>		Counts;
+	std::vector<const GLvoid*>	Offsets;
+	int				NumMeshlets;		// visible meshlets
+	int				NumTriangles;		// visible triangles
+};
+
+
+void	BuildMeshlets(Mesh*);
+int	CullMeshlets(const std::vector<Meshlet>&, const CullView&, GLenum, DrawList*);
+void	DrawMeshlets(const GpuMesh&, const DrawList&);
+void	GetCullView(bool, const glm::mat4&, const glm::mat4&, int, CullView*);
+
+#endif		// #ifndef MESHLET_H
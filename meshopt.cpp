@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "mesh.h"
+#include "meshlet.h"
+#include "meshopt.h"
+
+
+// simulate a FIFO post-transform cache over the index buffer:
+
+VertexCacheStats
+AnalyzeVertexCache(const unsigned int* indices, size_t numIndices, size_t numVertices, int cacheSize)
+{
+	VertexCacheStats stats;
+	stats.Acmr = stats.Atvr = 0.f;
+	if (numIndices < 3)
+		return stats;
+
+	// a vertex is in the cache if it was pushed within the last cacheSize pushes:
+
+	std::vector<unsigned int> pushedAt(numVertices, 0);
+	std::vector<bool> used(numVertices, false);
+	unsigned int pushes = 0;
+	size_t misses = 0;
+	size_t numUsed = 0;
+
+	for (size_t i = 0; i < numIndices; i++)
+	{
+		unsigned int v = indices[i];
+		if (!used[v])
+		{
+			used[v] = true;
+			numUsed++;
+		}
+
+		if (pushedAt[v] == 0 || pushes - pushedAt[v] >= (unsigned int)cacheSize)
+		{
+			pushes++;
+			pushedAt[v] = pushes;
+			misses++;
+		}
+	}
+
+	stats.Acmr = (float)misses / (float)(numIndices / 3);
+	stats.Atvr = (float)misses / (float)numUsed;
+	return stats;
+}
+
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation":
+//	greedily emit the triangle whose vertices score highest, where a vertex scores
+//	high for being recently used and for having few triangles left
+
+constexpr int FORSYTHCACHESIZE{ 32 };
+constexpr int FORSYTHMAXVALENCE{ 32 };
+
+
+static float
+ForsythVertexScore(int cachePosition, int remaining)
+{
+	if (remaining == 0)
+		return -1.f;
+
+	float score = 0.f;
+	if (cachePosition >= 0)
+	{
+		// the last triangle's vertices get a fixed score so the next triangle
+		// doesn't just reuse the same edge over and over:
+
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.f - (float)(cachePosition - 3) / (float)(FORSYTHCACHESIZE - 3), 1.5f);
+	}
+
+	// boost vertices with only a few triangles left, so they get finished off:
+
+	score += 2.f / sqrtf((float)remaining);
+	return score;
+}
+
+
+// reorder the triangles of an index buffer in place for vertex cache reuse:
+
+void
+OptimizeVertexCache(unsigned int* indices, size_t numIndices, size_t numVertices)
+{
+	size_t numTriangles = numIndices / 3;
+	if (numTriangles == 0)
+		return;
+
+	// score lookup tables:
+
+	float cacheScores[FORSYTHCACHESIZE + 1][FORSYTHMAXVALENCE + 1];
+	for (int c = -1; c < FORSYTHCACHESIZE; c++)
+		for (int r = 0; r <= FORSYTHMAXVALENCE; r++)
+			cacheScores[c + 1][r] = ForsythVertexScore(c, r);
+
+	auto score = [&cacheScores](int cachePosition, unsigned int remaining)
+	{
+		return cacheScores[cachePosition + 1][remaining < (unsigned int)FORSYTHMAXVALENCE ? remaining : FORSYTHMAXVALENCE];
+	};
+
+
+	// triangles that use each vertex (emitted triangles are swapped out of the list):
+
+	std::vector<unsigned int> remaining(numVertices, 0);
+	for (size_t i = 0; i < numIndices; i++)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> firstTriangle(numVertices + 1, 0);
+	for (size_t v = 0; v < numVertices; v++)
+		firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+
+	std::vector<unsigned int> triangles(numIndices);
+	std::vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (size_t i = 0; i < numIndices; i++)
+		triangles[filled[indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for (size_t v = 0; v < numVertices; v++)
+		vertexScore[v] = score(-1, remaining[v]);
+
+	std::vector<float> triangleScore(numTriangles);
+	std::vector<bool> emitted(numTriangles, false);
+	for (size_t t = 0; t < numTriangles; t++)
+		triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+	std::vector<unsigned int> output(numIndices);
+	unsigned int cache[FORSYTHCACHESIZE + 3];
+	int cacheSize = 0;
+	size_t cursor = 0;			// every triangle before this has been emitted
+
+	long long best = (long long)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+
+	for (size_t out = 0; out < numTriangles; out++)
+	{
+		// nothing left that touches the cache, so start over somewhere new:
+
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (long long)cursor;
+		}
+
+		unsigned int tri = (unsigned int)best;
+		emitted[tri] = true;
+
+		unsigned int newCache[FORSYTHCACHESIZE + 3];
+		int newSize = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[3 * tri + k];
+			output[3 * out + k] = v;
+			newCache[newSize++] = v;
+
+			// take this triangle off the vertex's list:
+
+			unsigned int* list = &triangles[firstTriangle[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				if (list[j] == tri)
+				{
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		for (int i = 0; i < cacheSize; i++)
+		{
+			unsigned int v = cache[i];
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+				newCache[newSize++] = v;
+		}
+
+
+		// rescore everything that is (or just fell out of) the cache:
+
+		for (int i = 0; i < newSize; i++)
+		{
+			unsigned int v = newCache[i];
+			cachePosition[v] = (i < FORSYTHCACHESIZE) ? i : -1;
+			vertexScore[v] = score(cachePosition[v], remaining[v]);
+		}
+
+		best = -1;
+		float bestScore = -1.f;
+		for (int i = 0; i < newSize; i++)
+		{
+			unsigned int v = newCache[i];
+			const unsigned int* list = &triangles[firstTriangle[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				unsigned int t = list[j];
+				float s = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+				triangleScore[t] = s;
+				if (s > bestScore)
+				{
+					bestScore = s;
+					best = t;
+				}
+			}
+		}
+
+		cacheSize = newSize < FORSYTHCACHESIZE ? newSize : FORSYTHCACHESIZE;
+		memcpy(cache, newCache, cacheSize * sizeof(unsigned int));
+	}
+
+	memcpy(indices, output.data(), numIndices * sizeof(unsigned int));
+}
+
+
+// cut a cache-optimized index buffer into clusters and sort the clusters so the ones
+// facing away from the mesh center are drawn first -- from most viewpoints they hide
+// what is behind them, so the expensive fragment shader runs less often
+// a cluster boundary is kept only where it costs at most threshold times the cache efficiency
+// (Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+
+struct OverdrawCluster
+{
+	size_t	First;
+	size_t	Count;
+	float	Key;
+};
+
+
+void
+OptimizeOverdraw(unsigned int* indices, size_t numIndices, const MeshVertex* vertices, size_t numVertices, float threshold)
+{
+	size_t numTriangles = numIndices / 3;
+	if (numTriangles < 2)
+		return;
+
+	// hard boundaries are where the cache has nothing left to reuse (all 3 vertices miss):
+
+	std::vector<unsigned int> pushedAt(numVertices, 0);
+	unsigned int pushes = 0;
+	std::vector<size_t> hard;
+	std::vector<unsigned char> missesPerTriangle(numTriangles);
+	for (size_t t = 0; t < numTriangles; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[3 * t + k];
+			if (pushedAt[v] == 0 || pushes - pushedAt[v] >= (unsigned int)STATSCACHESIZE)
+			{
+				pushes++;
+				pushedAt[v] = pushes;
+				misses++;
+			}
+		}
+		missesPerTriangle[t] = (unsigned char)misses;
+		if (t == 0 || misses == 3)
+			hard.push_back(t);
+	}
+	hard.push_back(numTriangles);
+
+
+	// soft boundaries split each hard cluster again wherever the running miss rate
+	// has come back down to (almost) the cluster's overall miss rate:
+
+	std::vector<OverdrawCluster> clusters;
+	for (size_t h = 0; h + 1 < hard.size(); h++)
+	{
+		size_t begin = hard[h];
+		size_t end = hard[h + 1];
+
+		size_t clusterMisses = 0;
+		for (size_t t = begin; t < end; t++)
+			clusterMisses += missesPerTriangle[t];
+		float clusterAcmr = (float)clusterMisses / (float)(end - begin);
+
+		size_t start = begin;
+		size_t runningMisses = 0;
+		for (size_t t = begin; t < end; t++)
+		{
+			runningMisses += missesPerTriangle[t];
+			size_t count = t + 1 - start;
+			if (t + 1 < end && count >= 8 && (float)runningMisses / (float)count <= clusterAcmr * threshold &&
+				missesPerTriangle[t + 1] >= 2)
+			{
+				OverdrawCluster c = { start, count, 0.f };
+				clusters.push_back(c);
+				start = t + 1;
+				runningMisses = 0;
+			}
+		}
+		OverdrawCluster c = { start, end - start, 0.f };
+		clusters.push_back(c);
+	}
+
+
+	// sort key: how far out along its own facing direction the cluster sits:
+
+	double cx = 0., cy = 0., cz = 0.;
+	for (size_t v = 0; v < numVertices; v++)
+	{
+		cx += vertices[v].x;
+		cy += vertices[v].y;
+		cz += vertices[v].z;
+	}
+	cx /= (double)numVertices;
+	cy /= (double)numVertices;
+	cz /= (double)numVertices;
+
+	for (OverdrawCluster& c : clusters)
+	{
+		float px = 0.f, py = 0.f, pz = 0.f;		// area-weighted centroid
+		float nx = 0.f, ny = 0.f, nz = 0.f;		// area-weighted normal
+		float area = 0.f;
+		for (size_t t = c.First; t < c.First + c.Count; t++)
+		{
+			const MeshVertex& a = vertices[indices[3 * t]];
+			const MeshVertex& b = vertices[indices[3 * t + 1]];
+			const MeshVertex& d = vertices[indices[3 * t + 2]];
+			float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+			float wx = d.x - a.x, wy = d.y - a.y, wz = d.z - a.z;
+			float tx = uy * wz - uz * wy;
+			float ty = uz * wx - ux * wz;
+			float tz = ux * wy - uy * wx;
+			float a2 = sqrtf(tx * tx + ty * ty + tz * tz);
+
+			px += (a.x + b.x + d.x) * a2;
+			py += (a.y + b.y + d.y) * a2;
+			pz += (a.z + b.z + d.z) * a2;
+			nx += tx;
+			ny += ty;
+			nz += tz;
+			area += a2;
+		}
+
+		float len = sqrtf(nx * nx + ny * ny + nz * nz);
+		if (area > 0.f && len > 0.f)
+		{
+			px /= 3.f * area;
+			py /= 3.f * area;
+			pz /= 3.f * area;
+			c.Key = ((px - (float)cx) * nx + (py - (float)cy) * ny + (pz - (float)cz) * nz) / len;
+		}
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(),
+		[](const OverdrawCluster& a, const OverdrawCluster& b) { return a.Key > b.Key; });
+
+	std::vector<unsigned int> output;
+	output.reserve(numIndices);
+	for (const OverdrawCluster& c : clusters)
+		output.insert(output.end(), indices + 3 * c.First, indices + 3 * (c.First + c.Count));
+
+	memcpy(indices, output.data(), output.size() * sizeof(unsigned int));
+}
+
+
+// renumber the vertices in the order the index buffer first uses them,
+// so vertex fetch walks through memory sequentially (unused vertices are dropped):
+
+void
+OptimizeVertexFetch(Mesh* mesh)
+{
+	const unsigned int UNUSED = ~0u;
+	std::vector<unsigned int> remap(mesh->Vertices.size(), UNUSED);
+	std::vector<MeshVertex> vertices;
+	vertices.reserve(mesh->Vertices.size());
+
+	for (unsigned int& index : mesh->Indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(mesh->Vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	mesh->Vertices.swap(vertices);
+}
+
+
+// the whole post-load optimization stage
+// (meshlets are cut from the overdraw-sorted order, before the vertices are renumbered)
+
+void
+OptimizeMesh(Mesh* mesh)
+{
+	if (mesh->Indices.empty())
+		return;
+
+	VertexCacheStats before = AnalyzeVertexCache(mesh->Indices.data(), mesh->Indices.size(), mesh->Vertices.size());
+
+	OptimizeVertexCache(mesh->Indices.data(), mesh->Indices.size(), mesh->Vertices.size());
+	OptimizeOverdraw(mesh->Indices.data(), mesh->Indices.size(), mesh->Vertices.data(), mesh->Vertices.size());
+	BuildMeshlets(mesh);
+	OptimizeVertexFetch(mesh);
+
+	VertexCacheStats after = AnalyzeVertexCache(mesh->Indices.data(), mesh->Indices.size(), mesh->Vertices.size());
+
+	fprintf(stderr, "Mesh optimization (%d-entry FIFO): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		STATSCACHESIZE, before.Acmr, after.Acmr, before.Atvr, after.Atvr);
+}
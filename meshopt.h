@@ -0,0 +1,33 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <stddef.h>
+
+struct Mesh;
+struct MeshVertex;
+
+// post-load triangle and vertex reordering for indexed meshes
+
+
+// how well an index buffer uses the post-transform vertex cache
+// (simulated as a FIFO of the given size)
+//	Acmr = vertex shader runs per triangle (0.5 is ideal for a big grid, 3 is the worst)
+//	Atvr = vertex shader runs per vertex (1 is ideal)
+
+struct VertexCacheStats
+{
+	float	Acmr;
+	float	Atvr;
+};
+
+
+constexpr int STATSCACHESIZE{ 16 };
+
+
+VertexCacheStats	AnalyzeVertexCache(const unsigned int*, size_t, size_t, int = STATSCACHESIZE);
+void			OptimizeMesh(Mesh*);
+void			OptimizeOverdraw(unsigned int*, size_t, const MeshVertex*, size_t, float = 1.05f);
+void			OptimizeVertexCache(unsigned int*, size_t, size_t);
+void			OptimizeVertexFetch(Mesh*);
+
+#endif		// #ifndef MESHOPT_H
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "geometrypool.h"
+#include "glslprogram.h"
+#include "glstate.h"
+#include "meshcache.h"
+#include "meshopt.h"
+#include "meshstream.h"
+#include "objreader.h"
+#include "tangentframes.h"
+
+
+// smallest buffers the stream starts out with (they double from there):
+
+constexpr size_t MINSTREAMVERTICES{ 64 * 1024 };
+constexpr size_t MINSTREAMINDICES{ 256 * 1024 };
+
+
+// the worker thread: read the obj, publishing every batch as soon as it has been turned into mesh data,
+// then do the slow whole-mesh work and write the cache
+
+static void
+StreamWorker(MeshStream* stream)
+{
+	Mesh* mesh = &stream->Final;
+	MeshBuilder builder(mesh);
+	size_t numPublishedVertices = 0;
+	size_t numPublishedIndices = 0;
+
+	ObjData obj;
+	int status = ReadObjFileStreaming(stream->ObjName.c_str(), &obj, [&](size_t firstCorner, size_t numCorners)
+	{
+		builder.AddTriangles(obj, firstCorner, numCorners);
+
+		std::lock_guard<std::mutex> lock(stream->Lock);
+		stream->NewVertices.insert(stream->NewVertices.end(), mesh->Vertices.begin() + numPublishedVertices, mesh->Vertices.end());
+		stream->NewIndices.insert(stream->NewIndices.end(), mesh->Indices.begin() + numPublishedIndices, mesh->Indices.end());
+		numPublishedVertices = mesh->Vertices.size();
+		numPublishedIndices = mesh->Indices.size();
+	}, &stream->Cancel);
+
+	if (status == 0)
+	{
+		mesh->xmin = obj.xmin;	mesh->ymin = obj.ymin;	mesh->zmin = obj.zmin;
+		mesh->xmax = obj.xmax;	mesh->ymax = obj.ymax;	mesh->zmax = obj.zmax;
+		obj = ObjData();
+
+		fprintf(stderr, "Streamed '%s': %d triangles, %d unique vertices\n",
+			stream->ObjName.c_str(), (int)mesh->Indices.size() / 3, (int)mesh->Vertices.size());
+
+		// (each of these can take a while on a big mesh, so a cancel is looked at in between)
+		ComputeTangentFrames(mesh);
+		if (!stream->Cancel)
+			OptimizeMesh(mesh);
+		if (!stream->Cancel)
+			BuildMeshLods(&mesh, 1);
+		if (!stream->Cancel)
+		{
+			CheckQuantizedMesh(*mesh);
+			SaveMeshCache(stream->ObjName.c_str(), *mesh);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(stream->Lock);
+	stream->Failed = (status != 0 || stream->Cancel);
+	stream->Finished = true;
+}
+
+
+// start loading objName in the background
+// gpu becomes an (empty) float-vertex mesh that UpdateMeshStream( ) fills in
+
+bool
+StartMeshStream(const char* objName, MeshStream* stream, GpuMesh* gpu)
+{
+	stream->ObjName = objName;
+	stream->NewVertices.clear();
+	stream->NewIndices.clear();
+	stream->Finished = stream->Failed = false;
+	stream->Final = Mesh();
+	stream->VertexCapacity = stream->IndexCapacity = 0;
+	stream->NumVertices = 0;
+
+	gpu->Vbo = gpu->Ibo = 0;
+	gpu->Pool = NULL;
+	gpu->PoolSlot = -1;
+	gpu->NumIndices = 0;
+	gpu->IndexType = GL_UNSIGNED_INT;
+	gpu->Format = VERTEXFORMAT_FLOAT;
+	for (int i = 0; i < 3; i++)
+	{
+		gpu->PositionScale[i] = 1.f;
+		gpu->PositionBias[i] = 0.f;
+	}
+	memset(gpu->Bounds, 0, sizeof(gpu->Bounds));
+	gpu->Meshlets.clear();
+	gpu->Lods.clear();
+	glGenVertexArrays(1, &gpu->Vao);
+
+	stream->Active = true;
+	stream->Cancel = false;
+	stream->Worker = std::thread(StreamWorker, stream);
+	return true;
+}
+
+
+// stop loading: the worker gives up at its next chance and is waited for
+// (it must not outlive the stream, so this has to happen before the program exits)
+
+void
+StopMeshStream(MeshStream* stream)
+{
+	stream->Cancel = true;
+	if (stream->Worker.joinable())
+		stream->Worker.join();
+	stream->Active = false;
+}
+
+
+MeshStream::~MeshStream()
+{
+	StopMeshStream(this);
+}
+
+
+// called by the GL thread every frame: upload whatever the worker has added since last time,
+// and once it is done replace the streamed mesh with the optimized one
+// returns true on the frame the final mesh gets swapped in
+
+bool
+UpdateMeshStream(MeshStream* stream, GpuMesh* gpu, GeometryPool* pool)
+{
+	if (!stream->Active)
+		return false;
+
+	std::vector<MeshVertex> vertices;
+	std::vector<unsigned int> indices;
+	bool finished;
+	{
+		std::lock_guard<std::mutex> lock(stream->Lock);
+		vertices.swap(stream->NewVertices);
+		indices.swap(stream->NewIndices);
+		finished = stream->Finished;
+	}
+
+	if (finished)
+	{
+		stream->Worker.join();
+		stream->Active = false;
+		if (stream->Failed)
+			return false;
+
+		GpuMesh optimized;
+		UploadMesh(stream->Final, &optimized, VERTEXFORMAT_PACKED, pool);
+		DeleteMesh(gpu);
+		*gpu = optimized;
+		stream->Final = Mesh();
+		return true;
+	}
+
+	if (indices.empty() && vertices.empty())
+		return false;
+
+	BindVertexArray(gpu->Vao);
+
+	size_t vertexBytes = stream->NumVertices * sizeof(MeshVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, gpu->Vbo);
+	if (GrowBuffer(GL_ARRAY_BUFFER, &gpu->Vbo, &stream->VertexCapacity, vertexBytes,
+		vertexBytes + vertices.size() * sizeof(MeshVertex), MINSTREAMVERTICES * sizeof(MeshVertex)))
+		MeshVertexLayout::Setup();
+	if (!vertices.empty())
+		glBufferSubData(GL_ARRAY_BUFFER, vertexBytes, vertices.size() * sizeof(MeshVertex), vertices.data());
+	stream->NumVertices += vertices.size();
+
+	size_t indexBytes = gpu->NumIndices * sizeof(unsigned int);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu->Ibo);
+	GrowBuffer(GL_ELEMENT_ARRAY_BUFFER, &gpu->Ibo, &stream->IndexCapacity, indexBytes,
+		indexBytes + indices.size() * sizeof(unsigned int), MINSTREAMINDICES * sizeof(unsigned int));
+	if (!indices.empty())
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices.size() * sizeof(unsigned int), indices.data());
+	gpu->NumIndices += (GLsizei)indices.size();
+
+	BindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	CheckGlErrors("UpdateMeshStream");
+	return false;
+}
@@ -0,0 +1,46 @@
+#ifndef MESHSTREAM_H
+#define MESHSTREAM_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mesh.h"
+
+// loading an obj in the background:
+//	a worker thread reads the file a batch at a time and builds the mesh as it goes,
+//	the GL thread appends every new batch to a growing vertex/index buffer and draws what has arrived,
+//	and once the whole file is in, the worker optimizes the mesh and the GL thread swaps it in
+//	(into a geometry pool, if given one: the streaming buffers are the mesh's own until then)
+
+
+struct MeshStream
+{
+	std::string			ObjName;
+	std::thread			Worker;
+	bool				Active;			// started and not swapped in yet (GL thread only)
+	std::atomic<bool>		Cancel;			// tells the worker to give up (see StopMeshStream( ))
+
+	std::mutex			Lock;			// guards the next four
+	std::vector<MeshVertex>		NewVertices;		// arrived since the last UpdateMeshStream( )
+	std::vector<unsigned int>	NewIndices;
+	bool				Finished;		// Final is complete
+	bool				Failed;
+
+	Mesh				Final;			// the worker's until Finished
+
+	size_t				VertexCapacity;		// GL thread only
+	size_t				IndexCapacity;
+	size_t				NumVertices;
+
+	~MeshStream();
+};
+
+
+bool	StartMeshStream(const char*, MeshStream*, GpuMesh*);
+void	StopMeshStream(MeshStream*);
+bool	UpdateMeshStream(MeshStream*, GpuMesh*, GeometryPool* = NULL);
+
+#endif		// #ifndef MESHSTREAM_H
@@ -0,0 +1,766 @@
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mappedfile.h"
+#include "objreader.h"
+#include "threadpool.h"
+#include "utils.h"
+
+// Obj reader that works directly on the memory-mapped file:
+//	no per-line allocation, no strtok( ), no locale-dependent atof( )/sscanf( )
+
+
+// powers of ten that are exactly representable as doubles:
+
+static const double POWERS_OF_TEN[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+constexpr int MAXEXACTPOWER{ 22 };
+
+// smallest piece of a file worth handing to its own thread:
+
+constexpr size_t MINOBJCHUNKSIZE{ 1 << 20 };
+
+// how much of the file each streaming batch covers:
+
+constexpr size_t OBJSTREAMBATCHSIZE{ 4 << 20 };
+
+
+static inline bool
+IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+static inline bool
+IsDigit(char c)
+{
+	return (unsigned)(c - '0') < 10u;
+}
+
+
+static inline const char*
+SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+		p++;
+	return p;
+}
+
+
+static inline const char*
+SkipToken(const char* p, const char* end)
+{
+	while (p < end && !IsSpace(*p))
+		p++;
+	return p;
+}
+
+
+// parse a decimal floating point number (same grammar as strtod( ) without hex, inf, or nan)
+// if there is no number here, *value is set to 0. and p is returned unchanged
+
+static const char*
+ParseObjFloat(const char* p, const char* end, float* value)
+{
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	// collect up to 19 significant digits, which always fit in 64 bits:
+
+	unsigned long long mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	for (; p < end && IsDigit(*p); p++)
+	{
+		anyDigits = true;
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0)
+				significant++;
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && IsDigit(*p); p++)
+		{
+			anyDigits = true;
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					significant++;
+				exponent--;
+			}
+		}
+	}
+
+	if (!anyDigits)
+	{
+		*value = 0.f;
+		return start;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+		{
+			negativeExponent = (*e == '-');
+			e++;
+		}
+
+		if (e < end && IsDigit(*e))
+		{
+			int x = 0;
+			for (; e < end && IsDigit(*e); e++)
+			{
+				if (x < 10000)
+					x = x * 10 + (*e - '0');
+			}
+			exponent += negativeExponent ? -x : x;
+			p = e;
+		}
+	}
+
+	double d = (double)mantissa;
+	if (mantissa != 0)
+	{
+		while (exponent > MAXEXACTPOWER)
+		{
+			d *= POWERS_OF_TEN[MAXEXACTPOWER];
+			exponent -= MAXEXACTPOWER;
+		}
+		while (exponent < -MAXEXACTPOWER)
+		{
+			d /= POWERS_OF_TEN[MAXEXACTPOWER];
+			exponent += MAXEXACTPOWER;
+		}
+		if (exponent > 0)
+			d *= POWERS_OF_TEN[exponent];
+		else if (exponent < 0)
+			d /= POWERS_OF_TEN[-exponent];
+	}
+
+	*value = (float)(negative ? -d : d);
+	return p;
+}
+
+
+// parse a (possibly signed) decimal integer
+// if there is no number here, *value is set to 0 and p is returned unchanged
+// (anything past INT_MAX is clamped to it, for the index range checks to throw out)
+
+static const char*
+ParseObjInt(const char* p, const char* end, int* value)
+{
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	if (p >= end || !IsDigit(*p))
+	{
+		*value = 0;
+		return start;
+	}
+
+	long long i = 0;
+	for (; p < end && IsDigit(*p); p++)
+	{
+		if (i <= INT_MAX)
+			i = i * 10 + (*p - '0');
+	}
+	if (i > INT_MAX)
+		i = INT_MAX;
+
+	*value = negative ? -(int)i : (int)i;
+	return p;
+}
+
+
+// parse one face corner, which can be one of v, v//n, v/t, v/t/n:
+
+static const char*
+ParseObjVTN(const char* p, const char* end, int* v, int* t, int* n)
+{
+	*t = *n = 0;
+	p = ParseObjInt(p, end, v);
+
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p != '/')
+			p = ParseObjInt(p, end, t);
+
+		if (p < end && *p == '/')
+			p = ParseObjInt(p + 1, end, n);
+	}
+
+	return SkipToken(p, end);
+}
+
+
+// a face as it was read, before its indices are resolved
+// (NumV, NumN, NumT are how many of each the chunk had read when it got to this face)
+
+struct ObjPolygon
+{
+	int	FirstCorner, NumCorners;
+	int	NumV, NumN, NumT;
+};
+
+
+// one newline-delimited piece of the file, parsed on its own
+// relative (negative) indices can only be resolved once we know how many
+// vertices, normals, and texture coords all of the earlier chunks have
+
+struct ObjChunk
+{
+	const char*				Begin;
+	const char*				End;
+
+	std::vector<struct Vertex>		Vertices;
+	std::vector<struct Normal>		Normals;
+	std::vector<struct TextureCoord>	TextureCoords;
+	std::vector<struct face>		RawCorners;
+	std::vector<ObjPolygon>			Polygons;
+	float					xmin, ymin, zmin;
+	float					xmax, ymax, zmax;
+
+	// filled in by the merge:
+
+	int					BaseV, BaseN, BaseT;
+	std::vector<struct face>		Triangles;
+	size_t					FirstTriangleCorner;
+};
+
+
+// read the corners of one 'f' line, exactly as they are written:
+
+static void
+ParseObjFace(const char* p, const char* eol, ObjChunk* chunk)
+{
+	ObjPolygon poly;
+	poly.FirstCorner = (int)chunk->RawCorners.size();
+	poly.NumCorners = 0;
+	poly.NumV = (int)chunk->Vertices.size();
+	poly.NumN = (int)chunk->Normals.size();
+	poly.NumT = (int)chunk->TextureCoords.size();
+
+	for (; ; )
+	{
+		p = SkipSpaces(p, eol);
+		if (p >= eol || poly.NumCorners >= MAXFACECORNERS)
+			break;
+
+		struct face corner;
+		p = ParseObjVTN(p, eol, &corner.v, &corner.t, &corner.n);
+		chunk->RawCorners.push_back(corner);
+		poly.NumCorners++;
+	}
+
+	chunk->Polygons.push_back(poly);
+}
+
+
+static void
+ParseObjLine(const char* p, const char* eol, ObjChunk* chunk)
+{
+	p = SkipSpaces(p, eol);
+	if (eol - p < 2)
+		return;
+
+	// anything other than v, vn, vt, and f is something we don't feel like handling today:
+
+	if (p[0] == 'v' && IsSpace(p[1]))
+	{
+		struct Vertex sv;
+		p = ParseObjFloat(SkipSpaces(p + 2, eol), eol, &sv.x);
+		p = ParseObjFloat(SkipSpaces(p, eol), eol, &sv.y);
+		p = ParseObjFloat(SkipSpaces(p, eol), eol, &sv.z);
+		chunk->Vertices.push_back(sv);
+
+		if (sv.x < chunk->xmin)	chunk->xmin = sv.x;
+		if (sv.x > chunk->xmax)	chunk->xmax = sv.x;
+		if (sv.y < chunk->ymin)	chunk->ymin = sv.y;
+		if (sv.y > chunk->ymax)	chunk->ymax = sv.y;
+		if (sv.z < chunk->zmin)	chunk->zmin = sv.z;
+		if (sv.z > chunk->zmax)	chunk->zmax = sv.z;
+	}
+	else if (p[0] == 'v' && p[1] == 'n' && eol - p > 2 && IsSpace(p[2]))
+	{
+		struct Normal sn;
+		p = ParseObjFloat(SkipSpaces(p + 3, eol), eol, &sn.nx);
+		p = ParseObjFloat(SkipSpaces(p, eol), eol, &sn.ny);
+		p = ParseObjFloat(SkipSpaces(p, eol), eol, &sn.nz);
+		chunk->Normals.push_back(sn);
+	}
+	else if (p[0] == 'v' && p[1] == 't' && eol - p > 2 && IsSpace(p[2]))
+	{
+		struct TextureCoord st;
+		p = ParseObjFloat(SkipSpaces(p + 3, eol), eol, &st.s);
+		p = ParseObjFloat(SkipSpaces(p, eol), eol, &st.t);
+		chunk->TextureCoords.push_back(st);
+	}
+	else if (p[0] == 'f' && IsSpace(p[1]))
+	{
+		ParseObjFace(p + 2, eol, chunk);
+	}
+}
+
+
+static void
+ParseObjChunk(ObjChunk* chunk)
+{
+	chunk->xmin = chunk->ymin = chunk->zmin = 1.e+37f;
+	chunk->xmax = chunk->ymax = chunk->zmax = -1.e+37f;
+
+	// guess the list sizes from the chunk size so the vectors are not constantly regrowing
+	// (a typical v/vt/vn/f line is 30-40 bytes):
+
+	size_t guess = (chunk->End - chunk->Begin) / 128;
+	chunk->Vertices.reserve(guess);
+	chunk->Normals.reserve(guess);
+	chunk->TextureCoords.reserve(guess);
+	chunk->RawCorners.reserve(3 * guess);
+	chunk->Polygons.reserve(guess);
+
+	const char* p = chunk->Begin;
+	const char* end = chunk->End;
+	while (p < end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		ParseObjLine(p, eol, chunk);
+		p = eol + 1;
+	}
+}
+
+
+// resolve the chunk's faces against the global lists and fan them into triangles
+// (the same rules the line-at-a-time reader uses, with "so far" counted over the whole file)
+
+static void
+ResolveObjChunk(ObjChunk* chunk)
+{
+	chunk->Triangles.reserve(3 * chunk->Polygons.size());
+
+	for (const ObjPolygon& poly : chunk->Polygons)
+	{
+		struct face vertices[MAXFACECORNERS];
+
+		int sizev = chunk->BaseV + poly.NumV;
+		int sizen = chunk->BaseN + poly.NumN;
+		int sizet = chunk->BaseT + poly.NumT;
+
+		bool valid = true;
+		for (int i = 0; i < poly.NumCorners; i++)
+		{
+			int v = chunk->RawCorners[poly.FirstCorner + i].v;
+			int n = chunk->RawCorners[poly.FirstCorner + i].n;
+			int t = chunk->RawCorners[poly.FirstCorner + i].t;
+
+			// if v, n, or t are negative, they are wrt the end of their respective list:
+
+			if (v < 0)
+				v += (sizev + 1);
+
+			if (n < 0)
+				n += (sizen + 1);
+
+			if (t < 0)
+				t += (sizet + 1);
+
+
+			// be sure we are not out-of-bounds:
+
+			if (t > sizet || t < 0)
+			{
+				fprintf(stderr, "Read texture coord %d, but only have %d so far\n", t, sizet);
+				t = 0;
+			}
+
+			if (n > sizen || n < 0)
+			{
+				fprintf(stderr, "Read normal %d, but only have %d so far\n", n, sizen);
+				n = 0;
+			}
+
+			if (v > sizev || v < 1)
+			{
+				fprintf(stderr, "Read vertex coord %d, but only have %d so far\n", v, sizev);
+				valid = false;
+			}
+
+			vertices[i].v = v;
+			vertices[i].n = n;
+			vertices[i].t = t;
+		}
+
+		// if vertices are invalid, don't keep anything this time:
+
+		if (!valid || poly.NumCorners < 3)
+			continue;
+
+		for (int it = 0; it < poly.NumCorners - 2; it++)
+		{
+			chunk->Triangles.push_back(vertices[0]);
+			chunk->Triangles.push_back(vertices[it + 1]);
+			chunk->Triangles.push_back(vertices[it + 2]);
+		}
+	}
+
+	chunk->RawCorners.clear();
+	chunk->RawCorners.shrink_to_fit();
+	chunk->Polygons.clear();
+	chunk->Polygons.shrink_to_fit();
+}
+
+
+template <class T>
+static void
+AppendChunkList(std::vector<T>* dst, size_t first, const std::vector<T>& src)
+{
+	if (!src.empty())
+		memcpy(&(*dst)[first], src.data(), src.size() * sizeof(T));
+}
+
+
+// read an obj file into *obj
+// the file is split into up to numThreads newline-aligned chunks that are parsed in parallel
+// (0 = one chunk per core) and then merged back together in file order
+// returns 0 on success, 1 if the file could not be read (same as LoadObjFile( ))
+
+int
+ReadObjFile(const char* name, ObjData* obj, int numThreads)
+{
+	obj->Vertices.clear();
+	obj->Normals.clear();
+	obj->TextureCoords.clear();
+	obj->Corners.clear();
+
+	obj->xmin = obj->ymin = obj->zmin = 1.e+37f;
+	obj->xmax = obj->ymax = obj->zmax = -1.e+37f;
+
+	MappedFile file;
+	if (!file.Open(name))
+	{
+		fprintf(stderr, "Cannot open .obj file '%s'\n", name);
+		return 1;
+	}
+
+	const char* begin = file.Data();
+	const char* end = begin + file.Size();
+
+	// don't bother splitting small files:
+
+	if (numThreads <= 0)
+		numThreads = ThreadPool::Shared().NumThreads();
+
+	size_t maxChunks = file.Size() / MINOBJCHUNKSIZE + 1;
+	int numChunks = (size_t)numThreads < maxChunks ? numThreads : (int)maxChunks;
+
+	std::vector<ObjChunk> chunks(numChunks);
+	const char* p = begin;
+	for (int i = 0; i < numChunks; i++)
+	{
+		const char* split = (i == numChunks - 1) ? end : begin + file.Size() / numChunks * (i + 1);
+		if (split < p)
+			split = p;
+		if (split < end)
+		{
+			split = (const char*)memchr(split, '\n', end - split);
+			split = (split == NULL) ? end : split + 1;
+		}
+
+		chunks[i].Begin = p;
+		chunks[i].End = split;
+		p = split;
+	}
+
+	ParallelFor(numChunks, [&chunks](int i) { ParseObjChunk(&chunks[i]); });
+
+
+	// prefix sums give each chunk's starting index in the global lists:
+
+	int baseV = 0, baseN = 0, baseT = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.BaseV = baseV;
+		chunk.BaseN = baseN;
+		chunk.BaseT = baseT;
+		baseV += (int)chunk.Vertices.size();
+		baseN += (int)chunk.Normals.size();
+		baseT += (int)chunk.TextureCoords.size();
+	}
+
+	ParallelFor(numChunks, [&chunks](int i) { ResolveObjChunk(&chunks[i]); });
+
+	size_t numCorners = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.FirstTriangleCorner = numCorners;
+		numCorners += chunk.Triangles.size();
+
+		obj->xmin = fminf(obj->xmin, chunk.xmin);
+		obj->ymin = fminf(obj->ymin, chunk.ymin);
+		obj->zmin = fminf(obj->zmin, chunk.zmin);
+		obj->xmax = fmaxf(obj->xmax, chunk.xmax);
+		obj->ymax = fmaxf(obj->ymax, chunk.ymax);
+		obj->zmax = fmaxf(obj->zmax, chunk.zmax);
+	}
+
+
+	// copy everything into place:
+
+	obj->Vertices.resize(baseV);
+	obj->Normals.resize(baseN);
+	obj->TextureCoords.resize(baseT);
+	obj->Corners.resize(numCorners);
+
+	ParallelFor(numChunks, [&chunks, obj](int i)
+	{
+		ObjChunk& chunk = chunks[i];
+		AppendChunkList(&obj->Vertices, chunk.BaseV, chunk.Vertices);
+		AppendChunkList(&obj->Normals, chunk.BaseN, chunk.Normals);
+		AppendChunkList(&obj->TextureCoords, chunk.BaseT, chunk.TextureCoords);
+		AppendChunkList(&obj->Corners, chunk.FirstTriangleCorner, chunk.Triangles);
+	});
+
+	return 0;
+}
+
+
+
+// read an obj file into *obj a batch at a time
+// after each batch has been appended, batchDone( firstCorner, numCorners ) is called (on this thread)
+// with the range of obj->Corners it added, so the caller can use those triangles right away
+// (batches are parsed a group at a time, one per pool thread, and handed over in file order)
+// if cancel is given and gets set, reading stops after the group of batches it is on
+// returns 0 on success, 1 if the file could not be read or the read was cancelled
+
+int
+ReadObjFileStreaming(const char* name, ObjData* obj, const std::function<void(size_t, size_t)>& batchDone,
+	const std::atomic<bool>* cancel)
+{
+	obj->Vertices.clear();
+	obj->Normals.clear();
+	obj->TextureCoords.clear();
+	obj->Corners.clear();
+
+	obj->xmin = obj->ymin = obj->zmin = 1.e+37f;
+	obj->xmax = obj->ymax = obj->zmax = -1.e+37f;
+
+	MappedFile file;
+	if (!file.Open(name))
+	{
+		fprintf(stderr, "Cannot open .obj file '%s'\n", name);
+		return 1;
+	}
+
+	const char* end = file.Data() + file.Size();
+	int groupSize = ThreadPool::Shared().NumThreads();
+	std::vector<ObjChunk> chunks(groupSize);
+
+	const char* p = file.Data();
+	while (p < end)
+	{
+		if (cancel != NULL && *cancel)
+			return 1;
+
+		// cut the next group of batches:
+
+		int numChunks = 0;
+		for (; numChunks < groupSize && p < end; numChunks++)
+		{
+			const char* split = (size_t)(end - p) > OBJSTREAMBATCHSIZE ? p + OBJSTREAMBATCHSIZE : end;
+			if (split < end)
+			{
+				split = (const char*)memchr(split, '\n', end - split);
+				split = (split == NULL) ? end : split + 1;
+			}
+
+			chunks[numChunks] = ObjChunk();
+			chunks[numChunks].Begin = p;
+			chunks[numChunks].End = split;
+			p = split;
+		}
+
+		ParallelFor(numChunks, [&chunks](int i) { ParseObjChunk(&chunks[i]); });
+
+		int baseV = (int)obj->Vertices.size();
+		int baseN = (int)obj->Normals.size();
+		int baseT = (int)obj->TextureCoords.size();
+		for (int i = 0; i < numChunks; i++)
+		{
+			chunks[i].BaseV = baseV;
+			chunks[i].BaseN = baseN;
+			chunks[i].BaseT = baseT;
+			baseV += (int)chunks[i].Vertices.size();
+			baseN += (int)chunks[i].Normals.size();
+			baseT += (int)chunks[i].TextureCoords.size();
+		}
+
+		ParallelFor(numChunks, [&chunks](int i) { ResolveObjChunk(&chunks[i]); });
+
+
+		// hand the batches over in file order:
+
+		for (int i = 0; i < numChunks; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			obj->Vertices.insert(obj->Vertices.end(), chunk.Vertices.begin(), chunk.Vertices.end());
+			obj->Normals.insert(obj->Normals.end(), chunk.Normals.begin(), chunk.Normals.end());
+			obj->TextureCoords.insert(obj->TextureCoords.end(), chunk.TextureCoords.begin(), chunk.TextureCoords.end());
+
+			obj->xmin = fminf(obj->xmin, chunk.xmin);
+			obj->ymin = fminf(obj->ymin, chunk.ymin);
+			obj->zmin = fminf(obj->zmin, chunk.zmin);
+			obj->xmax = fmaxf(obj->xmax, chunk.xmax);
+			obj->ymax = fmaxf(obj->ymax, chunk.ymax);
+			obj->zmax = fmaxf(obj->zmax, chunk.zmax);
+
+			size_t firstCorner = obj->Corners.size();
+			obj->Corners.insert(obj->Corners.end(), chunk.Triangles.begin(), chunk.Triangles.end());
+			chunk = ObjChunk();
+
+			batchDone(firstCorner, obj->Corners.size() - firstCorner);
+		}
+	}
+
+	return 0;
+}
+
+
+// write a synthetic grid obj with about numFaces triangles
+// (v/vt/vn on every corner, like an exported terrain)
+
+static bool
+WriteSyntheticObj(const char* name, int numFaces)
+{
+	FILE* fp = fopen(name, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot create synthetic .obj file '%s'\n", name);
+		return false;
+	}
+
+	int n = (int)sqrt(numFaces / 2.) + 1;		// vertices per side
+	fprintf(fp, "# synthetic %d x %d terrain grid\n", n, n);
+
+	for (int j = 0; j < n; j++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			float s = (float)i / (float)(n - 1);
+			float t = (float)j / (float)(n - 1);
+			float h = 0.1f * sinf(20.f * s) * cosf(20.f * t);
+			fprintf(fp, "v %f %f %f\n", 2.f * s - 1.f, h, 2.f * t - 1.f);
+			fprintf(fp, "vt %f %f\n", s, t);
+			fprintf(fp, "vn %f %f %f\n", 0.f, 1.f, 0.f);
+		}
+	}
+
+	for (int j = 0; j < n - 1; j++)
+	{
+		for (int i = 0; i < n - 1; i++)
+		{
+			int a = 1 + j * n + i;
+			int b = a + 1;
+			int c = a + n;
+			int d = c + 1;
+			fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+			fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+
+// time the original getc/strtok/atof reader against the mapped reader, serial and parallel
+// if numFaces > 0, a synthetic obj file of that size is written to filename first
+
+void
+BenchmarkObjReaders(const char* filename, int numFaces)
+{
+	if (numFaces > 0)
+	{
+		fprintf(stderr, "Writing synthetic obj file '%s' with %d faces\n", filename, numFaces);
+		if (!WriteSyntheticObj(filename, numFaces))
+			return;
+	}
+
+	ObjData legacy, mapped, parallel;
+
+	auto t0 = std::chrono::steady_clock::now();
+	int legacyStatus = ReadObjFileLegacy((char*)filename, &legacy);
+	auto t1 = std::chrono::steady_clock::now();
+	int mappedStatus = ReadObjFile(filename, &mapped, 1);
+	auto t2 = std::chrono::steady_clock::now();
+	int parallelStatus = ReadObjFile(filename, &parallel, 0);
+	auto t3 = std::chrono::steady_clock::now();
+
+	if (legacyStatus != 0 || mappedStatus != 0 || parallelStatus != 0)
+		return;
+
+	double legacyMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	double mappedMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	double parallelMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+
+	fprintf(stderr, "Legacy reader:   %10.2f ms\n", legacyMs);
+	fprintf(stderr, "Mapped reader:   %10.2f ms  (%.1fx)\n", mappedMs, legacyMs / mappedMs);
+	fprintf(stderr, "Parallel reader: %10.2f ms  (%.1fx, %d threads)\n", parallelMs, legacyMs / parallelMs,
+		ThreadPool::Shared().NumThreads());
+	fprintf(stderr, "Vertices %d / %d, triangles %d / %d\n",
+		(int)legacy.Vertices.size(), (int)mapped.Vertices.size(),
+		(int)legacy.Corners.size() / 3, (int)mapped.Corners.size() / 3);
+
+	// both readers have to agree on the results:
+
+	float maxError = 0.f;
+	size_t numVertices = legacy.Vertices.size() < mapped.Vertices.size() ? legacy.Vertices.size() : mapped.Vertices.size();
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		maxError = fmaxf(maxError, fabsf(legacy.Vertices[i].x - mapped.Vertices[i].x));
+		maxError = fmaxf(maxError, fabsf(legacy.Vertices[i].y - mapped.Vertices[i].y));
+		maxError = fmaxf(maxError, fabsf(legacy.Vertices[i].z - mapped.Vertices[i].z));
+	}
+	bool sameCorners = legacy.Corners.size() == mapped.Corners.size() &&
+		memcmp(legacy.Corners.data(), mapped.Corners.data(), legacy.Corners.size() * sizeof(struct face)) == 0;
+	bool sameParallel = parallel.Vertices.size() == mapped.Vertices.size() &&
+		parallel.Corners.size() == mapped.Corners.size() &&
+		memcmp(parallel.Vertices.data(), mapped.Vertices.data(), mapped.Vertices.size() * sizeof(struct Vertex)) == 0 &&
+		memcmp(parallel.Corners.data(), mapped.Corners.data(), mapped.Corners.size() * sizeof(struct face)) == 0;
+
+	fprintf(stderr, "Largest vertex difference = %g, corners %s, parallel results %s\n", maxError,
+		sameCorners ? "match" : "DO NOT match", sameParallel ? "match" : "DO NOT match");
+}
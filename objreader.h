@@ -0,0 +1,59 @@
+#ifndef OBJREADER_H
+#define OBJREADER_H
+
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+#include <vector>
+
+
+struct Vertex
+{
+	float x, y, z;
+};
+
+
+struct Normal
+{
+	float nx, ny, nz;
+};
+
+
+struct TextureCoord
+{
+	float s, t;		// a 3rd (p) component in the file is ignored
+};
+
+
+struct face
+{
+	int v, n, t;
+};
+
+
+// the parsed contents of an obj file
+// faces are already fanned into triangles, so Corners holds 3 entries per triangle
+// corner indices are 1-based into the lists, 0 means "not given" (only legal for n and t)
+
+struct ObjData
+{
+	std::vector<struct Vertex>		Vertices;
+	std::vector<struct Normal>		Normals;
+	std::vector<struct TextureCoord>	TextureCoords;
+	std::vector<struct face>		Corners;
+
+	float	xmin, ymin, zmin;
+	float	xmax, ymax, zmax;
+};
+
+
+// most corners the obj reader will keep for a single face:
+
+constexpr int MAXFACECORNERS{ 10 };
+
+
+int	ReadObjFile(const char*, ObjData*, int = 0);
+int	ReadObjFileStreaming(const char*, ObjData*, const std::function<void(size_t, size_t)>&, const std::atomic<bool>* = NULL);
+void	BenchmarkObjReaders(const char*, int);
+
+#endif		// #ifndef OBJREADER_H
@@ -0,0 +1,200 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "bmpreader.h"
+#include "riverdata.h"
+#include "threadpool.h"
+#include "utils.h"
+
+
+constexpr int RIVERWATERTHRESHOLD{ 12 };		// blue minus red above this is water (river.frag's 0.05, in bytes)
+
+
+// squared distance from each sample to the nearest feature along one line
+// (Felzenszwalb and Huttenlocher's lower envelope of parabolas, f = 0 at features, "infinity" elsewhere)
+
+static void
+DistanceTransform1D(const double* f, int n, double* d, int* v, double* z)
+{
+	int k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for (int q = 1; q < n; q++)
+	{
+		// where the parabola from q overtakes the last one in the envelope,
+		// dropping any it hides completely (never the first, since z[0] is -infinity):
+		double s;
+		for (;;)
+		{
+			s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2. * (q - v[k]));
+			if (s > z[k])
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = HUGE_VAL;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q)
+			k++;
+		d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+
+// squared euclidean distance, in texels, from every texel to the nearest one with isFeature set:
+// a pass down every column then along every row, both on the thread pool
+
+static void
+SquaredDistanceToFeature(const std::vector<bool>& isFeature, int width, int height, std::vector<double>* distance)
+{
+	double far = 2. * ((double)width * width + (double)height * height);
+	distance->resize((size_t)width * height);
+	for (size_t i = 0; i < distance->size(); i++)
+		(*distance)[i] = isFeature[i] ? 0. : far;
+
+	auto pass = [&](int numLines, int length, size_t lineStep, size_t sampleStep)
+	{
+		ParallelFor(numLines, [&](int line)
+		{
+			std::vector<double> f(length), d(length), z(length + 1);
+			std::vector<int> v(length);
+			double* first = distance->data() + line * lineStep;
+			for (int i = 0; i < length; i++)
+				f[i] = first[i * sampleStep];
+			DistanceTransform1D(f.data(), length, d.data(), v.data(), z.data());
+			for (int i = 0; i < length; i++)
+				first[i * sampleStep] = d[i];
+		});
+	};
+	pass(width, height, 1, width);
+	pass(height, width, width, 1);
+}
+
+
+// write 32-bit bottom-up BGRA texels as a BI_RGB .bmp:
+
+static bool
+WriteBmp32(const char* filename, int width, int height, const std::vector<unsigned char>& bgra)
+{
+	unsigned char header[54];
+	memset(header, 0, sizeof(header));
+	unsigned int pixelBytes = (unsigned int)bgra.size();
+	auto put32 = [&](int offset, unsigned int value)
+	{
+		for (int i = 0; i < 4; i++)
+			header[offset + i] = (unsigned char)(value >> (8 * i));
+	};
+	header[0] = 'B';
+	header[1] = 'M';
+	put32(2, sizeof(header) + pixelBytes);		// file size
+	put32(10, sizeof(header));			// offset to the pixels
+	put32(14, 40);					// BITMAPINFOHEADER
+	put32(18, width);
+	put32(22, height);
+	header[26] = 1;					// planes
+	header[28] = 32;				// bits per pixel
+	put32(34, pixelBytes);
+
+	FILE* fp = fopen(filename, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot create river data file '%s'\n", filename);
+		return false;
+	}
+	bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+		fwrite(bgra.data(), 1, bgra.size(), fp) == bgra.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		fprintf(stderr, "Cannot write river data file '%s'\n", filename);
+	return ok;
+}
+
+
+// bake the river mask and flow map into dataName (see riverdata.h)
+// the result is the size of the mask; the flow map is resampled to it if need be
+// returns false (after saying why) if any of the files is no good
+
+bool
+BakeRiverData(const char* maskName, const char* flowName, const char* dataName)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	int width, height, flowWidth, flowHeight;
+	unsigned char* mask = ReadBmpFile(maskName, &width, &height);
+	if (mask == NULL)
+		return false;
+	unsigned char* flow = ReadBmpFile(flowName, &flowWidth, &flowHeight);
+	if (flow == NULL)
+	{
+		delete[] mask;
+		return false;
+	}
+
+	size_t numTexels = (size_t)width * height;
+	std::vector<unsigned char> water(numTexels);
+	std::vector<bool> isWater(numTexels), isLand(numTexels);
+	for (size_t i = 0; i < numTexels; i++)
+	{
+		int amount = mask[3 * i + 2] - mask[3 * i + 0];
+		water[i] = (unsigned char)(amount > 0 ? amount : 0);
+		isWater[i] = amount > RIVERWATERTHRESHOLD;
+		isLand[i] = !isWater[i];
+	}
+	delete[] mask;
+
+	std::vector<double> toLand, toWater;
+	SquaredDistanceToFeature(isLand, width, height, &toLand);
+	SquaredDistanceToFeature(isWater, width, height, &toWater);
+
+	// the shore is halfway between a water texel and the land texel next to it:
+
+	std::vector<unsigned char> bgra(4 * numTexels);
+	ParallelFor(height, [&](int t)
+	{
+		int flowT = (int)((long long)t * flowHeight / height);
+		for (int s = 0; s < width; s++)
+		{
+			size_t i = (size_t)t * width + s;
+			double distance = isWater[i] ? sqrt(toLand[i]) - 0.5 : 0.5 - sqrt(toWater[i]);
+			double level = RIVERDATAZERO + distance * RIVERDATADISTANCESCALE + 0.5;
+			const unsigned char* flowTexel = flow + 3 * ((size_t)flowT * flowWidth + (long long)s * flowWidth / width);
+
+			unsigned char* out = &bgra[4 * i];
+			out[0] = flowTexel[0];
+			out[1] = (unsigned char)(level < 0. ? 0. : (level > 255. ? 255. : level));
+			out[2] = water[i];
+			out[3] = flowTexel[1];
+		}
+	});
+	delete[] flow;
+
+	if (!WriteBmp32(dataName, width, height, bgra))
+		return false;
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	fprintf(stderr, "Baked '%s' and '%s' -> '%s': %d x %d, %.0f ms\n", maskName, flowName, dataName, width, height, ms);
+	return true;
+}
+
+
+// rebake dataName if it is missing or older than the mask or the flow map
+// returns false if it is out of date and cannot be baked
+
+bool
+UpdateRiverData(const char* maskName, const char* flowName, const char* dataName)
+{
+	long long dataTime = FileTime(dataName);
+	if (dataTime >= 0 && dataTime >= FileTime(maskName) && dataTime >= FileTime(flowName))
+		return true;
+	return BakeRiverData(maskName, flowName, dataName);
+}
@@ -0,0 +1,21 @@
+#ifndef RIVERDATA_H
+#define RIVERDATA_H
+
+// everything river.frag needs to know about the river, baked into one 32-bit .bmp
+// so a water fragment costs one texture fetch:
+//	red	how much water: blue minus red of the river mask (the shader's old "b - r > 0.05" test as is)
+//	green	signed distance to the shore in texels, RIVERDATADISTANCESCALE steps per texel around 128
+//		(positive in the water, so "shallow" is one compare instead of four more fetches)
+//	blue	flow map red
+//	alpha	flow map green
+// the file is rebaked whenever it is older than the mask or the flow map
+
+
+constexpr float RIVERDATADISTANCESCALE{ 8.f };		// keep in sync with river.frag
+constexpr int RIVERDATAZERO{ 128 };
+
+
+bool	BakeRiverData(const char*, const char*, const char*);
+bool	UpdateRiverData(const char*, const char*, const char*);
+
+#endif		// #ifndef RIVERDATA_H
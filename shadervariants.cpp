@@ -0,0 +1,139 @@
+#include <stdio.h>
+
+#include "glslprogram.h"
+#include "shadervariants.h"
+
+
+ShaderVariants::ShaderVariants() : Last(NULL), Stale(NULL)
+{
+}
+
+
+static void
+DeleteVariant(GLSLProgram* program)
+{
+	program->DeleteProgram();
+	delete program;
+}
+
+
+// the last file and the flags that are on, for messages:
+
+static std::string
+VariantName(const ShaderVariants& variants, unsigned int key)
+{
+	std::string name = variants.Files.empty() ? "" : variants.Files.back();
+	name += " [";
+	for (size_t i = 0; i < variants.Flags.size(); i++)
+	{
+		if ((key >> i) & 1)
+			name += " " + variants.Flags[i];
+	}
+	return name + " ]";
+}
+
+
+// start building a variant, if it is not built, being built, or known not to build
+// (to have it ready before it is asked for)
+
+void
+StartShaderVariant(ShaderVariants* variants, unsigned int key)
+{
+	if (variants->Ready.count(key) != 0 || variants->Building.count(key) != 0 || variants->Failed.count(key) != 0)
+		return;
+
+	GLSLProgram* program = new GLSLProgram();
+	for (size_t i = 0; i < variants->Flags.size(); i++)
+		program->Define(variants->Flags[i].c_str(), (key >> i) & 1);
+	for (auto& constant : variants->Constants)
+		program->Define(constant.first.c_str(), constant.second);
+
+	char* files[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	for (size_t i = 0; i < variants->Files.size() && i < 6; i++)
+		files[i] = (char*)variants->Files[i].c_str();
+	if (!program->CreateAsync(files[0], files[1], files[2], files[3], files[4], files[5]))
+	{
+		fprintf(stderr, "Shader variant %s did not build\n", VariantName(*variants, key).c_str());
+		DeleteVariant(program);
+		variants->Failed.insert(key);
+		return;
+	}
+	variants->Building[key] = program;
+}
+
+
+// move the variants whose builds have finished into Ready (or Failed):
+
+static void
+PollShaderVariants(ShaderVariants* variants)
+{
+	for (auto building = variants->Building.begin(); building != variants->Building.end(); )
+	{
+		GLSLProgram* program = building->second;
+		GLSLProgram::BuildStatus status = program->PollBuild();
+		if (status == GLSLProgram::BUILD_PENDING)
+		{
+			++building;
+			continue;
+		}
+
+		if (status == GLSLProgram::BUILD_READY && (!variants->Prepare || variants->Prepare(program)))
+			variants->Ready[building->first] = program;
+		else
+		{
+			fprintf(stderr, "Shader variant %s did not build\n", VariantName(*variants, building->first).c_str());
+			DeleteVariant(program);
+			variants->Failed.insert(building->first);
+		}
+		building = variants->Building.erase(building);
+	}
+}
+
+
+// the program for a variant if it is ready, otherwise the last one handed out, or any that is ready
+// (starting the build if need be)
+// returns NULL until some variant has been ready
+
+GLSLProgram*
+GetShaderVariant(ShaderVariants* variants, unsigned int key)
+{
+	PollShaderVariants(variants);
+
+	auto ready = variants->Ready.find(key);
+	if (ready == variants->Ready.end())
+	{
+		StartShaderVariant(variants, key);
+		if (variants->Last != NULL || variants->Ready.empty())
+			return variants->Last;
+		ready = variants->Ready.begin();	// some other variant beats none
+	}
+
+	if (variants->Stale != NULL)
+	{
+		DeleteVariant(variants->Stale);
+		variants->Stale = NULL;
+	}
+	variants->Last = ready->second;
+	return variants->Last;
+}
+
+
+// throw away every variant so they are built again from the files as they are asked for
+// (the last one handed out stays in use until the first new one is ready)
+
+void
+RebuildShaderVariants(ShaderVariants* variants)
+{
+	for (auto& building : variants->Building)
+		DeleteVariant(building.second);
+	for (auto& ready : variants->Ready)
+	{
+		if (ready.second != variants->Last)
+			DeleteVariant(ready.second);
+	}
+	variants->Stale = variants->Last;
+
+	variants->Building.clear();
+	variants->Ready.clear();
+	variants->Failed.clear();
+}
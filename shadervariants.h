@@ -0,0 +1,44 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class GLSLProgram;
+
+// one shader built as a separate program for every combination of features it is drawn with,
+// so each program has its features fixed at compile time (no branching on uniforms, constants folded):
+//	a variant is named by a key whose bit i #defines Flags[i] as 1 (0 when the bit is clear),
+//	and every variant gets the same Constants (see GLSLProgram::Define( ))
+//	a variant is built in the background the first time it is asked for (see GLSLProgram::CreateAsync( )),
+//	and the last one that was ready is handed out until it is, so flipping a feature never stalls a frame
+//	the binary cache keeps every variant that has been built, so on later runs they are ready at once
+
+
+struct ShaderVariants
+{
+	std::vector<std::string>			Files;
+	std::vector<std::string>			Flags;
+	std::vector<std::pair<std::string, int>>	Constants;
+	std::function<bool(GLSLProgram*)>		Prepare;	// called once a variant is built (uniform blocks,
+									// texture units); returning false throws it away
+
+	std::map<unsigned int, GLSLProgram*>		Ready;
+	std::map<unsigned int, GLSLProgram*>		Building;
+	std::set<unsigned int>				Failed;		// not tried again until RebuildShaderVariants( )
+	GLSLProgram*					Last;		// the one most recently handed out, NULL if none yet
+	GLSLProgram*					Stale;		// Last, from before a rebuild, until a new one is ready
+
+	ShaderVariants();
+};
+
+
+void		StartShaderVariant(ShaderVariants*, unsigned int);
+GLSLProgram*	GetShaderVariant(ShaderVariants*, unsigned int);
+void		RebuildShaderVariants(ShaderVariants*);
+
+#endif		// #ifndef SHADERVARIANTS_H
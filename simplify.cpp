@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "mesh.h"
+#include "meshlet.h"
+#include "meshopt.h"
+#include "simplify.h"
+#include "threadpool.h"
+
+
+constexpr int MAXSIMPLIFYPASSES{ 100 };
+
+
+// sum of squared distances to a set of planes, weighted by triangle area
+// (symmetric 4x4 matrix: xx xy xz xw yy yz yw zz zw ww)
+
+struct Quadric
+{
+	double	a[10];
+	double	Weight;
+};
+
+
+static void
+AddPlane(Quadric* q, double nx, double ny, double nz, double d, double weight)
+{
+	q->a[0] += weight * nx * nx;	q->a[1] += weight * nx * ny;	q->a[2] += weight * nx * nz;	q->a[3] += weight * nx * d;
+	q->a[4] += weight * ny * ny;	q->a[5] += weight * ny * nz;	q->a[6] += weight * ny * d;
+	q->a[7] += weight * nz * nz;	q->a[8] += weight * nz * d;
+	q->a[9] += weight * d * d;
+	q->Weight += weight;
+}
+
+
+static void
+AddQuadric(Quadric* q, const Quadric& other)
+{
+	for (int i = 0; i < 10; i++)
+		q->a[i] += other.a[i];
+	q->Weight += other.Weight;
+}
+
+
+// mean squared distance of p from the planes of q0 and q1 together:
+
+static float
+QuadricError(const Quadric& q0, const Quadric& q1, const MeshVertex& p)
+{
+	double a[10];
+	for (int i = 0; i < 10; i++)
+		a[i] = q0.a[i] + q1.a[i];
+	double weight = q0.Weight + q1.Weight;
+
+	double x = p.x, y = p.y, z = p.z;
+	double e = a[0] * x * x + a[4] * y * y + a[7] * z * z
+		+ 2. * (a[1] * x * y + a[2] * x * z + a[5] * y * z)
+		+ 2. * (a[3] * x + a[6] * y + a[8] * z)
+		+ a[9];
+
+	return weight > 0. ? (float)(fabs(e) / weight) : 0.f;
+}
+
+
+static void
+Normal(const MeshVertex& a, const MeshVertex& b, const MeshVertex& c, double n[3])
+{
+	double ab[3] = { (double)b.x - a.x, (double)b.y - a.y, (double)b.z - a.z };
+	double ac[3] = { (double)c.x - a.x, (double)c.y - a.y, (double)c.z - a.z };
+	n[0] = ab[1] * ac[2] - ab[2] * ac[1];
+	n[1] = ab[2] * ac[0] - ab[0] * ac[2];
+	n[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+
+// vertices that must not move:
+//	seams	several mesh vertices at one position (different texture coords or normals)
+//	borders	an edge only one triangle uses
+
+static void
+FindLockedVertices(const Mesh& mesh, const unsigned int* indices, size_t numIndices, std::vector<unsigned char>* locked)
+{
+	unsigned int numVertices = (unsigned int)mesh.Vertices.size();
+	const std::vector<MeshVertex>& v = mesh.Vertices;
+
+
+	// group the vertices by position:
+
+	std::vector<unsigned int> order(numVertices);
+	for (unsigned int i = 0; i < numVertices; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&v](unsigned int a, unsigned int b)
+	{
+		if (v[a].x != v[b].x)	return v[a].x < v[b].x;
+		if (v[a].y != v[b].y)	return v[a].y < v[b].y;
+		return v[a].z < v[b].z;
+	});
+
+	std::vector<unsigned int> position(numVertices);		// the first vertex at the same position
+	std::vector<unsigned char> lockedPosition(numVertices, 0);
+	for (unsigned int i = 0; i < numVertices; )
+	{
+		unsigned int j = i + 1;
+		while (j < numVertices && v[order[j]].x == v[order[i]].x && v[order[j]].y == v[order[i]].y && v[order[j]].z == v[order[i]].z)
+			j++;
+		for (unsigned int k = i; k < j; k++)
+			position[order[k]] = order[i];
+		if (j - i > 1)
+			lockedPosition[order[i]] = 1;
+		i = j;
+	}
+
+
+	// an edge a->b is inside the mesh if some triangle around b has the edge b->a:
+
+	std::vector<unsigned int> start(numVertices + 1, 0);
+	for (size_t i = 0; i < numIndices; i++)
+		start[position[indices[i]] + 1]++;
+	for (unsigned int i = 0; i < numVertices; i++)
+		start[i + 1] += start[i];
+	std::vector<unsigned int> triangles(numIndices);
+	std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < numIndices; i++)
+		triangles[fill[position[indices[i]]]++] = (unsigned int)(i / 3);
+
+	for (size_t t = 0; t < numIndices / 3; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = position[indices[3 * t + k]];
+			unsigned int b = position[indices[3 * t + (k + 1) % 3]];
+
+			bool shared = false;
+			for (unsigned int i = start[b]; i < start[b + 1] && !shared; i++)
+			{
+				const unsigned int* other = &indices[3 * triangles[i]];
+				for (int m = 0; m < 3; m++)
+				{
+					if (position[other[m]] == b && position[other[(m + 1) % 3]] == a)
+						shared = true;
+				}
+			}
+
+			if (!shared)
+				lockedPosition[a] = lockedPosition[b] = 1;
+		}
+	}
+
+	locked->resize(numVertices);
+	for (unsigned int i = 0; i < numVertices; i++)
+		(*locked)[i] = lockedPosition[position[i]];
+}
+
+
+struct Collapse
+{
+	unsigned int	From;
+	unsigned int	To;
+	float		Error;
+};
+
+
+// would moving 'from' onto 'to' turn any of the triangles around 'from' over (or nearly so)?
+
+static bool
+CollapseFlips(const Mesh& mesh, const unsigned int* indices, const std::vector<unsigned int>& start,
+	const std::vector<unsigned int>& triangles, unsigned int from, unsigned int to)
+{
+	const std::vector<MeshVertex>& v = mesh.Vertices;
+	for (unsigned int i = start[from]; i < start[from + 1]; i++)
+	{
+		const unsigned int* t = &indices[3 * triangles[i]];
+		if (t[0] == to || t[1] == to || t[2] == to)
+			continue;			// this one disappears
+
+		double before[3], after[3];
+		Normal(v[t[0]], v[t[1]], v[t[2]], before);
+		Normal(v[t[0] == from ? to : t[0]], v[t[1] == from ? to : t[1]], v[t[2] == from ? to : t[2]], after);
+
+		double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+		double lengths = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+			sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+		if (dot < 0.25 * lengths)
+			return true;
+	}
+
+	return false;
+}
+
+
+// simplify the triangles in indices down to about targetIndices indices
+// vertices only ever collapse onto one of their neighbors, so the result uses the mesh's own vertices
+// returns the number of indices written to *result; *error gets the largest collapse error (object units)
+
+size_t
+SimplifyMesh(const Mesh& mesh, const unsigned int* indices, size_t numIndices, size_t targetIndices,
+	std::vector<unsigned int>* result, float* error)
+{
+	unsigned int numVertices = (unsigned int)mesh.Vertices.size();
+	const std::vector<MeshVertex>& v = mesh.Vertices;
+
+	result->assign(indices, indices + numIndices);
+	*error = 0.f;
+	if (numIndices <= targetIndices)
+		return numIndices;
+
+	std::vector<unsigned char> locked;
+	FindLockedVertices(mesh, indices, numIndices, &locked);
+
+	std::vector<Quadric> quadrics(numVertices);
+	memset(quadrics.data(), 0, numVertices * sizeof(Quadric));
+	for (size_t t = 0; t < numIndices / 3; t++)
+	{
+		const unsigned int* tri = &indices[3 * t];
+		double n[3];
+		Normal(v[tri[0]], v[tri[1]], v[tri[2]], n);
+		double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0.)
+			continue;
+
+		double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+		double d = -(nx * v[tri[0]].x + ny * v[tri[0]].y + nz * v[tri[0]].z);
+		for (int k = 0; k < 3; k++)
+			AddPlane(&quadrics[tri[k]], nx, ny, nz, d, 0.5 * length);
+	}
+
+	std::vector<unsigned int>& current = *result;
+	std::vector<unsigned int> remap(numVertices);
+	for (unsigned int i = 0; i < numVertices; i++)
+		remap[i] = i;
+	std::vector<unsigned char> touched(numVertices);
+	std::vector<unsigned int> start(numVertices + 1);
+	std::vector<unsigned int> triangles;
+	std::vector<Collapse> collapses;
+	float maxError = 0.f;
+
+	for (int pass = 0; pass < MAXSIMPLIFYPASSES && current.size() > targetIndices; pass++)
+	{
+		// triangles around each vertex:
+
+		std::fill(start.begin(), start.end(), 0);
+		for (unsigned int index : current)
+			start[index + 1]++;
+		for (unsigned int i = 0; i < numVertices; i++)
+			start[i + 1] += start[i];
+		triangles.resize(current.size());
+		std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+		for (size_t i = 0; i < current.size(); i++)
+			triangles[fill[current[i]]++] = (unsigned int)(i / 3);
+
+
+		// the cheaper direction of every edge (each inside edge shows up twice, so only take a < b):
+
+		collapses.clear();
+		for (size_t i = 0; i < current.size(); i++)
+		{
+			unsigned int a = current[i];
+			unsigned int b = current[i - i % 3 + (i + 1) % 3];
+			if (a > b)
+				continue;
+
+			Collapse c;
+			c.Error = 1.e30f;
+			if (!locked[a])
+			{
+				c.From = a;
+				c.To = b;
+				c.Error = QuadricError(quadrics[a], quadrics[b], v[b]);
+			}
+			if (!locked[b])
+			{
+				float e = QuadricError(quadrics[a], quadrics[b], v[a]);
+				if (e < c.Error)
+				{
+					c.From = b;
+					c.To = a;
+					c.Error = e;
+				}
+			}
+			if (c.Error < 1.e30f)
+				collapses.push_back(c);
+		}
+
+		if (collapses.empty())
+			break;
+
+		// every collapse removes about 2 triangles; take the cheapest ones that don't overlap
+		// (overlaps reject many, so look at a few times as many as are wanted):
+
+		size_t wanted = (current.size() - targetIndices) / 6 + 1;
+		auto cheaper = [](const Collapse& a, const Collapse& b) { return a.Error < b.Error; };
+		if (collapses.size() > 4 * wanted)
+		{
+			std::nth_element(collapses.begin(), collapses.begin() + 4 * wanted, collapses.end(), cheaper);
+			collapses.resize(4 * wanted);
+		}
+		std::sort(collapses.begin(), collapses.end(), cheaper);
+		size_t done = 0;
+		std::fill(touched.begin(), touched.end(), 0);
+		for (const Collapse& c : collapses)
+		{
+			if (done >= wanted)
+				break;
+			if (touched[c.From] || touched[c.To])
+				continue;
+			if (CollapseFlips(mesh, current.data(), start, triangles, c.From, c.To))
+				continue;
+
+			remap[c.From] = c.To;
+			AddQuadric(&quadrics[c.To], quadrics[c.From]);
+			maxError = std::max(maxError, c.Error);
+			done++;
+
+			// the neighbors' triangles just changed, so leave them alone until the next pass:
+			for (unsigned int i = start[c.From]; i < start[c.From + 1]; i++)
+			{
+				const unsigned int* t = &current[3 * triangles[i]];
+				touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+			}
+		}
+
+		if (done == 0)
+			break;
+
+
+		// apply the collapses and drop the triangles that became degenerate:
+
+		size_t kept = 0;
+		for (size_t i = 0; i < current.size(); i += 3)
+		{
+			unsigned int a = remap[current[i + 0]];
+			unsigned int b = remap[current[i + 1]];
+			unsigned int c = remap[current[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			current[kept++] = a;
+			current[kept++] = b;
+			current[kept++] = c;
+		}
+		current.resize(kept);
+
+		for (const Collapse& c : collapses)
+			remap[c.From] = c.From;
+	}
+
+	*error = sqrtf(maxError);
+	return current.size();
+}
+
+
+// append simplified levels to one mesh's index buffer, each from the one before
+
+static void
+BuildLods(Mesh* mesh)
+{
+	mesh->Lods.clear();
+
+	MeshLod full;
+	full.FirstIndex = 0;
+	full.IndexCount = (unsigned int)mesh->Indices.size();
+	full.Error = 0.f;
+	mesh->Lods.push_back(full);
+
+	std::vector<unsigned int> source(mesh->Indices);
+	std::vector<unsigned int> simplified;
+	float error = 0.f;
+	for (int level = 1; level < MAXMESHLODS; level++)
+	{
+		size_t target = (full.IndexCount / 3 >> level) * 3;
+		if (target == 0)
+			break;
+
+		float levelError;
+		SimplifyMesh(*mesh, source.data(), source.size(), target, &simplified, &levelError);
+
+		// stop when the locked vertices won't let it get any smaller:
+		if (simplified.empty() || simplified.size() > source.size() * 9 / 10)
+			break;
+
+		OptimizeVertexCache(simplified.data(), simplified.size(), mesh->Vertices.size());
+
+		// errors can add up along the chain, so stay on the safe side:
+		error += levelError;
+
+		MeshLod lod;
+		lod.FirstIndex = (unsigned int)mesh->Indices.size();
+		lod.IndexCount = (unsigned int)simplified.size();
+		lod.Error = error;
+		mesh->Indices.insert(mesh->Indices.end(), simplified.begin(), simplified.end());
+		mesh->Lods.push_back(lod);
+
+		source.swap(simplified);
+	}
+
+	fprintf(stderr, "Mesh levels of detail:");
+	for (const MeshLod& lod : mesh->Lods)
+		fprintf(stderr, " %d triangles (error %.3g)", (int)lod.IndexCount / 3, lod.Error);
+	fprintf(stderr, "\n");
+}
+
+
+// build the level-of-detail chains for a group of meshes, one thread per mesh:
+
+void
+BuildMeshLods(Mesh** meshes, int numMeshes)
+{
+	ParallelFor(numMeshes, [meshes](int i)
+	{
+		BuildLods(meshes[i]);
+	});
+}
+
+
+// pick the coarsest level whose error covers at most maxPixels on screen
+// (bounds are the mesh's xmin, ymin, zmin, xmax, ymax, zmax; the nearest point of its bounding sphere counts)
+
+int
+SelectMeshLod(const std::vector<MeshLod>& lods, const CullView& view, const float bounds[6], float maxPixels)
+{
+	float pixelsPerUnit = view.PixelScale;
+	if (view.Perspective)
+	{
+		float d[3], radius2 = 0.f;
+		for (int i = 0; i < 3; i++)
+		{
+			float half = 0.5f * (bounds[3 + i] - bounds[i]);
+			radius2 += half * half;
+			d[i] = bounds[i] + half - view.Eye[i];
+		}
+		float distance = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) - sqrtf(radius2);
+		if (distance <= 0.f)
+			return 0;
+		pixelsPerUnit /= distance;
+	}
+
+	int best = 0;
+	for (int i = 1; i < (int)lods.size(); i++)
+	{
+		if (lods[i].Error * pixelsPerUnit > maxPixels)
+			break;
+		best = i;
+	}
+	return best;
+}
@@ -0,0 +1,33 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stddef.h>
+#include <vector>
+
+struct CullView;
+struct Mesh;
+
+// levels of detail: simplified copies of a mesh's triangles that share its vertices
+// (quadric error metric, half-edge collapses, border and seam vertices never move)
+
+
+constexpr int MAXMESHLODS{ 4 };			// the full mesh + 50%, 25%, 12.5%
+constexpr float LODPIXELERROR{ 1.f };		// switch to a coarser level once its error is smaller than this on screen
+
+
+// one level, a range of the mesh's index buffer
+// (level 0 is the full mesh and the range its meshlets cover)
+
+struct MeshLod
+{
+	unsigned int	FirstIndex;
+	unsigned int	IndexCount;
+	float		Error;			// how far the surface may have moved, in object units
+};
+
+
+void	BuildMeshLods(Mesh**, int);
+int	SelectMeshLod(const std::vector<MeshLod>&, const CullView&, const float[6], float = LODPIXELERROR);
+size_t	SimplifyMesh(const Mesh&, const unsigned int*, size_t, size_t, std::vector<unsigned int>*, float*);
+
+#endif		// #ifndef SIMPLIFY_H
@@ -0,0 +1,236 @@
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "mesh.h"
+#include "tangentframes.h"
+#include "threadpool.h"
+
+
+constexpr size_t TANGENTBLOCKSIZE{ 16 * 1024 };		// vertices or triangles per parallel task
+
+
+static int
+NumBlocks(size_t count)
+{
+	return (int)((count + TANGENTBLOCKSIZE - 1) / TANGENTBLOCKSIZE);
+}
+
+
+static float
+Normalize(float v[3])
+{
+	float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length > 0.f)
+	{
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+	return length;
+}
+
+
+// v minus its component along the unit vector n:
+
+static void
+ProjectOut(float v[3], const float n[3])
+{
+	float d = v[0] * n[0] + v[1] * n[1] + v[2] * n[2];
+	v[0] -= d * n[0];
+	v[1] -= d * n[1];
+	v[2] -= d * n[2];
+}
+
+
+// everything the per-vertex pass needs from the triangles, one array per component:
+
+struct TriangleFrames
+{
+	std::vector<float>	nx, ny, nz;		// unit face normal
+	std::vector<float>	tx, ty, tz;		// unit direction of increasing s
+	std::vector<float>	bx, by, bz;		// unit direction of increasing t
+	std::vector<float>	angle;			// angle at each corner (3 per triangle)
+};
+
+
+void
+ComputeTangentFrames(Mesh* mesh)
+{
+	std::vector<MeshVertex>& vertices = mesh->Vertices;
+	const std::vector<unsigned int>& indices = mesh->Indices;
+	size_t numVertices = vertices.size();
+	size_t numTriangles = (mesh->Lods.empty() ? indices.size() : mesh->Lods[0].IndexCount) / 3;
+	if (numVertices == 0 || numTriangles == 0)
+		return;
+
+
+	// positions and texture coords as structure-of-arrays:
+
+	std::vector<float> px(numVertices), py(numVertices), pz(numVertices), ps(numVertices), pt(numVertices);
+	ParallelFor(NumBlocks(numVertices), [&](int block)
+	{
+		size_t last = (block + 1) * TANGENTBLOCKSIZE < numVertices ? (block + 1) * TANGENTBLOCKSIZE : numVertices;
+		for (size_t i = block * TANGENTBLOCKSIZE; i < last; i++)
+		{
+			px[i] = vertices[i].x;
+			py[i] = vertices[i].y;
+			pz[i] = vertices[i].z;
+			ps[i] = vertices[i].s;
+			pt[i] = vertices[i].t;
+		}
+	});
+
+
+	// face normals, texture directions, and corner angles:
+
+	TriangleFrames faces;
+	for (std::vector<float>* list : { &faces.nx, &faces.ny, &faces.nz, &faces.tx, &faces.ty, &faces.tz, &faces.bx, &faces.by, &faces.bz })
+		list->resize(numTriangles);
+	faces.angle.resize(3 * numTriangles);
+
+	ParallelFor(NumBlocks(numTriangles), [&](int block)
+	{
+		size_t last = (block + 1) * TANGENTBLOCKSIZE < numTriangles ? (block + 1) * TANGENTBLOCKSIZE : numTriangles;
+		for (size_t f = block * TANGENTBLOCKSIZE; f < last; f++)
+		{
+			unsigned int i0 = indices[3 * f], i1 = indices[3 * f + 1], i2 = indices[3 * f + 2];
+			float e1[3] = { px[i1] - px[i0], py[i1] - py[i0], pz[i1] - pz[i0] };
+			float e2[3] = { px[i2] - px[i0], py[i2] - py[i0], pz[i2] - pz[i0] };
+			float ds1 = ps[i1] - ps[i0], dt1 = pt[i1] - pt[i0];
+			float ds2 = ps[i2] - ps[i0], dt2 = pt[i2] - pt[i0];
+
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			Normalize(n);
+			faces.nx[f] = n[0];	faces.ny[f] = n[1];	faces.nz[f] = n[2];
+
+			// solve e1 = ds1*T + dt1*B, e2 = ds2*T + dt2*B (only the directions matter, so the
+			// determinant's size doesn't, but its sign does):
+			float det = ds1 * dt2 - ds2 * dt1;
+			float sign = det < 0.f ? -1.f : 1.f;
+			float tangent[3], bitangent[3];
+			for (int k = 0; k < 3; k++)
+			{
+				tangent[k] = sign * (e1[k] * dt2 - e2[k] * dt1);
+				bitangent[k] = sign * (e2[k] * ds1 - e1[k] * ds2);
+			}
+			if (det == 0.f)
+				tangent[0] = tangent[1] = tangent[2] = bitangent[0] = bitangent[1] = bitangent[2] = 0.f;
+			Normalize(tangent);
+			Normalize(bitangent);
+			faces.tx[f] = tangent[0];	faces.ty[f] = tangent[1];	faces.tz[f] = tangent[2];
+			faces.bx[f] = bitangent[0];	faces.by[f] = bitangent[1];	faces.bz[f] = bitangent[2];
+
+			const unsigned int corners[3] = { i0, i1, i2 };
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = corners[k], b = corners[(k + 1) % 3], c = corners[(k + 2) % 3];
+				float ab[3] = { px[b] - px[a], py[b] - py[a], pz[b] - pz[a] };
+				float ac[3] = { px[c] - px[a], py[c] - py[a], pz[c] - pz[a] };
+				float lengths = Normalize(ab) * Normalize(ac);
+				float cosine = ab[0] * ac[0] + ab[1] * ac[1] + ab[2] * ac[2];
+				cosine = cosine < -1.f ? -1.f : (cosine > 1.f ? 1.f : cosine);
+				faces.angle[3 * f + k] = lengths > 0.f ? acosf(cosine) : 0.f;
+			}
+		}
+	});
+
+
+	// the corners around each vertex:
+
+	std::vector<unsigned int> start(numVertices + 1, 0);
+	for (size_t i = 0; i < 3 * numTriangles; i++)
+		start[indices[i] + 1]++;
+	for (size_t v = 0; v < numVertices; v++)
+		start[v + 1] += start[v];
+	std::vector<unsigned int> corners(3 * numTriangles);
+	std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < 3 * numTriangles; i++)
+		corners[fill[indices[i]]++] = (unsigned int)i;
+
+
+	// every vertex gathers from its own corners, so the blocks never write to the same place:
+
+	ParallelFor(NumBlocks(numVertices), [&](int block)
+	{
+		size_t last = (block + 1) * TANGENTBLOCKSIZE < numVertices ? (block + 1) * TANGENTBLOCKSIZE : numVertices;
+		for (size_t v = block * TANGENTBLOCKSIZE; v < last; v++)
+		{
+			MeshVertex& vertex = vertices[v];
+
+			// (a zero-length obj normal is as good as none)
+			float n[3] = { vertex.nx, vertex.ny, vertex.nz };
+			if (vertex.tw == 0.f || Normalize(n) == 0.f)
+			{
+				float sum[3] = { 0.f, 0.f, 0.f };
+				for (unsigned int c = start[v]; c < start[v + 1]; c++)
+				{
+					unsigned int f = corners[c] / 3;
+					float w = faces.angle[corners[c]];
+					sum[0] += w * faces.nx[f];
+					sum[1] += w * faces.ny[f];
+					sum[2] += w * faces.nz[f];
+				}
+				if (Normalize(sum) > 0.f)
+				{
+					n[0] = sum[0];
+					n[1] = sum[1];
+					n[2] = sum[2];
+				}
+				else
+				{
+					// only in zero-area triangles: any unit normal will do
+					n[0] = 0.f;
+					n[1] = 1.f;
+					n[2] = 0.f;
+				}
+			}
+
+			float tangent[3] = { 0.f, 0.f, 0.f }, bitangent[3] = { 0.f, 0.f, 0.f };
+			for (unsigned int c = start[v]; c < start[v + 1]; c++)
+			{
+				unsigned int f = corners[c] / 3;
+				float w = faces.angle[corners[c]];
+				float t[3] = { faces.tx[f], faces.ty[f], faces.tz[f] };
+				float b[3] = { faces.bx[f], faces.by[f], faces.bz[f] };
+				ProjectOut(t, n);
+				ProjectOut(b, n);
+				Normalize(t);
+				Normalize(b);
+				for (int k = 0; k < 3; k++)
+				{
+					tangent[k] += w * t[k];
+					bitangent[k] += w * b[k];
+				}
+			}
+
+			ProjectOut(tangent, n);
+			if (Normalize(tangent) == 0.f)
+			{
+				// no usable texture coords: any direction in the normal's plane will do
+				float axis[3] = { 1.f, 0.f, 0.f };
+				if (fabsf(n[0]) > 0.9f)
+				{
+					axis[0] = 0.f;
+					axis[1] = 1.f;
+				}
+				ProjectOut(axis, n);
+				Normalize(axis);
+				tangent[0] = axis[0];
+				tangent[1] = axis[1];
+				tangent[2] = axis[2];
+			}
+
+			float cross[3] = { n[1] * tangent[2] - n[2] * tangent[1], n[2] * tangent[0] - n[0] * tangent[2], n[0] * tangent[1] - n[1] * tangent[0] };
+			float handedness = cross[0] * bitangent[0] + cross[1] * bitangent[1] + cross[2] * bitangent[2];
+
+			vertex.nx = n[0];
+			vertex.ny = n[1];
+			vertex.nz = n[2];
+			vertex.tx = tangent[0];
+			vertex.ty = tangent[1];
+			vertex.tz = tangent[2];
+			vertex.tw = handedness < 0.f ? -1.f : 1.f;
+		}
+	});
+}
@@ -0,0 +1,16 @@
+#ifndef TANGENTFRAMES_H
+#define TANGENTFRAMES_H
+
+struct Mesh;
+
+// per-vertex tangent frames for an indexed mesh:
+//	vertices whose obj corners had no (or a zero) normal get an angle-weighted smooth normal
+//	every vertex gets a tangent along increasing s and the bitangent's handedness in tw,
+//	accumulated MikkTSpace-style (per corner, projected onto the normal's plane, weighted by the
+//	corner angle) -- vertices are not split where the tangent frames disagree
+// runs in parallel over ranges of vertices, reading the mesh through structure-of-arrays copies
+
+
+void	ComputeTangentFrames(Mesh*);
+
+#endif		// #ifndef TANGENTFRAMES_H
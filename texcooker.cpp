@@ -0,0 +1,477 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bmpreader.h"
+#include "ktx2.h"
+#include "texcooker.h"
+#include "threadpool.h"
+#include "utils.h"
+
+
+const CookRecipe COOKCOLOR{ CODEC_BC1, true, false, { 0.f, 0.f, 0.f }, NULL };
+const CookRecipe COOKNORMALMAP{ CODEC_BC5, false, true, { 0.f, 0.f, 0.f }, "rg01" };
+const CookRecipe COOKFLOWMAP{ CODEC_BC5, false, false, { 0.f, 0.f, 0.f }, "rg01" };
+const CookRecipe COOKWATERMASK{ CODEC_BC4, false, false, { -1.f, 0.f, 1.f }, "00r1" };
+
+constexpr int COOKROWSPERTASK{ 16 };		// texel rows (or block rows) per ParallelFor( ) task
+
+
+// one mip level, 1 or 3 floats per texel:
+
+struct CookLevel
+{
+	int			Width, Height;
+	std::vector<float>	Texels;
+};
+
+
+static unsigned char
+ToByte(float v)
+{
+	v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+	return (unsigned char)(v * 255.f + 0.5f);
+}
+
+
+static void
+ForRowBlocks(int numRows, const std::function<void(int, int)>& body)
+{
+	ParallelFor((numRows + COOKROWSPERTASK - 1) / COOKROWSPERTASK, [&](int task)
+	{
+		int first = task * COOKROWSPERTASK;
+		body(first, first + COOKROWSPERTASK < numRows ? first + COOKROWSPERTASK : numRows);
+	});
+}
+
+
+// the next smaller mip level: a 2x2 box filter (the last row or column repeats for odd sizes)
+
+static void
+Downsample(const CookLevel& src, int channels, bool normalize, CookLevel* dst)
+{
+	dst->Width = src.Width > 1 ? src.Width / 2 : 1;
+	dst->Height = src.Height > 1 ? src.Height / 2 : 1;
+	dst->Texels.resize((size_t)dst->Width * dst->Height * channels);
+
+	ForRowBlocks(dst->Height, [&](int firstRow, int lastRow)
+	{
+		for (int y = firstRow; y < lastRow; y++)
+		{
+			int y0 = 2 * y < src.Height ? 2 * y : src.Height - 1;
+			int y1 = 2 * y + 1 < src.Height ? 2 * y + 1 : src.Height - 1;
+			for (int x = 0; x < dst->Width; x++)
+			{
+				int x0 = 2 * x < src.Width ? 2 * x : src.Width - 1;
+				int x1 = 2 * x + 1 < src.Width ? 2 * x + 1 : src.Width - 1;
+				const float* corners[4] =
+				{
+					&src.Texels[((size_t)y0 * src.Width + x0) * channels], &src.Texels[((size_t)y0 * src.Width + x1) * channels],
+					&src.Texels[((size_t)y1 * src.Width + x0) * channels], &src.Texels[((size_t)y1 * src.Width + x1) * channels]
+				};
+
+				float* out = &dst->Texels[((size_t)y * dst->Width + x) * channels];
+				for (int c = 0; c < channels; c++)
+					out[c] = 0.25f * (corners[0][c] + corners[1][c] + corners[2][c] + corners[3][c]);
+
+				if (normalize)
+				{
+					float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+					if (length > 0.f)
+					{
+						out[0] /= length;
+						out[1] /= length;
+						out[2] /= length;
+					}
+				}
+			}
+		}
+	});
+}
+
+
+// BC1: two 5:6:5 endpoints and a 2-bit index per texel
+
+static unsigned short
+Pack565(const float c[3])
+{
+	int r = (int)(c[0] < 0.f ? 0.f : (c[0] > 255.f ? 31.f : c[0] * 31.f / 255.f + 0.5f));
+	int g = (int)(c[1] < 0.f ? 0.f : (c[1] > 255.f ? 63.f : c[1] * 63.f / 255.f + 0.5f));
+	int b = (int)(c[2] < 0.f ? 0.f : (c[2] > 255.f ? 31.f : c[2] * 31.f / 255.f + 0.5f));
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+
+static void
+Unpack565(unsigned short p, int c[3])
+{
+	int r = (p >> 11) & 31, g = (p >> 5) & 63, b = p & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+
+// pick the indices for a pair of endpoints (c0 > c1, so the block is in 4-color mode)
+// returns the squared error
+
+static int
+FitBc1Indices(const unsigned char texels[16][3], unsigned short c0, unsigned short c1, unsigned int* indices)
+{
+	int palette[4][3];
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	for (int k = 0; k < 3; k++)
+	{
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+
+	int error = 0;
+	*indices = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestDistance = 1 << 30;
+		for (int p = 0; p < 4; p++)
+		{
+			int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+			int distance = dr * dr + dg * dg + db * db;
+			if (distance < bestDistance)
+			{
+				best = p;
+				bestDistance = distance;
+			}
+		}
+		*indices |= (unsigned int)best << (2 * i);
+		error += bestDistance;
+	}
+	return error;
+}
+
+
+// endpoints from the extent of the colors along their principal axis, then one least-squares refit
+
+static void
+EncodeBc1Block(const unsigned char texels[16][3], unsigned char* out)
+{
+	float mean[3] = { 0.f, 0.f, 0.f };
+	for (int i = 0; i < 16; i++)
+		for (int k = 0; k < 3; k++)
+			mean[k] += texels[i][k] / 16.f;
+
+	float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };		// rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+		cov[0] += d[0] * d[0];	cov[1] += d[0] * d[1];	cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1];	cov[4] += d[1] * d[2];	cov[5] += d[2] * d[2];
+	}
+
+	float axis[3] = { 1.f, 1.f, 1.f };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3] =
+		{
+			cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+		};
+		float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length == 0.f)
+			break;
+		axis[0] = next[0] / length;
+		axis[1] = next[1] / length;
+		axis[2] = next[2] / length;
+	}
+
+	float tmin = 0.f, tmax = 0.f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+		tmin = t < tmin ? t : tmin;
+		tmax = t > tmax ? t : tmax;
+	}
+
+	// pull the ends in a little, since the extremes are rarely worth an exact palette entry:
+	float inset = (tmax - tmin) / 16.f;
+	float e0[3], e1[3];
+	for (int k = 0; k < 3; k++)
+	{
+		e0[k] = mean[k] + axis[k] * (tmax - inset);
+		e1[k] = mean[k] + axis[k] * (tmin + inset);
+	}
+
+	unsigned short c0 = Pack565(e0), c1 = Pack565(e1);
+	unsigned int indices = 0;
+	int error = 0;
+	if (c0 < c1)
+	{
+		unsigned short swap = c0;
+		c0 = c1;
+		c1 = swap;
+	}
+	if (c0 != c1)
+		error = FitBc1Indices(texels, c0, c1, &indices);
+
+	// least-squares endpoints for those indices (weights of c0: 1, 0, 2/3, 1/3):
+	if (c0 != c1)
+	{
+		static const float WEIGHTS[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+		float aa = 0.f, bb = 0.f, ab = 0.f, ax[3] = { 0.f, 0.f, 0.f }, bx[3] = { 0.f, 0.f, 0.f };
+		for (int i = 0; i < 16; i++)
+		{
+			float a = WEIGHTS[(indices >> (2 * i)) & 3], b = 1.f - a;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			for (int k = 0; k < 3; k++)
+			{
+				ax[k] += a * texels[i][k];
+				bx[k] += b * texels[i][k];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) > 1e-6f)
+		{
+			float f0[3], f1[3];
+			for (int k = 0; k < 3; k++)
+			{
+				f0[k] = (bb * ax[k] - ab * bx[k]) / det;
+				f1[k] = (aa * bx[k] - ab * ax[k]) / det;
+			}
+			unsigned short r0 = Pack565(f0), r1 = Pack565(f1);
+			if (r0 < r1)
+			{
+				unsigned short swap = r0;
+				r0 = r1;
+				r1 = swap;
+			}
+			unsigned int refitIndices;
+			if (r0 != r1)
+			{
+				int refitError = FitBc1Indices(texels, r0, r1, &refitIndices);
+				if (refitError < error)
+				{
+					c0 = r0;
+					c1 = r1;
+					indices = refitIndices;
+				}
+			}
+		}
+	}
+
+	out[0] = (unsigned char)c0;
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)c1;
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+
+// BC4: two 8-bit endpoints and a 3-bit index per texel (8-value mode: a0 > a1)
+
+static void
+EncodeBc4Block(const unsigned char values[16], unsigned char* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		a0 = values[i] > a0 ? values[i] : a0;
+		a1 = values[i] < a1 ? values[i] : a1;
+	}
+
+	unsigned long long indices = 0;
+	if (a0 > a1)
+	{
+		int palette[8] = { a0, a1 };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int distance = abs(values[i] - palette[p]);
+				if (distance < bestDistance)
+				{
+					best = p;
+					bestDistance = distance;
+				}
+			}
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+
+// encode one level, a row of 4x4 blocks per task
+// (blocks hanging over the edge repeat the last row and column)
+
+static std::vector<unsigned char>
+EncodeLevel(const CookLevel& level, const CookRecipe& recipe)
+{
+	int channels = recipe.Codec == CODEC_BC4 ? 1 : 3;
+	int blockBytes = recipe.Codec == CODEC_BC5 ? 16 : 8;
+	int blocksWide = (level.Width + 3) / 4;
+	int blocksHigh = (level.Height + 3) / 4;
+	std::vector<unsigned char> blocks((size_t)blocksWide * blocksHigh * blockBytes);
+
+	ForRowBlocks(blocksHigh, [&](int firstRow, int lastRow)
+	{
+		for (int by = firstRow; by < lastRow; by++)
+		{
+			for (int bx = 0; bx < blocksWide; bx++)
+			{
+				unsigned char texels[16][3];
+				for (int i = 0; i < 16; i++)
+				{
+					int x = 4 * bx + (i & 3) < level.Width ? 4 * bx + (i & 3) : level.Width - 1;
+					int y = 4 * by + (i >> 2) < level.Height ? 4 * by + (i >> 2) : level.Height - 1;
+					const float* texel = &level.Texels[((size_t)y * level.Width + x) * channels];
+					for (int c = 0; c < channels; c++)
+					{
+						float v = texel[c];
+						if (recipe.Srgb)
+							v = LinearToSrgb(v);
+						else if (recipe.NormalMap)
+							v = 0.5f * v + 0.5f;
+						texels[i][c] = ToByte(v);
+					}
+				}
+
+				unsigned char* out = &blocks[((size_t)by * blocksWide + bx) * blockBytes];
+				if (recipe.Codec == CODEC_BC1)
+				{
+					EncodeBc1Block(texels, out);
+				}
+				else
+				{
+					for (int c = 0; c < (recipe.Codec == CODEC_BC5 ? 2 : 1); c++)
+					{
+						unsigned char values[16];
+						for (int i = 0; i < 16; i++)
+							values[i] = texels[i][c];
+						EncodeBc4Block(values, out + 8 * c);
+					}
+				}
+			}
+		}
+	});
+
+	return blocks;
+}
+
+
+// the .ktx2 name that goes with a .bmp name (same place, same name, different extension):
+
+std::string
+CookedTextureName(const char* bmpName)
+{
+	return ChangeExtension(bmpName, ".ktx2");
+}
+
+
+// "color", "normal", "flow", or "mask" -> a recipe, NULL if it is none of those
+
+const CookRecipe*
+FindCookRecipe(const char* name)
+{
+	if (strcmp(name, "color") == 0)
+		return &COOKCOLOR;
+	if (strcmp(name, "normal") == 0)
+		return &COOKNORMALMAP;
+	if (strcmp(name, "flow") == 0)
+		return &COOKFLOWMAP;
+	if (strcmp(name, "mask") == 0)
+		return &COOKWATERMASK;
+	return NULL;
+}
+
+
+// cook bmpName into ktxName
+// returns false (after saying why) if either file is no good
+
+bool
+CookTexture(const char* bmpName, const char* ktxName, const CookRecipe& recipe)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	int width, height;
+	unsigned char* rgb = ReadBmpFile(bmpName, &width, &height);
+	if (rgb == NULL)
+		return false;
+
+	// level 0 as floats the filter can average:
+
+	int channels = recipe.Codec == CODEC_BC4 ? 1 : 3;
+	float toFloat[256];
+	for (int i = 0; i < 256; i++)
+	{
+		float v = i / 255.f;
+		toFloat[i] = recipe.Srgb ? SrgbToLinear(v) : (recipe.NormalMap ? 2.f * v - 1.f : v);
+	}
+
+	std::vector<CookLevel> levels(1);
+	levels[0].Width = width;
+	levels[0].Height = height;
+	levels[0].Texels.resize((size_t)width * height * channels);
+	ForRowBlocks(height, [&](int firstRow, int lastRow)
+	{
+		for (size_t i = (size_t)firstRow * width; i < (size_t)lastRow * width; i++)
+		{
+			const unsigned char* texel = rgb + 3 * i;
+			if (channels == 1)
+			{
+				levels[0].Texels[i] = recipe.ChannelWeights[0] * toFloat[texel[0]] +
+					recipe.ChannelWeights[1] * toFloat[texel[1]] + recipe.ChannelWeights[2] * toFloat[texel[2]];
+			}
+			else
+			{
+				for (int c = 0; c < 3; c++)
+					levels[0].Texels[3 * i + c] = toFloat[texel[c]];
+			}
+		}
+	});
+	delete[] rgb;
+
+	while ((levels.back().Width > 1 || levels.back().Height > 1) && (int)levels.size() < KTX2MAXLEVELS)
+	{
+		CookLevel next;
+		Downsample(levels.back(), channels, recipe.NormalMap, &next);
+		levels.push_back(std::move(next));
+	}
+
+	std::vector<std::vector<unsigned char>> encoded;
+	size_t totalBytes = 0;
+	for (const CookLevel& level : levels)
+	{
+		encoded.push_back(EncodeLevel(level, recipe));
+		totalBytes += encoded.back().size();
+	}
+
+	// (color stays UNORM: the shaders use the sRGB-encoded values as they are, like the bmp path)
+	unsigned int vkFormat = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	if (recipe.Codec == CODEC_BC4)
+		vkFormat = VK_FORMAT_BC4_UNORM_BLOCK;
+	if (recipe.Codec == CODEC_BC5)
+		vkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+	if (!WriteKtx2File(ktxName, vkFormat, width, height, encoded, recipe.Swizzle))
+		return false;
+
+	static const char* CODECNAMES[] = { "BC1", "BC4", "BC5" };
+	fprintf(stderr, "Cooked '%s' -> '%s': %d x %d, %d levels, %s, %.2f MB (was %.2f MB as RGB), %.0f ms\n",
+		bmpName, ktxName, width, height, (int)levels.size(), CODECNAMES[recipe.Codec],
+		totalBytes / 1048576., 3. * width * height / 1048576.,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+	return true;
+}
@@ -0,0 +1,41 @@
+#ifndef TEXCOOKER_H
+#define TEXCOOKER_H
+
+#include <string>
+
+// the offline texture cooker: a .bmp in, a block-compressed .ktx2 with a full mip chain out
+//	mips are box-filtered on the thread pool, in linear light for color and as unit vectors for normal maps,
+//	then every level is encoded (BC1 color, BC4 one channel, BC5 two channels), also on the thread pool
+//	the runtime (LoadBmpTexture( ), StartTextureLoads( )) uses the .ktx2 next to a .bmp when it is newer
+
+
+enum TextureCodec
+{
+	CODEC_BC1,		// rgb, 4 bits per texel
+	CODEC_BC4,		// one channel, 4 bits per texel
+	CODEC_BC5		// two channels, 8 bits per texel
+};
+
+
+// how to cook one texture:
+
+struct CookRecipe
+{
+	TextureCodec	Codec;
+	bool		Srgb;			// rgb is sRGB-encoded color: average the mips in linear light
+	bool		NormalMap;		// rgb is a unit vector (2*rgb - 1): average the mips as vectors
+	float		ChannelWeights[3];	// BC4: the one channel stored is dot( rgb, ChannelWeights )
+	const char*	Swizzle;		// how the shader sees the stored channels (NULL = as they are)
+};
+
+extern const CookRecipe COOKCOLOR;		// BC1
+extern const CookRecipe COOKNORMALMAP;		// BC5 x and y, the shader rebuilds z
+extern const CookRecipe COOKFLOWMAP;		// BC5 red and green, averaged as plain values
+extern const CookRecipe COOKWATERMASK;		// BC4 blue minus red, seen in the blue channel (red reads 0)
+
+
+std::string		CookedTextureName(const char*);
+const CookRecipe*	FindCookRecipe(const char*);
+bool			CookTexture(const char*, const char*, const CookRecipe&);
+
+#endif		// #ifndef TEXCOOKER_H
@@ -0,0 +1,415 @@
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "glstate.h"
+#include "texcooker.h"
+#include "texture.h"
+#include "texturemanager.h"
+#include "threadpool.h"
+#include "utils.h"
+
+
+constexpr size_t PAGESIZE{ 4096 };
+
+
+// true if the file a exists and b does not, or a was modified no earlier than b:
+
+static bool
+IsNewerFile(const char* a, const char* b)
+{
+	struct stat aInfo, bInfo;
+	if (stat(a, &aInfo) != 0)
+		return false;
+	if (stat(b, &bInfo) != 0)
+		return true;
+	return aInfo.st_mtime >= bInfo.st_mtime;
+}
+
+
+// the GL internal format for one of the cooker's block formats, 0 if this GL cannot take it:
+
+static GLenum
+CompressedFormat(unsigned int vkFormat)
+{
+	bool s3tc = GLEW_EXT_texture_compression_s3tc != 0;
+	bool rgtc = GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+	switch (vkFormat)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		return s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		return s3tc && GLEW_EXT_texture_sRGB ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : 0;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		return rgtc ? GL_COMPRESSED_RED_RGTC1 : 0;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return rgtc ? GL_COMPRESSED_RG_RGTC2 : 0;
+	}
+	return 0;
+}
+
+
+static void
+TouchPages(const unsigned char* first, size_t bytes)
+{
+	unsigned char sum = 0;
+	for (size_t i = 0; i < bytes; i += PAGESIZE)
+		sum += first[i];
+	volatile unsigned char sink = sum;
+	(void)sink;
+}
+
+
+// bring the pages the upload will read into memory
+// (hashing the whole file does that too, when the hash is wanted)
+
+static void
+ReadInTexels(PendingTexture* pending, bool hashContents, const unsigned char* first, size_t bytes)
+{
+	if (hashContents)
+		pending->ContentHash = HashBytes(pending->File.Data(), pending->File.Size(), 0);
+	else if (first != NULL)
+		TouchPages(first, bytes);
+	pending->CpuBytes = pending->File.Size() + (pending->Texels != NULL ? 3 * (size_t)pending->Width * pending->Height : 0);
+}
+
+
+PendingTexture::PendingTexture() : Cooked(false), Texels(NULL), Width(0), Height(0), ContentHash(0), CpuBytes(0), Valid(false)
+{
+}
+
+
+PendingTexture::~PendingTexture()
+{
+	delete[] Texels;
+}
+
+
+// the CPU side of loading a texture, safe to run on any thread:
+// map and check the cooked file if there is an up-to-date one, otherwise the bmp,
+// then either expand it (8-bit palette files) or touch every page of its pixels
+// so the upload does not end up waiting on the disk
+// (and hash the file's contents if hashContents is set)
+
+void
+PrepareTexture(const char* filename, bool hashContents, PendingTexture* pending)
+{
+	pending->Texels = NULL;
+	pending->Cooked = false;
+	pending->ContentHash = 0;
+	pending->CpuBytes = 0;
+	pending->Valid = false;
+
+	std::string cookedName = CookedTextureName(filename);
+	if (IsNewerFile(cookedName.c_str(), filename) && pending->File.Open(cookedName.c_str()))
+	{
+		Ktx2Image& ktx = pending->Ktx;
+		if (ParseKtx2File(cookedName.c_str(), pending->File, &ktx) && CompressedFormat(ktx.VkFormat) != 0)
+		{
+			// (the levels are stored smallest first, so they end with level 0)
+			const unsigned char* first = ktx.Levels[ktx.NumLevels - 1];
+			pending->Cooked = true;
+			pending->Width = ktx.Width;
+			pending->Height = ktx.Height;
+			ReadInTexels(pending, hashContents, first, ktx.Levels[0] + ktx.LevelBytes[0] - first);
+			pending->Valid = true;
+			return;
+		}
+		fprintf(stderr, "Not using cooked texture '%s', loading '%s' instead\n", cookedName.c_str(), filename);
+		pending->File.Close();
+	}
+
+	if (!pending->File.Open(filename))
+	{
+		fprintf(stderr, "Cannot open Bmp file '%s'\n", filename);
+		return;
+	}
+	if (!ParseBmpFile(filename, pending->File, &pending->Image))
+		return;
+
+	const BmpImage& image = pending->Image;
+	pending->Width = image.Width;
+	pending->Height = image.Height;
+	if (image.BitCount == 8)
+	{
+		pending->Texels = DecodeBmpImage(image);
+		ReadInTexels(pending, hashContents, NULL, 0);
+	}
+	else
+		ReadInTexels(pending, hashContents, image.Pixels, image.RowBytes * image.Height);
+	pending->Valid = true;
+}
+
+
+// fill level 0 of the bound texture, which may already have been allocated:
+
+static void
+UploadTexels(bool allocated, GLint internalFormat, int width, int height, GLenum format, const void* texels)
+{
+	if (allocated)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, texels);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, texels);
+}
+
+
+// every level of a cooked texture into the bound texture:
+
+static void
+UploadCookedLevels(bool immutable, const Ktx2Image& ktx)
+{
+	GLenum format = CompressedFormat(ktx.VkFormat);
+	if (immutable)
+		glTexStorage2D(GL_TEXTURE_2D, ktx.NumLevels, format, ktx.Width, ktx.Height);
+
+	for (int level = 0; level < ktx.NumLevels; level++)
+	{
+		int w = ktx.Width >> level > 0 ? ktx.Width >> level : 1;
+		int h = ktx.Height >> level > 0 ? ktx.Height >> level : 1;
+		if (immutable)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format, (GLsizei)ktx.LevelBytes[level], ktx.Levels[level]);
+		else
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, format, w, h, 0, (GLsizei)ktx.LevelBytes[level], ktx.Levels[level]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ktx.NumLevels - 1);
+
+	// which stored channel the shader sees as r, g, b, and a:
+	if (strcmp(ktx.Swizzle, "rgba") != 0)
+	{
+		GLint swizzle[4];
+		for (int c = 0; c < 4; c++)
+		{
+			switch (ktx.Swizzle[c])
+			{
+			case 'r':	swizzle[c] = GL_RED;	break;
+			case 'g':	swizzle[c] = GL_GREEN;	break;
+			case 'b':	swizzle[c] = GL_BLUE;	break;
+			case 'a':	swizzle[c] = GL_ALPHA;	break;
+			case '0':	swizzle[c] = GL_ZERO;	break;
+			default:	swizzle[c] = GL_ONE;	break;
+			}
+		}
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+}
+
+
+// level 0 of a bmp into the bound texture, straight from the mapped file when GL can take its pixels
+// (32-bit files keep their alpha)
+
+static void
+UploadBmpLevel(bool immutable, const BmpImage& image, const unsigned char* texels)
+{
+	GLint internalFormat = image.BitCount == 32 ? GL_RGBA8 : GL_RGB8;
+	if (immutable)
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, image.Width, image.Height);
+
+	GLint oldAlignment, oldRowLength;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &oldAlignment);
+	glGetIntegerv(GL_UNPACK_ROW_LENGTH, &oldRowLength);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	if (texels != NULL)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		UploadTexels(immutable, internalFormat, image.Width, image.Height, GL_RGB, texels);
+	}
+	else
+	{
+		GLenum format = image.BitCount == 24 ? GL_BGR : GL_BGRA;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		if (!image.TopDown)
+		{
+			UploadTexels(immutable, internalFormat, image.Width, image.Height, format, image.Pixels);
+		}
+		else
+		{
+			// GL wants the bottom row first, so hand it the stored rows last to first:
+			if (!immutable)
+				UploadTexels(false, internalFormat, image.Width, image.Height, format, NULL);
+			for (int t = 0; t < image.Height; t++)
+			{
+				const unsigned char* row = image.Pixels + (size_t)(image.Height - 1 - t) * image.RowBytes;
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, t, image.Width, 1, format, GL_UNSIGNED_BYTE, row);
+			}
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, oldAlignment);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, oldRowLength);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+
+// the GL side: make a texture out of a prepared file, linearly filtered and wrapping with wrap in s and t
+// (frees the expanded texels, if there were any)
+// returns the texture name, or 0 if the file could not be used
+
+GLuint
+CreateTexture(const char* filename, GLint wrap, PendingTexture* pending)
+{
+	if (!pending->Valid)
+		return 0;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	BindTexture(0, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	bool immutable = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+	if (pending->Cooked)
+	{
+		UploadCookedLevels(immutable, pending->Ktx);
+		fprintf(stderr, "Image size in file '%s' is: %d x %d (cooked, %d levels)\n",
+			filename, pending->Width, pending->Height, pending->Ktx.NumLevels);
+	}
+	else
+	{
+		UploadBmpLevel(immutable, pending->Image, pending->Texels);
+		delete[] pending->Texels;
+		pending->Texels = NULL;
+		fprintf(stderr, "Image size in file '%s' is: %d x %d\n", filename, pending->Width, pending->Height);
+	}
+
+	return texture;
+}
+
+
+// load one .bmp file into a new texture right now
+// returns the texture name, or 0 if the file cannot be used
+
+GLuint
+LoadBmpTexture(const char* filename, GLint wrap, int* width, int* height)
+{
+	PendingTexture pending;
+	PrepareTexture(filename, false, &pending);
+	GLuint texture = CreateTexture(filename, wrap, &pending);
+
+	if (pending.Valid && width != NULL)
+		*width = pending.Width;
+	if (pending.Valid && height != NULL)
+		*height = pending.Height;
+	return texture;
+}
+
+
+// start reading every requested file on the thread pool
+// with a manager, files it already has are handed out right away, and a file asked for twice is read once
+// loads (and the requests' file names and results) have to stay around until FinishTextureLoads( )
+
+void
+StartTextureLoads(const TextureRequest* requests, int numRequests, TextureLoads* loads, TextureManager* manager)
+{
+	loads->Requests.assign(requests, requests + numRequests);
+	loads->Pending.clear();
+	loads->Manager = manager;
+	loads->SameAs.assign(numRequests, -1);
+	loads->Ready.clear();
+	loads->NumUploaded = 0;
+
+	std::map<std::string, int> firstRequest;
+	for (int i = 0; i < numRequests; i++)
+	{
+		*requests[i].Texture = 0;
+		loads->Pending.push_back(nullptr);
+		if (manager != NULL)
+		{
+			if (FindSharedTexture(manager, requests[i]))
+			{
+				loads->NumUploaded++;
+				continue;
+			}
+			auto first = firstRequest.insert({ TextureKey(requests[i].FileName, requests[i].Wrap), i });
+			if (!first.second)
+			{
+				loads->SameAs[i] = first.first->second;
+				continue;
+			}
+		}
+		loads->Pending[i].reset(new PendingTexture);
+	}
+
+	for (int i = 0; i < numRequests; i++)
+	{
+		if (loads->Pending[i] == nullptr)
+			continue;
+		ThreadPool::Shared().Submit([loads, i]
+		{
+			PendingTexture* pending = loads->Pending[i].get();
+			PrepareTexture(loads->Requests[i].FileName, loads->Manager != NULL, pending);
+			if (loads->Manager != NULL)
+				loads->Manager->CpuBytes += pending->CpuBytes;
+
+			std::lock_guard<std::mutex> lock(loads->Lock);
+			loads->Ready.push_back(i);
+			loads->ReadyChanged.notify_all();
+		});
+	}
+}
+
+
+// upload whatever the workers have finished since last time (GL thread only)
+// returns how many textures are still to come
+
+int
+UploadReadyTextures(TextureLoads* loads)
+{
+	std::vector<int> ready;
+	{
+		std::lock_guard<std::mutex> lock(loads->Lock);
+		ready.swap(loads->Ready);
+	}
+
+	for (int i : ready)
+	{
+		const TextureRequest& request = loads->Requests[i];
+		PendingTexture* pending = loads->Pending[i].get();
+		if (loads->Manager != NULL)
+			*request.Texture = ShareTexture(loads->Manager, request, pending);
+		else
+			*request.Texture = CreateTexture(request.FileName, request.Wrap, pending);
+		if (pending->Valid && request.Width != NULL)
+			*request.Width = pending->Width;
+		if (pending->Valid && request.Height != NULL)
+			*request.Height = pending->Height;
+
+		// done with the file:
+		loads->Pending[i].reset();
+		loads->NumUploaded++;
+
+		// the other requests for the same file get the same texture (or none, if it failed):
+		for (int j = i + 1; j < (int)loads->Requests.size(); j++)
+		{
+			if (loads->SameAs[j] != i)
+				continue;
+			FindSharedTexture(loads->Manager, loads->Requests[j]);
+			loads->NumUploaded++;
+		}
+	}
+
+	return (int)loads->Requests.size() - loads->NumUploaded;
+}
+
+
+// upload the rest of the textures, each as soon as its worker is done with it
+
+void
+FinishTextureLoads(TextureLoads* loads)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	while (UploadReadyTextures(loads) > 0)
+	{
+		std::unique_lock<std::mutex> lock(loads->Lock);
+		loads->ReadyChanged.wait(lock, [loads] { return !loads->Ready.empty(); });
+	}
+
+	fprintf(stderr, "Textures: waited %.1f ms for the last of %d files\n",
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count(), (int)loads->Requests.size());
+}
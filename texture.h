@@ -0,0 +1,90 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+#include "glew.h"
+#include "bmpreader.h"
+#include "ktx2.h"
+#include "mappedfile.h"
+
+struct TextureManager;
+
+// 2D textures straight from .bmp files:
+//	24- and 32-bit files go to GL as GL_BGR/GL_BGRA right out of the mapped file, with no copy on the CPU side
+//	(32-bit files become RGBA8 textures, alpha and all)
+//	(bmp rows are padded to a multiple of 4 bytes, which is exactly what GL_UNPACK_ALIGNMENT 4 skips)
+//	top-down files go up a row at a time, and only 8-bit palette files get expanded first
+//	the storage is immutable (glTexStorage2D) when the GL has it
+//	a cooked .ktx2 next to the .bmp (see texcooker.h) is used instead when it is newer: block-compressed,
+//	with the whole mip chain, and trilinear filtering
+//
+// a whole set of files can be read at once on the thread pool:
+//	StartTextureLoads( ) hands every file to a worker, which maps it, checks it, and pulls it into memory,
+//	the GL thread is free to do other work (compile shaders), calling UploadReadyTextures( ) whenever it likes,
+//	and FinishTextureLoads( ) uploads the rest as each one arrives, so the wait is as long as the slowest file
+//	with a TextureManager (see texturemanager.h) files it already has, or that come up twice, are only read once
+
+
+// one texture for StartTextureLoads( ):
+
+struct TextureRequest
+{
+	const char*	FileName;
+	GLint		Wrap;			// for both s and t
+	GLuint*		Texture;		// gets the texture name (0 if the file cannot be used)
+	int*		Width;			// may be NULL
+	int*		Height;
+};
+
+
+// a file a worker has got ready for uploading
+// (the expanded texels are freed on upload, or with the PendingTexture if it never gets that far)
+
+struct PendingTexture
+{
+	MappedFile	File;
+	bool		Cooked;			// File is the .ktx2, not the .bmp
+	BmpImage	Image;
+	Ktx2Image	Ktx;
+	unsigned char*	Texels;			// expanded RGB texels, if the bmp's own pixels will not do
+	int		Width, Height;
+	unsigned long long ContentHash;		// of the whole file, if asked for
+	size_t		CpuBytes;		// the mapped file and any expanded texels
+	bool		Valid;
+
+	PendingTexture();
+	~PendingTexture();
+	PendingTexture(const PendingTexture&) = delete;
+	PendingTexture& operator=(const PendingTexture&) = delete;
+};
+
+
+struct TextureLoads
+{
+	std::vector<TextureRequest>			Requests;
+	std::vector<std::unique_ptr<PendingTexture>>	Pending;		// NULL for requests that are not read
+	TextureManager*					Manager;		// may be NULL
+	std::vector<int>				SameAs;			// an earlier request for the same file, or -1
+
+	std::mutex					Lock;		// guards the next two
+	std::vector<int>				Ready;		// requests read but not uploaded yet
+	std::condition_variable				ReadyChanged;
+
+	int						NumUploaded;	// GL thread only
+};
+
+
+void	PrepareTexture(const char*, bool, PendingTexture*);
+GLuint	CreateTexture(const char*, GLint, PendingTexture*);
+GLuint	LoadBmpTexture(const char*, GLint, int* = NULL, int* = NULL);
+
+void	StartTextureLoads(const TextureRequest*, int, TextureLoads*, TextureManager* = NULL);
+int	UploadReadyTextures(TextureLoads*);
+void	FinishTextureLoads(TextureLoads*);
+
+#endif		// #ifndef TEXTURE_H
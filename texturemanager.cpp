@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glstate.h"
+#include "texture.h"
+#include "texturemanager.h"
+
+
+TextureManager::TextureManager() : GpuBytes(0), CpuBytes(0), PeakCpuBytes(0), NumLoads(0), NumShared(0)
+{
+}
+
+
+// what a prepared file will take up once it is a texture:
+// the cooked levels exactly, or 4 bytes a texel (most GLs pad RGB8 out to that)
+
+static size_t
+TextureGpuBytes(const PendingTexture& pending)
+{
+	if (!pending.Cooked)
+		return 4 * (size_t)pending.Width * pending.Height;
+
+	size_t bytes = 0;
+	for (int level = 0; level < pending.Ktx.NumLevels; level++)
+		bytes += pending.Ktx.LevelBytes[level];
+	return bytes;
+}
+
+
+// the name the manager knows a file by: its full path (case folded on Windows), and the wrap mode
+
+std::string
+TextureKey(const char* filename, GLint wrap)
+{
+	char path[4096];
+#ifdef WIN32
+	if (_fullpath(path, filename, sizeof(path)) == NULL)
+		snprintf(path, sizeof(path), "%s", filename);
+	for (char* c = path; *c != '\0'; c++)
+		*c = *c == '/' ? '\\' : (char)tolower((unsigned char)*c);
+#else
+	if (realpath(filename, path) == NULL)
+		snprintf(path, sizeof(path), "%s", filename);
+#endif
+	return std::string(path) + '|' + std::to_string(wrap);
+}
+
+
+static std::string
+ContentKey(unsigned long long hash, GLint wrap)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "%016llx|%d", hash, (int)wrap);
+	return key;
+}
+
+
+// one more reference to a texture the manager already has
+// (also filling in the request's texture name and size)
+
+static void
+AddReference(TextureManager* manager, GLuint texture, const TextureRequest& request)
+{
+	ManagedTexture& managed = manager->Textures[texture];
+	managed.RefCount++;
+	manager->NumShared++;
+
+	*request.Texture = texture;
+	if (request.Width != NULL)
+		*request.Width = managed.Width;
+	if (request.Height != NULL)
+		*request.Height = managed.Height;
+}
+
+
+// if the manager already has the requested file, add a reference and fill in the request
+// returns false if it does not
+
+bool
+FindSharedTexture(TextureManager* manager, const TextureRequest& request)
+{
+	auto found = manager->ByPath.find(TextureKey(request.FileName, request.Wrap));
+	if (found == manager->ByPath.end())
+		return false;
+	AddReference(manager, found->second, request);
+	return true;
+}
+
+
+// the GL side of a managed load: the texture with the same contents if the manager has one,
+// otherwise a new texture (see CreateTexture( )) that the manager keeps
+// (either way the file is done with afterwards)
+// returns the texture name, or 0 if the file could not be used
+
+GLuint
+ShareTexture(TextureManager* manager, const TextureRequest& request, PendingTexture* pending)
+{
+	manager->PeakCpuBytes = std::max(manager->PeakCpuBytes, manager->CpuBytes.load());
+	manager->CpuBytes -= pending->CpuBytes;
+	if (!pending->Valid)
+		return 0;
+
+	std::string pathKey = TextureKey(request.FileName, request.Wrap);
+	std::string contentKey = ContentKey(pending->ContentHash, request.Wrap);
+	auto same = manager->ByContent.find(contentKey);
+	if (same != manager->ByContent.end())
+	{
+		fprintf(stderr, "Texture '%s' is a copy of one already loaded, sharing it\n", request.FileName);
+		delete[] pending->Texels;
+		pending->Texels = NULL;
+		manager->ByPath[pathKey] = same->second;
+		AddReference(manager, same->second, request);
+		return same->second;
+	}
+
+	GLuint texture = CreateTexture(request.FileName, request.Wrap, pending);
+	if (texture == 0)
+		return 0;
+
+	ManagedTexture& managed = manager->Textures[texture];
+	managed.Texture = texture;
+	managed.Wrap = request.Wrap;
+	managed.Width = pending->Width;
+	managed.Height = pending->Height;
+	managed.GpuBytes = TextureGpuBytes(*pending);
+	managed.ContentHash = pending->ContentHash;
+	managed.RefCount = 1;
+	manager->ByPath[pathKey] = texture;
+	manager->ByContent[contentKey] = texture;
+	manager->GpuBytes += managed.GpuBytes;
+	manager->NumLoads++;
+	return texture;
+}
+
+
+// a texture for one file right now, shared if the manager already has it
+// returns the texture name, or 0 if the file cannot be used
+
+GLuint
+AcquireTexture(TextureManager* manager, const char* filename, GLint wrap, int* width, int* height)
+{
+	GLuint texture = 0;
+	TextureRequest request = { filename, wrap, &texture, width, height };
+	if (FindSharedTexture(manager, request))
+		return texture;
+
+	PendingTexture pending;
+	PrepareTexture(filename, true, &pending);
+	manager->CpuBytes += pending.CpuBytes;
+	texture = ShareTexture(manager, request, &pending);
+	if (texture != 0 && width != NULL)
+		*width = pending.Width;
+	if (texture != 0 && height != NULL)
+		*height = pending.Height;
+	return texture;
+}
+
+
+// drop one reference, deleting the texture when it was the last
+
+void
+ReleaseTexture(TextureManager* manager, GLuint texture)
+{
+	auto found = manager->Textures.find(texture);
+	if (found == manager->Textures.end())
+	{
+		fprintf(stderr, "Releasing texture %u, which the texture manager does not have\n", texture);
+		return;
+	}
+	if (--found->second.RefCount > 0)
+		return;
+
+	for (auto path = manager->ByPath.begin(); path != manager->ByPath.end(); )
+	{
+		if (path->second == texture)
+			path = manager->ByPath.erase(path);
+		else
+			++path;
+	}
+	manager->ByContent.erase(ContentKey(found->second.ContentHash, found->second.Wrap));
+	manager->GpuBytes -= found->second.GpuBytes;
+	manager->Textures.erase(found);
+	DeleteTexture(texture);
+}
+
+
+void
+ReportTextureMemory(const TextureManager& manager)
+{
+	int numReferences = 0;
+	for (auto& texture : manager.Textures)
+		numReferences += texture.second.RefCount;
+
+	const double MB = 1024. * 1024.;
+	fprintf(stderr, "Textures: %d resident for %d references (%d files read, %d shared), %.1f MB on the GPU, "
+		"%.1f MB on the CPU (%.1f MB at most while loading)\n",
+		(int)manager.Textures.size(), numReferences, manager.NumLoads, manager.NumShared,
+		manager.GpuBytes / MB, manager.CpuBytes.load() / MB, manager.PeakCpuBytes / MB);
+}
@@ -0,0 +1,58 @@
+#ifndef TEXTUREMANAGER_H
+#define TEXTUREMANAGER_H
+
+#include <atomic>
+#include <map>
+#include <stddef.h>
+#include <string>
+
+#include "glew.h"
+
+struct PendingTexture;
+struct TextureRequest;
+
+// textures shared by everything that asks for them, so a file used in several places
+// (the prop libraries in assets/ repeat a lot of theirs) is read and uploaded once:
+//	a texture is found by the canonical path of its file, or failing that by a hash of the file's contents
+//	(taken by the worker reading it anyway), so copies of one file under different names share it too
+//	every acquire counts a reference, and the texture is deleted when the last one is released
+//	nothing stays on the CPU side: the mapped file and any expanded texels go as soon as the texture is uploaded
+//
+// pass one to StartTextureLoads( ) to load a batch on the thread pool, or use AcquireTexture( ) for one file now
+
+
+struct ManagedTexture
+{
+	GLuint			Texture;
+	GLint			Wrap;			// textures with different wrap modes are never shared
+	int			Width, Height;
+	size_t			GpuBytes;		// what the texel data takes up (estimated for uncompressed formats)
+	unsigned long long	ContentHash;
+	int			RefCount;
+};
+
+
+struct TextureManager
+{
+	std::map<GLuint, ManagedTexture>	Textures;
+	std::map<std::string, GLuint>		ByPath;		// canonical path and wrap mode
+	std::map<std::string, GLuint>		ByContent;	// content hash and wrap mode
+
+	size_t					GpuBytes;
+	std::atomic<size_t>			CpuBytes;	// read by workers, not uploaded yet
+	size_t					PeakCpuBytes;
+	int					NumLoads;	// files actually read
+	int					NumShared;	// acquires that found a texture already there
+
+	TextureManager();
+};
+
+
+std::string	TextureKey(const char*, GLint);
+bool		FindSharedTexture(TextureManager*, const TextureRequest&);
+GLuint		ShareTexture(TextureManager*, const TextureRequest&, PendingTexture*);
+GLuint		AcquireTexture(TextureManager*, const char*, GLint, int* = NULL, int* = NULL);
+void		ReleaseTexture(TextureManager*, GLuint);
+void		ReportTextureMemory(const TextureManager&);
+
+#endif		// #ifndef TEXTUREMANAGER_H
@@ -0,0 +1,161 @@
+#include <atomic>
+#include <memory>
+
+#include "threadpool.h"
+
+
+ThreadPool::ThreadPool(int numThreads)
+{
+	Busy = 0;
+	Stopping = false;
+
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	for (int i = 0; i < numThreads; i++)
+		Workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		Stopping = true;
+	}
+	TaskReady.notify_all();
+
+	for (std::thread& worker : Workers)
+		worker.join();
+}
+
+
+int
+ThreadPool::NumThreads() const
+{
+	return (int)Workers.size();
+}
+
+
+void
+ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> guard(Lock);
+		Tasks.push_back(std::move(task));
+	}
+	TaskReady.notify_one();
+}
+
+
+// wait until the queue is empty and no task is running:
+
+void
+ThreadPool::Wait()
+{
+	std::unique_lock<std::mutex> guard(Lock);
+	AllDone.wait(guard, [this] { return Tasks.empty() && Busy == 0; });
+}
+
+
+void
+ThreadPool::WorkerLoop()
+{
+	for (; ; )
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> guard(Lock);
+			TaskReady.wait(guard, [this] { return Stopping || !Tasks.empty(); });
+			if (Stopping && Tasks.empty())
+				return;
+
+			task = std::move(Tasks.front());
+			Tasks.pop_front();
+			Busy++;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> guard(Lock);
+			Busy--;
+			if (Tasks.empty() && Busy == 0)
+				AllDone.notify_all();
+		}
+	}
+}
+
+
+ThreadPool&
+ThreadPool::Shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+
+// the calling thread works on the loop too, and only waits for helpers that actually
+// started -- so ParallelFor( ) can be called from inside a pool task without deadlocking
+
+struct ParallelForState
+{
+	std::atomic<int>		Next;
+	int				Count;
+	int				Active;
+	bool				Finished;
+	std::mutex			Lock;
+	std::condition_variable		Idle;
+};
+
+
+void
+ParallelFor(int count, const std::function<void(int)>& body)
+{
+	if (count <= 0)
+		return;
+
+	if (count == 1)
+	{
+		body(0);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->Next = 0;
+	state->Count = count;
+	state->Active = 0;
+	state->Finished = false;
+
+	ThreadPool& pool = ThreadPool::Shared();
+	int helpers = pool.NumThreads() < count - 1 ? pool.NumThreads() : count - 1;
+	for (int h = 0; h < helpers; h++)
+	{
+		pool.Submit([state, &body]
+		{
+			{
+				std::lock_guard<std::mutex> guard(state->Lock);
+				if (state->Finished)
+					return;
+				state->Active++;
+			}
+
+			for (int i = state->Next++; i < state->Count; i = state->Next++)
+				body(i);
+
+			std::lock_guard<std::mutex> guard(state->Lock);
+			state->Active--;
+			if (state->Active == 0)
+				state->Idle.notify_all();
+		});
+	}
+
+	for (int i = state->Next++; i < count; i = state->Next++)
+		body(i);
+
+	std::unique_lock<std::mutex> guard(state->Lock);
+	state->Finished = true;
+	state->Idle.wait(guard, [&state] { return state->Active == 0; });
+}
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// a fixed set of worker threads pulling tasks off one queue
+
+class ThreadPool
+{
+private:
+	std::vector<std::thread>		Workers;
+	std::deque<std::function<void()>>	Tasks;
+	std::mutex				Lock;
+	std::condition_variable			TaskReady;
+	std::condition_variable			AllDone;
+	int					Busy;
+	bool					Stopping;
+
+	void	WorkerLoop();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+public:
+	ThreadPool(int = 0);		// 0 = one thread per core
+	~ThreadPool();
+
+	int	NumThreads() const;
+	void	Submit(std::function<void()>);
+	void	Wait();
+
+	static ThreadPool&	Shared();
+};
+
+
+// call body( i ) for every i in [0,count) using the shared pool and the calling thread
+// returns once every call has finished
+
+void	ParallelFor(int, const std::function<void(int)>&);
+
+#endif		// #ifndef THREADPOOL_H
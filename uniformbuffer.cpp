@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "uniformbuffer.h"
+
+
+// a buffer of size bytes bound to uniform block binding point binding
+// returns false if the GL has no uniform buffers
+
+bool
+CreateUniformBuffer(GLuint binding, size_t size, UniformBuffer* ub)
+{
+	if (!GLEW_VERSION_3_1 && !GLEW_ARB_uniform_buffer_object)
+	{
+		fprintf(stderr, "No uniform buffer objects\n");
+		return false;
+	}
+
+	ub->Binding = binding;
+	ub->Shadow.assign(size, 0);
+	ub->Loaded = false;
+	ub->NumUploads = 0;
+	glGenBuffers(1, &ub->Buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, ub->Buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, ub->Buffer);
+	return true;
+}
+
+
+// send the block's new contents, just the span from the first changed byte to the last
+// returns true if anything was sent
+
+bool
+UpdateUniformBuffer(UniformBuffer* ub, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (size > ub->Shadow.size())
+		size = ub->Shadow.size();
+
+	size_t first = 0, last = size;
+	if (ub->Loaded)
+	{
+		while (first < size && bytes[first] == ub->Shadow[first])
+			first++;
+		if (first == size)
+			return false;
+		while (bytes[last - 1] == ub->Shadow[last - 1])
+			last--;
+	}
+
+	memcpy(&ub->Shadow[first], bytes + first, last - first);
+	glBindBuffer(GL_UNIFORM_BUFFER, ub->Buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, first, last - first, bytes + first);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	ub->Loaded = true;
+	ub->NumUploads++;
+	return true;
+}
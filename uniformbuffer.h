@@ -0,0 +1,29 @@
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "glew.h"
+
+// a std140 uniform block's data in a buffer object, bound to one binding point for good
+// (see GLSLProgram::BindUniformBlock( ) for the program side)
+// the C++ struct filling it has to match the block's std140 layout: keep to 4-byte scalars and vec4s,
+// or a vec3 followed by a scalar, and pad the struct out to a multiple of 16 bytes
+// updates go through a copy of what the GL has, so only the bytes that changed are sent, and nothing when none did
+
+
+struct UniformBuffer
+{
+	GLuint				Buffer;
+	GLuint				Binding;
+	std::vector<unsigned char>	Shadow;		// what the buffer holds
+	bool				Loaded;		// false until the first update
+	int				NumUploads;	// for the debug output
+};
+
+
+bool	CreateUniformBuffer(GLuint, size_t, UniformBuffer*);
+bool	UpdateUniformBuffer(UniformBuffer*, const void*, size_t);
+
+#endif		// #ifndef UNIFORMBUFFER_H
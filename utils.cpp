@@ -1,10 +1,20 @@
 
 #include <cmath>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <vector>
 
-#include "glew.h"
+#include "bmpreader.h"
+#include "mappedfile.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "objreader.h"
+#include "tangentframes.h"
+#include "threadpool.h"
 #include "utils.h"
 
 // MATH UTILS
@@ -66,7 +76,106 @@ Unit(float v[3])
 }
 
 
+// the sRGB transfer function, both ways (values 0 to 1):
+
+float
+SrgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+
+float
+LinearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+
 // FILE UTILS
+
+// 64-bit FNV-1a style hash, taken 8 bytes at a time with a final mix
+// (only meant for spotting changed files, not for security)
+
+unsigned long long
+HashBytes(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned long long PRIME = 0x100000001b3ull;
+	unsigned long long h = seed ^ 0xcbf29ce484222325ull;
+
+	const unsigned char* p = (const unsigned char*)data;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++, p += 8)
+	{
+		unsigned long long w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * PRIME;
+	}
+	for (size_t i = words * 8; i < size; i++, p++)
+		h = (h ^ *p) * PRIME;
+
+	h ^= size;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+// hash a whole file, 1 MB blocks at a time in parallel
+// returns false if the file cannot be read
+
+bool
+HashFile(const char* filename, unsigned long long* hash)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+
+	const size_t BLOCKSIZE = 1 << 20;
+	int numBlocks = (int)((file.Size() + BLOCKSIZE - 1) / BLOCKSIZE);
+	std::vector<unsigned long long> blockHashes(numBlocks);
+
+	ParallelFor(numBlocks, [&file, &blockHashes, BLOCKSIZE](int i)
+	{
+		size_t first = (size_t)i * BLOCKSIZE;
+		size_t size = file.Size() - first < BLOCKSIZE ? file.Size() - first : BLOCKSIZE;
+		blockHashes[i] = HashBytes(file.Data() + first, size, 0);
+	});
+
+	*hash = HashBytes(blockHashes.data(), blockHashes.size() * sizeof(unsigned long long), file.Size());
+	return true;
+}
+
+
+// modification time of a file (and its size, if asked), -1 if it is not there:
+
+long long
+FileTime(const char* filename, unsigned long long* size)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return -1;
+
+	if (size != NULL)
+		*size = (unsigned long long)st.st_size;
+	return (long long)st.st_mtime;
+}
+
+
+// the name of a file made from another one, in the same place with a different extension:
+// ("final_project_assets/terrain.bmp", ".vtex") -> "final_project_assets/terrain.vtex"
+
+std::string
+ChangeExtension(const char* filename, const char* extension)
+{
+	std::string name(filename);
+	size_t dot = name.find_last_of('.');
+	size_t slash = name.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		name.erase(dot);
+	return name + extension;
+}
 // delimiters for parsing the obj file:
 const char* OBJDELIMS = " \t";
 
@@ -99,8 +208,19 @@ constexpr int birgb{ 0 };
 
 
 // read a BMP file into a Texture:
+// (see ReadBmpFile( ) for the formats it takes)
 unsigned char*
 BmpToTexture(char* filename, int* width, int* height)
+{
+	return ReadBmpFile(filename, width, height);
+}
+
+
+// read a BMP file with the original fgetc-at-a-time reader
+// (kept so BenchmarkBmpReaders( ) has something to compare against)
+
+unsigned char*
+BmpToTextureLegacy(char* filename, int* width, int* height)
 {
 	FILE* fp = fopen(filename, "rb");
 	if (fp == NULL)
@@ -213,42 +333,24 @@ ReadShort(FILE* fp)
 	return (b1 << 8) | b0;
 }
 
-struct Vertex
-{
-	float x, y, z;
-};
-
-
-struct Normal
-{
-	float nx, ny, nz;
-};
-
-
-struct TextureCoord
-{
-	float s, t, p;
-};
-
 
-struct face
-{
-	int v, n, t;
-};
+// read an obj file with the original line-at-a-time reader
+// (kept so BenchmarkObjReaders( ) has something to compare against)
 
 int
-LoadObjFile(char* name)
+ReadObjFileLegacy(char* name, ObjData* obj)
 {
 	char* cmd;		// the command string
 	char* str;		// argument string
 
-	std::vector <struct Vertex> Vertices(10000);
-	std::vector <struct Normal> Normals(10000);
-	std::vector <struct TextureCoord> TextureCoords(10000);
+	obj->Vertices.clear();
+	obj->Normals.clear();
+	obj->TextureCoords.clear();
+	obj->Corners.clear();
 
-	Vertices.clear();
-	Normals.clear();
-	TextureCoords.clear();
+	std::vector <struct Vertex>& Vertices = obj->Vertices;
+	std::vector <struct Normal>& Normals = obj->Normals;
+	std::vector <struct TextureCoord>& TextureCoords = obj->TextureCoords;
 
 	struct Vertex sv;
 	struct Normal sn;
@@ -265,14 +367,8 @@ LoadObjFile(char* name)
 	}
 
 
-	float xmin = 1.e+37f;
-	float ymin = 1.e+37f;
-	float zmin = 1.e+37f;
-	float xmax = -xmin;
-	float ymax = -ymin;
-	float zmax = -zmin;
-
-	glBegin(GL_TRIANGLES);
+	obj->xmin = obj->ymin = obj->zmin = 1.e+37f;
+	obj->xmax = obj->ymax = obj->zmax = -1.e+37f;
 
 	for (; ; )
 	{
@@ -326,12 +422,12 @@ LoadObjFile(char* name)
 
 			Vertices.push_back(sv);
 
-			if (sv.x < xmin)	xmin = sv.x;
-			if (sv.x > xmax)	xmax = sv.x;
-			if (sv.y < ymin)	ymin = sv.y;
-			if (sv.y > ymax)	ymax = sv.y;
-			if (sv.z < zmin)	zmin = sv.z;
-			if (sv.z > zmax)	zmax = sv.z;
+			if (sv.x < obj->xmin)	obj->xmin = sv.x;
+			if (sv.x > obj->xmax)	obj->xmax = sv.x;
+			if (sv.y < obj->ymin)	obj->ymin = sv.y;
+			if (sv.y > obj->ymax)	obj->ymax = sv.y;
+			if (sv.z < obj->zmin)	obj->zmin = sv.z;
+			if (sv.z > obj->zmax)	obj->zmax = sv.z;
 
 			continue;
 		}
@@ -356,7 +452,7 @@ LoadObjFile(char* name)
 
 		if (strcmp(cmd, "vt") == 0)
 		{
-			st.s = st.t = st.p = 0.;
+			st.s = st.t = 0.;
 
 			str = strtok(NULL, OBJDELIMS);
 			st.s = atof(str);
@@ -365,10 +461,6 @@ LoadObjFile(char* name)
 			if (str != NULL)
 				st.t = atof(str);
 
-			str = strtok(NULL, OBJDELIMS);
-			if (str != NULL)
-				st.p = atof(str);
-
 			TextureCoords.push_back(st);
 
 			continue;
@@ -377,8 +469,8 @@ LoadObjFile(char* name)
 
 		if (strcmp(cmd, "f") == 0)
 		{
-			struct face vertices[10];
-			for (int i = 0; i < 10; i++)
+			struct face vertices[MAXFACECORNERS];
+			for (int i = 0; i < MAXFACECORNERS; i++)
 			{
 				vertices[i].v = 0;
 				vertices[i].n = 0;
@@ -391,7 +483,6 @@ LoadObjFile(char* name)
 
 			int numVertices = 0;
 			bool valid = true;
-			int vtx = 0;
 			char* str;
 			while ((str = strtok(NULL, OBJDELIMS)) != NULL)
 			{
@@ -412,41 +503,35 @@ LoadObjFile(char* name)
 
 				// be sure we are not out-of-bounds (<vector> will abort):
 
-				if (t > sizet)
+				if (t > sizet || t < 0)
 				{
-					if (t != 0)
-						fprintf(stderr, "Read texture coord %d, but only have %d so far\n", t, sizet);
+					fprintf(stderr, "Read texture coord %d, but only have %d so far\n", t, sizet);
 					t = 0;
 				}
 
-				if (n > sizen)
+				if (n > sizen || n < 0)
 				{
-					if (n != 0)
-						fprintf(stderr, "Read normal %d, but only have %d so far\n", n, sizen);
+					fprintf(stderr, "Read normal %d, but only have %d so far\n", n, sizen);
 					n = 0;
 				}
 
-				if (v > sizev)
+				if (v > sizev || v < 1)
 				{
-					if (v != 0)
-						fprintf(stderr, "Read vertex coord %d, but only have %d so far\n", v, sizev);
-					v = 0;
+					fprintf(stderr, "Read vertex coord %d, but only have %d so far\n", v, sizev);
 					valid = false;
 				}
 
-				vertices[vtx].v = v;
-				vertices[vtx].n = n;
-				vertices[vtx].t = t;
-				vtx++;
+				vertices[numVertices].v = v;
+				vertices[numVertices].n = n;
+				vertices[numVertices].t = t;
+				numVertices++;
 
-				if (vtx >= 10)
+				if (numVertices >= MAXFACECORNERS)
 					break;
-
-				numVertices++;
 			}
 
 
-			// if vertices are invalid, don't draw anything this time:
+			// if vertices are invalid, don't keep anything this time:
 
 			if (!valid)
 				continue;
@@ -455,72 +540,42 @@ LoadObjFile(char* name)
 				continue;
 
 
-			// list the vertices:
+			// fan the face into triangles:
 
 			int numTriangles = numVertices - 2;
 
 			for (int it = 0; it < numTriangles; it++)
 			{
-				int vv[3];
-				vv[0] = 0;
-				vv[1] = it + 1;
-				vv[2] = it + 2;
-
-				// get the planar normal, in case vertex normals are not defined:
-
-				struct Vertex* v0 = &Vertices[vertices[vv[0]].v - 1];
-				struct Vertex* v1 = &Vertices[vertices[vv[1]].v - 1];
-				struct Vertex* v2 = &Vertices[vertices[vv[2]].v - 1];
-
-				float v01[3], v02[3], norm[3];
-				v01[0] = v1->x - v0->x;
-				v01[1] = v1->y - v0->y;
-				v01[2] = v1->z - v0->z;
-				v02[0] = v2->x - v0->x;
-				v02[1] = v2->y - v0->y;
-				v02[2] = v2->z - v0->z;
-				Cross(v01, v02, norm);
-				Unit(norm, norm);
-				glNormal3fv(norm);
-
-				for (int vtx = 0; vtx < 3; vtx++)
-				{
-					if (vertices[vv[vtx]].t != 0)
-					{
-						struct TextureCoord* tp = &TextureCoords[vertices[vv[vtx]].t - 1];
-						glTexCoord2f(tp->s, tp->t);
-					}
-
-					if (vertices[vv[vtx]].n != 0)
-					{
-						struct Normal* np = &Normals[vertices[vv[vtx]].n - 1];
-						glNormal3f(np->nx, np->ny, np->nz);
-					}
-
-					struct Vertex* vp = &Vertices[vertices[vv[vtx]].v - 1];
-					glVertex3f(vp->x, vp->y, vp->z);
-				}
+				obj->Corners.push_back(vertices[0]);
+				obj->Corners.push_back(vertices[it + 1]);
+				obj->Corners.push_back(vertices[it + 2]);
 			}
 			continue;
 		}
+	}
 
+	fclose(fp);
+	return 0;
+}
 
-		if (strcmp(cmd, "s") == 0)
-		{
-			continue;
-		}
 
-	}
+// read an obj file into an indexed mesh, ready for UploadMesh( )
+// (triangles and vertices come out reordered for the vertex cache, overdraw, and vertex fetch)
 
-	glEnd();
-	fclose(fp);
+int
+LoadObjFile(char* name, Mesh* mesh)
+{
+	ObjData obj;
+	if (ReadObjFile(name, &obj) != 0)
+		return 1;
+
+	BuildMesh(obj, mesh);
+	ComputeTangentFrames(mesh);
+	OptimizeMesh(mesh);
+	BuildMeshLods(&mesh, 1);
 
 	fprintf(stderr, "Obj file range: [%8.3f,%8.3f,%8.3f] -> [%8.3f,%8.3f,%8.3f]\n",
-		xmin, ymin, zmin, xmax, ymax, zmax);
-	fprintf(stderr, "Obj file center = (%8.3f,%8.3f,%8.3f)\n",
-		(xmin + xmax) / 2., (ymin + ymax) / 2., (zmin + zmax) / 2.);
-	fprintf(stderr, "Obj file  span = (%8.3f,%8.3f,%8.3f)\n",
-		xmax - xmin, ymax - ymin, zmax - zmin);
+		obj.xmin, obj.ymin, obj.zmin, obj.xmax, obj.ymax, obj.zmax);
 
 	return 0;
 }
@@ -639,71 +694,56 @@ const float LENFRAC = 0.10f;
 // fraction of length to use as start location of the characters:
 const float BASEFRAC = 1.10f;
 
-//	Draw a set of 3D axes:
-//	(length is the axis length in world coordinates)
+// a strip of points as separate line segments (x, y, z for each end):
 
-void
-Axes(float length)
+static void
+AddLineStrip(const std::vector<float>& strip, std::vector<float>* lines)
 {
-	glBegin(GL_LINE_STRIP);
-	glVertex3f(length, 0., 0.);
-	glVertex3f(0., 0., 0.);
-	glVertex3f(0., length, 0.);
-	glEnd();
-	glBegin(GL_LINE_STRIP);
-	glVertex3f(0., 0., 0.);
-	glVertex3f(0., 0., length);
-	glEnd();
+	for (size_t i = 3; i < strip.size(); i += 3)
+		lines->insert(lines->end(), strip.begin() + (i - 3), strip.begin() + (i + 3));
+}
 
-	float fact = LENFRAC * length;
-	float base = BASEFRAC * length;
 
-	glBegin(GL_LINE_STRIP);
-	for (int i = 0; i < 4; i++)
+// a stroke character's strips, starting a new one wherever its order goes negative:
+
+static void
+AddCharacter(const float* cx, const float* cy, const int* order, int n, const float origin[3], const float u[3],
+	const float v[3], float fact, std::vector<float>* lines)
+{
+	std::vector<float> strip;
+	for (int i = 0; i < n; i++)
 	{
-		int j = xorder[i];
+		int j = order[i];
 		if (j < 0)
 		{
-
-			glEnd();
-			glBegin(GL_LINE_STRIP);
+			AddLineStrip(strip, lines);
+			strip.clear();
 			j = -j;
 		}
 		j--;
-		glVertex3f(base + fact * xx[j], fact * xy[j], 0.0);
+		for (int c = 0; c < 3; c++)
+			strip.push_back(origin[c] + fact * (cx[j] * u[c] + cy[j] * v[c]));
 	}
-	glEnd();
+	AddLineStrip(strip, lines);
+}
 
-	glBegin(GL_LINE_STRIP);
-	for (int i = 0; i < 5; i++)
-	{
-		int j = yorder[i];
-		if (j < 0)
-		{
 
-			glEnd();
-			glBegin(GL_LINE_STRIP);
-			j = -j;
-		}
-		j--;
-		glVertex3f(fact * yx[j], base + fact * yy[j], 0.0);
-	}
-	glEnd();
+//	The line segments of a set of 3D axes, labelled, for drawing as GL_LINES:
+//	(length is the axis length in world coordinates)
 
-	glBegin(GL_LINE_STRIP);
-	for (int i = 0; i < 6; i++)
-	{
-		int j = zorder[i];
-		if (j < 0)
-		{
+void
+AxesLines(float length, std::vector<float>* lines)
+{
+	lines->clear();
+	AddLineStrip({ length, 0., 0.,  0., 0., 0.,  0., length, 0. }, lines);
+	AddLineStrip({ 0., 0., 0.,  0., 0., length }, lines);
 
-			glEnd();
-			glBegin(GL_LINE_STRIP);
-			j = -j;
-		}
-		j--;
-		glVertex3f(0.0, fact * zy[j], base + fact * zx[j]);
-	}
-	glEnd();
+	float fact = LENFRAC * length;
+	float base = BASEFRAC * length;
 
-}
\ No newline at end of file
+	const float xAxis[3] = { 1., 0., 0. }, yAxis[3] = { 0., 1., 0. }, zAxis[3] = { 0., 0., 1. };
+	const float xOrigin[3] = { base, 0., 0. }, yOrigin[3] = { 0., base, 0. }, zOrigin[3] = { 0., 0., base };
+	AddCharacter(xx, xy, xorder, 4, xOrigin, xAxis, yAxis, fact, lines);
+	AddCharacter(yx, yy, yorder, 5, yOrigin, xAxis, yAxis, fact, lines);
+	AddCharacter(zx, zy, zorder, 6, zOrigin, zAxis, yAxis, fact, lines);
+}
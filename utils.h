@@ -1,15 +1,29 @@
 #pragma once
+#include <stddef.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
+
+struct Mesh;
+struct ObjData;
 
 unsigned char* BmpToTexture(char*, int*, int*);
+unsigned char* BmpToTextureLegacy(char*, int*, int*);
+bool HashFile(const char*, unsigned long long*);
+long long FileTime(const char*, unsigned long long* = NULL);
+std::string ChangeExtension(const char*, const char*);
+unsigned long long HashBytes(const void*, size_t, unsigned long long);
 int ReadInt(FILE*);
 short ReadShort(FILE*);
 
 void Cross(float[3], float[3], float[3]);
 float Dot(float[3], float[3]);
 float Unit(float[3], float[3]);
+float SrgbToLinear(float);
+float LinearToSrgb(float);
 char* ReadRestOfLine(FILE*);
 void ReadObjVTN(char*, int*, int*, int*);
 float Unit(float[3]);
-int LoadObjFile(char* name);
-void Axes(float);
+int LoadObjFile(char*, Mesh*);
+int ReadObjFileLegacy(char*, ObjData*);
+void AxesLines(float, std::vector<float>*);
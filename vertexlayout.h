@@ -0,0 +1,121 @@
+#ifndef VERTEXLAYOUT_H
+#define VERTEXLAYOUT_H
+
+#include <stddef.h>
+
+#include "glew.h"
+
+// compile-time description of an interleaved vertex format
+//
+//	typedef VertexLayout< Attr<ATTRIB_POSITION, 3, GL_FLOAT>,
+//			      Attr<ATTRIB_NORMAL, 2, GL_SHORT, GL_TRUE> >	MyLayout;
+//
+//	MyLayout::Stride		bytes per vertex
+//	MyLayout::Offset<1>( )		bytes from the start of the vertex to the 2nd attribute
+//	MyLayout::Setup( )		glVertexAttribPointer( ) for every attribute (into the bound VAO)
+//	MyLayout::Describe( )		the same information as data, for files that store vertices
+
+
+// generic attribute locations every shader uses (layout(location = ...) in the .vert files):
+
+enum AttributeLocation
+{
+	ATTRIB_POSITION = 0,
+	ATTRIB_NORMAL = 1,
+	ATTRIB_TEXCOORD = 2,
+	ATTRIB_TANGENT = 3,
+	ATTRIB_POSITIONSCALE = 4,	// per mesh, not per vertex (see SetMeshUniforms( ) and geometrypool.h)
+	ATTRIB_POSITIONBIAS = 5
+};
+
+
+// one attribute of a layout, as data:
+
+struct VertexAttribute
+{
+	unsigned int	Location;		// AttributeLocation
+	unsigned int	Components;
+	unsigned int	Type;			// GL_FLOAT, GL_SHORT, ...
+	unsigned int	Normalized;
+	unsigned int	Offset;			// bytes from the start of the vertex
+};
+
+
+template <GLenum Type> struct GLTypeSize;
+template <> struct GLTypeSize<GL_FLOAT>			{ static constexpr size_t Size = 4; };
+template <> struct GLTypeSize<GL_HALF_FLOAT>		{ static constexpr size_t Size = 2; };
+template <> struct GLTypeSize<GL_INT>			{ static constexpr size_t Size = 4; };
+template <> struct GLTypeSize<GL_UNSIGNED_INT>		{ static constexpr size_t Size = 4; };
+template <> struct GLTypeSize<GL_SHORT>			{ static constexpr size_t Size = 2; };
+template <> struct GLTypeSize<GL_UNSIGNED_SHORT>	{ static constexpr size_t Size = 2; };
+template <> struct GLTypeSize<GL_BYTE>			{ static constexpr size_t Size = 1; };
+template <> struct GLTypeSize<GL_UNSIGNED_BYTE>		{ static constexpr size_t Size = 1; };
+
+
+template <AttributeLocation Location, int Components, GLenum Type, GLboolean Normalized = GL_FALSE>
+struct Attr
+{
+	static constexpr AttributeLocation	Loc = Location;
+	static constexpr int			Count = Components;
+	static constexpr GLenum			GLType = Type;
+	static constexpr GLboolean		Norm = Normalized;
+	static constexpr size_t			Size = Components * GLTypeSize<Type>::Size;
+
+	// every attribute has to start on a 4-byte boundary for the fast vertex fetch path:
+	static_assert(Size % 4 == 0, "vertex attributes must be a multiple of 4 bytes");
+};
+
+
+template <class... Attrs> struct VertexLayout;
+
+template <>
+struct VertexLayout<>
+{
+	static constexpr size_t	Stride = 0;
+	static constexpr int	NumAttributes = 0;
+
+	template <size_t I> static constexpr size_t Offset() { return 0; }
+
+	static void Setup(GLsizei, size_t) { }
+	static void Describe(VertexAttribute*, unsigned int) { }
+};
+
+template <class First, class... Rest>
+struct VertexLayout<First, Rest...>
+{
+	static constexpr size_t	Stride = First::Size + VertexLayout<Rest...>::Stride;
+	static constexpr int	NumAttributes = 1 + VertexLayout<Rest...>::NumAttributes;
+
+	template <size_t I>
+	static constexpr size_t
+	Offset()
+	{
+		return I == 0 ? 0 : First::Size + VertexLayout<Rest...>::template Offset<(I == 0 ? 0 : I - 1)>();
+	}
+
+
+	// point every attribute at the buffer bound to GL_ARRAY_BUFFER
+	// (baseOffset is where the first vertex starts in that buffer)
+
+	static void
+	Setup(GLsizei stride = (GLsizei)Stride, size_t baseOffset = 0)
+	{
+		glEnableVertexAttribArray(First::Loc);
+		glVertexAttribPointer(First::Loc, First::Count, First::GLType, First::Norm, stride, (const GLvoid*)baseOffset);
+		VertexLayout<Rest...>::Setup(stride, baseOffset + First::Size);
+	}
+
+
+	static void
+	Describe(VertexAttribute* attributes, unsigned int offset = 0)
+	{
+		attributes->Location = First::Loc;
+		attributes->Components = First::Count;
+		attributes->Type = First::GLType;
+		attributes->Normalized = First::Norm;
+		attributes->Offset = offset;
+		VertexLayout<Rest...>::Describe(attributes + 1, offset + (unsigned int)First::Size);
+	}
+};
+
+#endif		// #ifndef VERTEXLAYOUT_H
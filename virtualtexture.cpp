@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "glslprogram.h"
+#include "glstate.h"
+#include "threadpool.h"
+#include "utils.h"
+#include "virtualtexture.h"
+
+
+constexpr int VTMINSLOTS{ 4 };
+constexpr int VTMAXSLOTSPERSIDE{ 255 };		// slot numbers go in a byte of the page table
+
+
+static int
+LevelTilesX(const VirtualTexture& vt, int level)
+{
+	return VtexLevelTiles(vt.Image.Header.TilesX, level);
+}
+
+
+static int
+LevelTilesY(const VirtualTexture& vt, int level)
+{
+	return VtexLevelTiles(vt.Image.Header.TilesY, level);
+}
+
+
+// put a loaded tile into a cache slot: an empty one if there is one, otherwise the one
+// that has gone longest without being seen (never one seen this frame, or the pinned coarsest tile)
+// returns false if every slot is in use this frame
+
+static bool
+PlaceTile(VirtualTexture* vt, int tile, const unsigned char* texels)
+{
+	int root = vt->Image.FirstTile[vt->Image.Header.NumLevels - 1];
+	int best = -1;
+	for (int slot = 0; slot < (int)vt->SlotTile.size(); slot++)
+	{
+		if (vt->SlotTile[slot] < 0)
+		{
+			best = slot;
+			break;
+		}
+		if (vt->SlotTile[slot] == root || vt->SlotLastUsed[slot] >= vt->Frame)
+			continue;
+		if (best < 0 || vt->SlotLastUsed[slot] < vt->SlotLastUsed[best])
+			best = slot;
+	}
+	if (best < 0)
+		return false;
+
+	if (vt->SlotTile[best] >= 0)
+		vt->TileSlot[vt->SlotTile[best]] = -1;
+	vt->SlotTile[best] = tile;
+	vt->SlotLastUsed[best] = vt->Frame;
+	vt->TileSlot[tile] = best;
+
+	BindTexture(0, vt->Atlas);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (best % vt->SlotsX) * VTEXTILESTRIDE, (best / vt->SlotsX) * VTEXTILESTRIDE,
+		VTEXTILESTRIDE, VTEXTILESTRIDE, GL_RGB, GL_UNSIGNED_BYTE, texels);
+
+	vt->PageTableDirty = true;
+	return true;
+}
+
+
+// point every page table entry at its own tile if it is in the cache, otherwise at whatever its parent
+// points at (working down from the coarsest level, which is always there), and upload the lot
+
+static void
+RebuildPageTable(VirtualTexture* vt)
+{
+	int numLevels = (int)vt->Image.Header.NumLevels;
+	BindTexture(0, vt->PageTable);
+	for (int level = numLevels - 1; level >= 0; level--)
+	{
+		int tilesX = LevelTilesX(*vt, level);
+		int tilesY = LevelTilesY(*vt, level);
+		unsigned char* entries = &vt->PageEntries[4 * (size_t)vt->Image.FirstTile[level]];
+		for (int y = 0; y < tilesY; y++)
+		{
+			for (int x = 0; x < tilesX; x++)
+			{
+				unsigned char* entry = entries + 4 * (y * tilesX + x);
+				int slot = vt->TileSlot[vt->Image.FirstTile[level] + y * tilesX + x];
+				if (slot >= 0)
+				{
+					entry[0] = (unsigned char)(slot % vt->SlotsX);
+					entry[1] = (unsigned char)(slot / vt->SlotsX);
+					entry[2] = (unsigned char)level;
+					entry[3] = 255;
+				}
+				else
+				{
+					int parentTilesX = LevelTilesX(*vt, level + 1);
+					int parentX = x / 2 < parentTilesX ? x / 2 : parentTilesX - 1;
+					int parentY = y / 2 < LevelTilesY(*vt, level + 1) ? y / 2 : LevelTilesY(*vt, level + 1) - 1;
+					memcpy(entry, &vt->PageEntries[4 * ((size_t)vt->Image.FirstTile[level + 1] + parentY * parentTilesX + parentX)], 4);
+				}
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tilesX, tilesY, GL_RGBA, GL_UNSIGNED_BYTE, entries);
+	}
+	vt->PageTableDirty = false;
+}
+
+
+// copy one tile out of the mapped file on the thread pool, then hand it back to the GL thread:
+
+static void
+StartTileLoad(VirtualTexture* vt, int tile)
+{
+	int staging = vt->FreeStaging.back();
+	vt->FreeStaging.pop_back();
+	vt->TileLoading[tile] = true;
+
+	ThreadPool::Shared().Submit([vt, tile, staging]()
+	{
+		memcpy(&vt->Staging[VTEXTILEBYTES * staging], vt->Image.Base + vt->Image.TileOffsets[tile], VTEXTILEBYTES);
+		std::lock_guard<std::mutex> lock(vt->Lock);
+		vt->Loaded.push_back({ tile, staging });
+	});
+}
+
+
+// open the virtual texture baked from imageName (see VirtualTextureName( )), if there is one and it is
+// at least as new as the image, with a tile cache of about cacheBytes
+// returns false if there is no usable one
+
+bool
+OpenVirtualTexture(const char* imageName, size_t cacheBytes, VirtualTexture* vt)
+{
+	std::string vtexName = VirtualTextureName(imageName);
+	long long vtexTime = FileTime(vtexName.c_str());
+	if (vtexTime < 0 || vtexTime < FileTime(imageName))
+		return false;
+	if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object)
+	{
+		fprintf(stderr, "Not using virtual texture '%s': no framebuffer objects\n", vtexName.c_str());
+		return false;
+	}
+	if (!vt->File.Open(vtexName.c_str()) || !ParseVtexFile(vtexName.c_str(), vt->File, &vt->Image))
+		return false;
+
+	const VtexHeader& header = vt->Image.Header;
+	int numLevels = (int)header.NumLevels;
+	vt->NumTiles = 0;
+	for (int level = 0; level < numLevels; level++)
+		vt->NumTiles += LevelTilesX(*vt, level) * LevelTilesY(*vt, level);
+
+	// as many slots as the budget allows, in as square an atlas as fits:
+
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int maxSlotsPerSide = std::min(VTMAXSLOTSPERSIDE, maxSize / VTEXTILESTRIDE);
+	int numSlots = (int)(cacheBytes / (4 * VTEXTILESTRIDE * VTEXTILESTRIDE));
+	numSlots = std::max(VTMINSLOTS, std::min(numSlots, maxSlotsPerSide * maxSlotsPerSide));
+	vt->SlotsX = std::min(maxSlotsPerSide, (int)ceil(sqrt((double)numSlots)));
+	vt->SlotsY = std::max(1, numSlots / vt->SlotsX);
+	vt->SlotTile.assign(vt->SlotsX * vt->SlotsY, -1);
+	vt->SlotLastUsed.assign(vt->SlotTile.size(), -1);
+	vt->TileSlot.assign(vt->NumTiles, -1);
+	vt->TileWanted.assign(vt->NumTiles, -1);
+	vt->TileLoading.assign(vt->NumTiles, false);
+
+	glGenTextures(1, &vt->Atlas);
+	BindTexture(0, vt->Atlas);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, vt->SlotsX * VTEXTILESTRIDE, vt->SlotsY * VTEXTILESTRIDE, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	// one page table texel per tile, one mip level per tile level:
+
+	vt->PageEntries.assign(4 * (size_t)vt->NumTiles, 0);
+	glGenTextures(1, &vt->PageTable);
+	BindTexture(0, vt->PageTable);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	for (int level = 0; level < numLevels; level++)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, LevelTilesX(*vt, level), LevelTilesY(*vt, level), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	// the feedback pass is set up by its first frame:
+
+	vt->FeedbackProgram = new GLSLProgram();
+	if (!vt->FeedbackProgram->Create("final_project_assets/river.vert", "final_project_assets/vtfeedback.frag"))
+	{
+		fprintf(stderr, "Not using virtual texture '%s': the feedback shader did not build\n", vtexName.c_str());
+		return false;
+	}
+	vt->FeedbackFbo = vt->FeedbackColor = vt->FeedbackDepth = 0;
+	vt->FeedbackWidth = vt->FeedbackHeight = 0;
+	glGenBuffers(VTFEEDBACKFRAMES, vt->FeedbackPbos);
+	for (int i = 0; i < VTFEEDBACKFRAMES; i++)
+		vt->FeedbackPboWidth[i] = vt->FeedbackPboHeight[i] = 0;
+
+	vt->Staging.resize(VTEXTILEBYTES * VTSTAGINGTILES);
+	vt->FreeStaging.clear();
+	for (int i = VTSTAGINGTILES - 1; i >= 0; i--)
+		vt->FreeStaging.push_back(i);
+	vt->Ready.clear();
+	vt->Loaded.clear();
+	vt->Frame = 0;
+	vt->NumUploaded = 0;
+
+	// the coarsest level, which stays put so every page table lookup has something to fall back on:
+
+	GLint oldAlignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &oldAlignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	int root = vt->Image.FirstTile[numLevels - 1];
+	PlaceTile(vt, root, vt->Image.Base + vt->Image.TileOffsets[root]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, oldAlignment);
+	RebuildPageTable(vt);
+
+	fprintf(stderr, "Virtual texture '%s': %u x %u, %d levels, cache of %d x %d tiles (%.0f MB)\n",
+		vtexName.c_str(), header.Width, header.Height, numLevels, vt->SlotsX, vt->SlotsY,
+		4. * VTEXTILESTRIDE * VTEXTILESTRIDE * vt->SlotTile.size() / (1024. * 1024.));
+	return true;
+}
+
+
+// (re)make the feedback framebuffer for a width x height viewport:
+
+static bool
+SizeFeedbackFramebuffer(VirtualTexture* vt, int width, int height)
+{
+	width = std::max(1, width / VTFEEDBACKSCALE);
+	height = std::max(1, height / VTFEEDBACKSCALE);
+	if (vt->FeedbackFbo != 0 && width == vt->FeedbackWidth && height == vt->FeedbackHeight)
+		return true;
+
+	if (vt->FeedbackFbo == 0)
+	{
+		glGenFramebuffers(1, &vt->FeedbackFbo);
+		glGenTextures(1, &vt->FeedbackColor);
+		glGenRenderbuffers(1, &vt->FeedbackDepth);
+	}
+	vt->FeedbackWidth = width;
+	vt->FeedbackHeight = height;
+
+	BindTexture(0, vt->FeedbackColor);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindRenderbuffer(GL_RENDERBUFFER, vt->FeedbackDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, vt->FeedbackFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vt->FeedbackColor, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vt->FeedbackDepth);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete)
+		fprintf(stderr, "Virtual texture feedback framebuffer is not complete\n");
+	return complete;
+}
+
+
+// draw the feedback pass for a width x height viewport (draw( ) draws everything that uses the virtual texture
+// with the program it is given, the current matrices as they are) and start reading it back
+
+void
+RenderVirtualTextureFeedback(VirtualTexture* vt, int width, int height, const std::function<void(GLSLProgram*)>& draw)
+{
+	if (!SizeFeedbackFramebuffer(vt, width, height))
+		return;
+
+	GLint oldViewport[4];
+	GLfloat oldClearColor[4];
+	GetViewport(oldViewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, oldClearColor);
+	glBindFramebuffer(GL_FRAMEBUFFER, vt->FeedbackFbo);
+	SetViewport(0, 0, vt->FeedbackWidth, vt->FeedbackHeight);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// (the smaller framebuffer makes every texel span VTFEEDBACKSCALE times fewer pixels, so take that back off the level)
+	vt->FeedbackProgram->Use();
+	SetVirtualTextureUniforms(vt->FeedbackProgram, *vt, -1, -1, -log2f((float)VTFEEDBACKSCALE));
+	draw(vt->FeedbackProgram);
+	vt->FeedbackProgram->Use(0);
+
+	int pbo = vt->Frame % VTFEEDBACKFRAMES;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, vt->FeedbackPbos[pbo]);
+	glBufferData(GL_PIXEL_PACK_BUFFER, 4 * (size_t)vt->FeedbackWidth * vt->FeedbackHeight, NULL, GL_STREAM_READ);
+	glReadPixels(0, 0, vt->FeedbackWidth, vt->FeedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	vt->FeedbackPboWidth[pbo] = vt->FeedbackWidth;
+	vt->FeedbackPboHeight[pbo] = vt->FeedbackHeight;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	SetViewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
+	glClearColor(oldClearColor[0], oldClearColor[1], oldClearColor[2], oldClearColor[3]);
+}
+
+
+// the tiles the oldest feedback asks for: mark the ones in the cache (and their ancestors) as seen,
+// and return the rest, coarsest first
+
+static void
+ReadFeedback(VirtualTexture* vt, std::vector<int>* wanted)
+{
+	int pbo = (vt->Frame + 1) % VTFEEDBACKFRAMES;		// the oldest one
+	int width = vt->FeedbackPboWidth[pbo];
+	int height = vt->FeedbackPboHeight[pbo];
+	if (width == 0)
+		return;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, vt->FeedbackPbos[pbo]);
+	const unsigned char* pixels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	int numLevels = (int)vt->Image.Header.NumLevels;
+	for (int i = 0; pixels != NULL && i < width * height; i++)
+	{
+		const unsigned char* pixel = pixels + 4 * i;
+		if (pixel[3] == 0)
+			continue;
+
+		// (see vtfeedback.frag for the packing)
+		int level = std::min(pixel[3] - 1, numLevels - 1);
+		int x = pixel[0] | ((pixel[2] & 0x0f) << 8);
+		int y = pixel[1] | ((pixel[2] & 0xf0) << 4);
+		for (; level < numLevels; level++, x /= 2, y /= 2)
+		{
+			x = std::min(x, LevelTilesX(*vt, level) - 1);
+			y = std::min(y, LevelTilesY(*vt, level) - 1);
+			int tile = vt->Image.FirstTile[level] + y * LevelTilesX(*vt, level) + x;
+			if (vt->TileWanted[tile] == vt->Frame)
+				break;
+			vt->TileWanted[tile] = vt->Frame;
+			if (vt->TileSlot[tile] >= 0)
+				vt->SlotLastUsed[vt->TileSlot[tile]] = vt->Frame;
+			else if (!vt->TileLoading[tile] && vt->Image.TileOffsets[tile] != 0)
+				wanted->push_back(tile);
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	vt->FeedbackPboWidth[pbo] = 0;
+
+	// coarsest first (tile numbers go up with the level), so the fallbacks get better quickly:
+	std::sort(wanted->begin(), wanted->end(), std::greater<int>());
+}
+
+
+// once a frame, before drawing: put the tiles that have arrived into the cache, start loading
+// the ones the feedback asks for, and bring the page table up to date
+
+void
+UpdateVirtualTexture(VirtualTexture* vt)
+{
+	{
+		std::lock_guard<std::mutex> lock(vt->Lock);
+		vt->Ready.insert(vt->Ready.end(), vt->Loaded.begin(), vt->Loaded.end());
+		vt->Loaded.clear();
+	}
+
+	std::vector<int> wanted;
+	ReadFeedback(vt, &wanted);
+
+	GLint oldAlignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &oldAlignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	vt->NumUploaded = 0;
+	size_t used = 0;
+	for (; used < vt->Ready.size() && vt->NumUploaded < VTMAXUPLOADSPERFRAME; used++)
+	{
+		const LoadedTile& loaded = vt->Ready[used];
+		if (!PlaceTile(vt, loaded.Tile, &vt->Staging[VTEXTILEBYTES * loaded.Staging]))
+			break;
+		vt->TileLoading[loaded.Tile] = false;
+		vt->FreeStaging.push_back(loaded.Staging);
+		vt->NumUploaded++;
+	}
+	vt->Ready.erase(vt->Ready.begin(), vt->Ready.begin() + used);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, oldAlignment);
+
+	for (size_t i = 0; i < wanted.size() && !vt->FreeStaging.empty(); i++)
+		StartTileLoad(vt, wanted[i]);
+
+	if (vt->PageTableDirty)
+		RebuildPageTable(vt);
+	vt->Frame++;
+}
+
+
+// the uniforms VirtualTextureColor( ) in the shaders needs, binding the cache and the page table
+// to texture units atlasUnit and pageTableUnit (unless they are negative, as the feedback pass has no use for them)
+
+void
+SetVirtualTextureUniforms(GLSLProgram* program, const VirtualTexture& vt, int atlasUnit, int pageTableUnit, float lodBias)
+{
+	static const UniformHandle uVtAtlas = GetUniformHandle("uVtAtlas");
+	static const UniformHandle uVtPageTable = GetUniformHandle("uVtPageTable");
+	static const UniformHandle uVtWidth = GetUniformHandle("uVtWidth");
+	static const UniformHandle uVtHeight = GetUniformHandle("uVtHeight");
+	static const UniformHandle uVtNumLevels = GetUniformHandle("uVtNumLevels");
+	static const UniformHandle uVtLodBias = GetUniformHandle("uVtLodBias");
+
+	if (atlasUnit >= 0)
+	{
+		BindTexture(atlasUnit, vt.Atlas);
+		program->SetUniformVariable(uVtAtlas, atlasUnit);
+	}
+	if (pageTableUnit >= 0)
+	{
+		BindTexture(pageTableUnit, vt.PageTable);
+		program->SetUniformVariable(uVtPageTable, pageTableUnit);
+	}
+	program->SetUniformVariable(uVtWidth, (float)vt.Image.Header.Width);
+	program->SetUniformVariable(uVtHeight, (float)vt.Image.Header.Height);
+	program->SetUniformVariable(uVtNumLevels, (float)vt.Image.Header.NumLevels);
+	program->SetUniformVariable(uVtLodBias, lodBias);
+}
@@ -0,0 +1,90 @@
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include <functional>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+#include "glew.h"
+#include "mappedfile.h"
+#include "vtexfile.h"
+
+class GLSLProgram;
+
+// virtual texturing, for images too big to be one GL texture (see vtexfile.h for the tiles on disk):
+//	the tile cache is one GL texture holding a fixed number of tiles (the memory budget), in any order
+//	the page table is a small mipmapped RGBA8 texture with a texel per tile of every level, saying which
+//	cache slot holds that tile -- or, until it arrives, its nearest ancestor that is there
+//	(the coarsest level is a single tile that is loaded up front and never evicted, so every lookup finds something)
+//	a feedback pass draws the scene into a small framebuffer writing the tile and level each pixel wants,
+//	read back a couple of frames later through pixel buffer objects so the GL never waits on it
+//	the tiles that are wanted but missing are copied out of the mapped file on the thread pool, coarsest first,
+//	and a few are put into the cache every frame in place of the tiles that have gone longest without being seen
+//
+// the shader side is VirtualTextureColor( ) in river.frag and vtfeedback.frag, which must agree with
+// the uniforms SetVirtualTextureUniforms( ) sets
+
+
+constexpr size_t VTCACHEBYTES{ 64 * 1024 * 1024 };	// default tile cache budget
+constexpr int VTSTAGINGTILES{ 32 };			// tiles being loaded or waiting for upload at once
+constexpr int VTMAXUPLOADSPERFRAME{ 16 };
+constexpr int VTFEEDBACKSCALE{ 8 };			// the feedback framebuffer is this much smaller each way
+constexpr int VTFEEDBACKFRAMES{ 3 };			// feedback read back this many frames late
+
+
+// a tile that has been read and is waiting for the GL thread:
+
+struct LoadedTile
+{
+	int	Tile;				// index into the file's tile offsets
+	int	Staging;			// which staging buffer holds it
+};
+
+
+struct VirtualTexture
+{
+	MappedFile			File;
+	VtexImage			Image;
+	int				NumTiles;		// on the whole grid, all levels
+
+	// the tile cache:
+	GLuint				Atlas;
+	int				SlotsX, SlotsY;
+	std::vector<int>		SlotTile;		// -1 if empty
+	std::vector<int>		SlotLastUsed;		// frame number
+	std::vector<int>		TileSlot;		// -1 if not in the cache
+	std::vector<int>		TileWanted;		// frame number it was last asked for
+	std::vector<bool>		TileLoading;
+
+	// the page table:
+	GLuint				PageTable;
+	std::vector<unsigned char>	PageEntries;		// RGBA8: slot x, slot y, level of the tile it is, 255
+	bool				PageTableDirty;
+
+	// the feedback pass:
+	GLSLProgram*			FeedbackProgram;
+	GLuint				FeedbackFbo, FeedbackColor, FeedbackDepth;
+	int				FeedbackWidth, FeedbackHeight;
+	GLuint				FeedbackPbos[VTFEEDBACKFRAMES];
+	int				FeedbackPboWidth[VTFEEDBACKFRAMES];	// 0 if nothing has been read into it
+	int				FeedbackPboHeight[VTFEEDBACKFRAMES];
+
+	// loading:
+	std::vector<unsigned char>	Staging;		// VTSTAGINGTILES tiles
+	std::vector<int>		FreeStaging;		// GL thread only
+	std::vector<LoadedTile>		Ready;			// GL thread only: loaded, waiting for a slot
+	std::mutex			Lock;			// guards Loaded
+	std::vector<LoadedTile>		Loaded;
+
+	int				Frame;
+	int				NumUploaded;		// last frame, for the debug output
+};
+
+
+bool	OpenVirtualTexture(const char*, size_t, VirtualTexture*);
+void	RenderVirtualTextureFeedback(VirtualTexture*, int, int, const std::function<void(GLSLProgram*)>&);
+void	UpdateVirtualTexture(VirtualTexture*);
+void	SetVirtualTextureUniforms(GLSLProgram*, const VirtualTexture&, int, int, float);
+
+#endif		// #ifndef VIRTUALTEXTURE_H
@@ -0,0 +1,358 @@
+#include <chrono>
+#include <deque>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "bmpreader.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "utils.h"
+#include "vtexfile.h"
+
+
+// one mip level as the baker sees it: a band of rows on their way into tiles
+
+struct BakeLevel
+{
+	int					Width, Height;
+	int					TilesX, TilesY;
+	int					FirstTile;
+	std::deque<std::vector<unsigned char>>	Rows;		// RGB
+	int					FirstRow;	// the level row Rows[0] is
+	int					NumRows;	// rows received so far
+	int					NextTileRow;
+};
+
+
+// what every level shares:
+
+struct VtexBaker
+{
+	std::vector<BakeLevel>			Levels;
+	std::vector<unsigned long long>		TileOffsets;
+	unsigned long long			NextOffset;
+	FILE*					Fp;
+	bool					Ok;
+	float					ToLinear[256];
+	unsigned char				ToSrgb[4096];
+};
+
+
+// "final_project_assets/terrain.bmp" -> "final_project_assets/terrain.vtex":
+
+std::string
+VirtualTextureName(const char* imageName)
+{
+	return ChangeExtension(imageName, ".vtex");
+}
+
+
+static unsigned int
+NextPowerOfTwo(unsigned int n)
+{
+	unsigned int p = 1;
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+
+// cut tile row NextTileRow of a level into tiles (on the thread pool) and write them out:
+
+static void
+EmitTileRow(VtexBaker* baker, BakeLevel* level)
+{
+	int ty = level->NextTileRow;
+	// (the grid is a power of two each way, the image need not be: tiles wholly past it are left out)
+	int numTiles = (level->Width + VTEXTILESIZE - 1) / VTEXTILESIZE;
+	numTiles = numTiles < level->TilesX ? numTiles : level->TilesX;
+	bool inside = ty * VTEXTILESIZE < level->Height;
+	if (!inside)
+		numTiles = 0;
+
+	std::vector<unsigned char> tiles(VTEXTILEBYTES * numTiles);
+	ParallelFor(numTiles, [&](int tx)
+	{
+		unsigned char* tile = &tiles[VTEXTILEBYTES * tx];
+		for (int j = 0; j < VTEXTILESTRIDE; j++)
+		{
+			int t = ty * VTEXTILESIZE - VTEXBORDER + j;
+			t = t < 0 ? 0 : (t >= level->Height ? level->Height - 1 : t);
+			const unsigned char* row = level->Rows[t - level->FirstRow].data();
+			for (int i = 0; i < VTEXTILESTRIDE; i++)
+			{
+				int s = tx * VTEXTILESIZE - VTEXBORDER + i;
+				s = s < 0 ? 0 : (s >= level->Width ? level->Width - 1 : s);
+				memcpy(tile + 3 * (j * VTEXTILESTRIDE + i), row + 3 * s, 3);
+			}
+		}
+	});
+
+	if (baker->Ok && fwrite(tiles.data(), 1, tiles.size(), baker->Fp) != tiles.size())
+		baker->Ok = false;
+	for (int tx = 0; tx < numTiles; tx++)
+	{
+		baker->TileOffsets[level->FirstTile + ty * level->TilesX + tx] = baker->NextOffset;
+		baker->NextOffset += VTEXTILEBYTES;
+	}
+	level->NextTileRow++;
+}
+
+
+// average two rows of a level into one row of the next, in linear light:
+
+static void
+HalveRows(const VtexBaker& baker, const unsigned char* a, const unsigned char* b, int width, std::vector<unsigned char>* half)
+{
+	int halfWidth = (width + 1) / 2;
+	half->resize(3 * (size_t)halfWidth);
+	for (int x = 0; x < halfWidth; x++)
+	{
+		int x0 = 2 * x;
+		int x1 = x0 + 1 < width ? x0 + 1 : x0;
+		for (int c = 0; c < 3; c++)
+		{
+			float sum = baker.ToLinear[a[3 * x0 + c]] + baker.ToLinear[a[3 * x1 + c]] +
+				baker.ToLinear[b[3 * x0 + c]] + baker.ToLinear[b[3 * x1 + c]];
+			(*half)[3 * x + c] = baker.ToSrgb[(int)(sum * (4095.f / 4.f) + 0.5f)];
+		}
+	}
+}
+
+
+// hand a batch of rows to a level: pass them on, halved, to the next level,
+// and cut whatever tile rows they complete
+
+static void
+AddRows(VtexBaker* baker, int index, std::vector<std::vector<unsigned char>>* rows)
+{
+	BakeLevel* level = &baker->Levels[index];
+	int firstNew = level->NumRows;
+	for (auto& row : *rows)
+		level->Rows.push_back(std::move(row));
+	level->NumRows += (int)rows->size();
+
+	// the next level's rows: every even row averaged with the odd one after it
+	// (or with itself, if it is the last row)
+	// (an even row from an earlier batch is still in the band, which always keeps VTEXBORDER rows back)
+
+	std::vector<std::vector<unsigned char>> halves;
+	if (index + 1 < (int)baker->Levels.size())
+	{
+		int firstHalf = firstNew / 2;
+		int endHalf = level->NumRows == level->Height ? (level->NumRows + 1) / 2 : level->NumRows / 2;
+		halves.resize(endHalf - firstHalf);
+		ParallelFor((int)halves.size(), [&](int h)
+		{
+			int r = 2 * (firstHalf + h);
+			int next = r + 1 < level->Height ? r + 1 : r;
+			const unsigned char* a = level->Rows[r - level->FirstRow].data();
+			const unsigned char* b = level->Rows[next - level->FirstRow].data();
+			HalveRows(*baker, a, b, level->Width, &halves[h]);
+		});
+	}
+
+	// every tile row whose rows (and the apron above them) are all here:
+
+	while (level->NextTileRow < level->TilesY)
+	{
+		int needed = (level->NextTileRow + 1) * VTEXTILESIZE + VTEXBORDER;
+		if (level->NumRows < (needed < level->Height ? needed : level->Height))
+			break;
+		EmitTileRow(baker, level);
+		while (!level->Rows.empty() && level->FirstRow < level->NextTileRow * VTEXTILESIZE - VTEXBORDER)
+		{
+			level->Rows.pop_front();
+			level->FirstRow++;
+		}
+	}
+
+	if (!halves.empty())
+		AddRows(baker, index + 1, &halves);
+}
+
+
+// cut bmpName into the tiles of every mip level and write them to vtexName
+// the image is read straight out of the mapped file a tile row at a time and each level only keeps
+// the rows its next tile row needs, so the image can be far bigger than memory
+// returns false (after saying why) if either file is no good
+
+bool
+BakeVirtualTexture(const char* bmpName, const char* vtexName)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	BmpImage image;
+	if (!file.Open(bmpName) || !ParseBmpFile(bmpName, file, &image))
+	{
+		fprintf(stderr, "Cannot bake a virtual texture from '%s'\n", bmpName);
+		return false;
+	}
+
+	VtexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, "VTEX", 4);
+	header.FormatVersion = VTEXFORMATVERSION;
+	header.Width = image.Width;
+	header.Height = image.Height;
+	header.TilesX = NextPowerOfTwo((image.Width + VTEXTILESIZE - 1) / VTEXTILESIZE);
+	header.TilesY = NextPowerOfTwo((image.Height + VTEXTILESIZE - 1) / VTEXTILESIZE);
+	header.NumLevels = 1;
+	while ((header.TilesX >> (header.NumLevels - 1)) > 1 || (header.TilesY >> (header.NumLevels - 1)) > 1)
+		header.NumLevels++;
+	header.TileSize = VTEXTILESIZE;
+	header.Border = VTEXBORDER;
+	if (header.NumLevels > (unsigned int)VTEXMAXLEVELS)
+	{
+		fprintf(stderr, "Image '%s' is too big for a virtual texture\n", bmpName);
+		return false;
+	}
+
+	VtexBaker baker;
+	baker.Levels.resize(header.NumLevels);
+	int numTiles = 0;
+	for (int l = 0; l < (int)header.NumLevels; l++)
+	{
+		BakeLevel& level = baker.Levels[l];
+		level.Width = l == 0 ? image.Width : (baker.Levels[l - 1].Width + 1) / 2;
+		level.Height = l == 0 ? image.Height : (baker.Levels[l - 1].Height + 1) / 2;
+		level.TilesX = VtexLevelTiles(header.TilesX, l);
+		level.TilesY = VtexLevelTiles(header.TilesY, l);
+		level.FirstTile = numTiles;
+		level.FirstRow = 0;
+		level.NumRows = 0;
+		level.NextTileRow = 0;
+		numTiles += level.TilesX * level.TilesY;
+	}
+	for (int i = 0; i < 256; i++)
+		baker.ToLinear[i] = SrgbToLinear(i / 255.f);
+	for (int i = 0; i < 4096; i++)
+		baker.ToSrgb[i] = (unsigned char)(LinearToSrgb(i / 4095.f) * 255.f + 0.5f);
+
+	std::string tempName = std::string(vtexName) + ".tmp";
+	baker.Fp = fopen(tempName.c_str(), "wb");
+	if (baker.Fp == NULL)
+	{
+		fprintf(stderr, "Cannot create virtual texture '%s'\n", tempName.c_str());
+		return false;
+	}
+	baker.TileOffsets.assign(numTiles, 0);
+	baker.NextOffset = sizeof(header) + sizeof(unsigned long long) * numTiles;
+	baker.Ok = fwrite(&header, sizeof(header), 1, baker.Fp) == 1 &&
+		fwrite(baker.TileOffsets.data(), sizeof(unsigned long long), numTiles, baker.Fp) == (size_t)numTiles;
+
+	// level 0 a tile row at a time:
+
+	for (int first = 0; first < image.Height && baker.Ok; first += VTEXTILESIZE)
+	{
+		std::vector<std::vector<unsigned char>> rows(first + VTEXTILESIZE < image.Height ? VTEXTILESIZE : image.Height - first);
+		ParallelFor((int)rows.size(), [&](int j)
+		{
+			int t = first + j;
+			const unsigned char* stored = image.Pixels + (size_t)(image.TopDown ? image.Height - 1 - t : t) * image.RowBytes;
+			std::vector<unsigned char>& row = rows[j];
+			row.resize(3 * (size_t)image.Width);
+			for (int x = 0; x < image.Width; x++)
+			{
+				unsigned char* texel = &row[3 * x];
+				if (image.BitCount == 8)
+				{
+					memcpy(texel, image.Palette[stored[x]], 3);
+				}
+				else
+				{
+					const unsigned char* bgr = stored + (image.BitCount / 8) * x;
+					texel[0] = bgr[2];
+					texel[1] = bgr[1];
+					texel[2] = bgr[0];
+				}
+			}
+		});
+		AddRows(&baker, 0, &rows);
+	}
+
+	// now the offsets are all known:
+
+	baker.Ok = baker.Ok && fseek(baker.Fp, (long)sizeof(header), SEEK_SET) == 0 &&
+		fwrite(baker.TileOffsets.data(), sizeof(unsigned long long), numTiles, baker.Fp) == (size_t)numTiles;
+	baker.Ok = fclose(baker.Fp) == 0 && baker.Ok;
+	if (!baker.Ok)
+	{
+		fprintf(stderr, "Cannot write virtual texture '%s'\n", tempName.c_str());
+		remove(tempName.c_str());
+		return false;
+	}
+
+	remove(vtexName);
+	if (rename(tempName.c_str(), vtexName) != 0)
+	{
+		fprintf(stderr, "Cannot rename '%s' to '%s'\n", tempName.c_str(), vtexName);
+		remove(tempName.c_str());
+		return false;
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	unsigned long long tileBytes = baker.NextOffset - sizeof(header) - sizeof(unsigned long long) * numTiles;
+	fprintf(stderr, "Baked '%s' -> '%s': %d x %d, %d levels, %d tiles of %d, %.1f MB, %.0f ms\n",
+		bmpName, vtexName, image.Width, image.Height, header.NumLevels, (int)(tileBytes / VTEXTILEBYTES), VTEXTILESIZE,
+		baker.NextOffset / (1024. * 1024.), ms);
+	return true;
+}
+
+
+// check the header of a mapped .vtex file and find its tiles
+// returns false (after saying why) if the file cannot be used
+
+bool
+ParseVtexFile(const char* filename, const MappedFile& file, VtexImage* image)
+{
+	const unsigned char* bytes = (const unsigned char*)file.Data();
+	size_t size = file.Size();
+
+	VtexHeader& header = image->Header;
+	if (size < sizeof(header))
+	{
+		fprintf(stderr, "Virtual texture '%s' is too short\n", filename);
+		return false;
+	}
+	memcpy(&header, bytes, sizeof(header));
+	if (memcmp(header.Magic, "VTEX", 4) != 0 || header.FormatVersion != VTEXFORMATVERSION ||
+		header.TileSize != (unsigned int)VTEXTILESIZE || header.Border != (unsigned int)VTEXBORDER)
+	{
+		fprintf(stderr, "File '%s' is not a version %u virtual texture\n", filename, VTEXFORMATVERSION);
+		return false;
+	}
+	if (header.NumLevels < 1 || header.NumLevels > (unsigned int)VTEXMAXLEVELS ||
+		VtexLevelTiles(header.TilesX, header.NumLevels - 1) != 1 || VtexLevelTiles(header.TilesY, header.NumLevels - 1) != 1)
+	{
+		fprintf(stderr, "Virtual texture '%s' has a bad header\n", filename);
+		return false;
+	}
+
+	size_t numTiles = 0;
+	for (int l = 0; l < (int)header.NumLevels; l++)
+	{
+		image->FirstTile[l] = (int)numTiles;
+		numTiles += (size_t)VtexLevelTiles(header.TilesX, l) * VtexLevelTiles(header.TilesY, l);
+	}
+	if ((size - sizeof(header)) / sizeof(unsigned long long) < numTiles)
+	{
+		fprintf(stderr, "Virtual texture '%s' is too short\n", filename);
+		return false;
+	}
+
+	image->TileOffsets = (const unsigned long long*)(bytes + sizeof(header));
+	for (size_t i = 0; i < numTiles; i++)
+	{
+		if (image->TileOffsets[i] != 0 && (image->TileOffsets[i] > size || size - image->TileOffsets[i] < VTEXTILEBYTES))
+		{
+			fprintf(stderr, "Virtual texture '%s' is missing tiles\n", filename);
+			return false;
+		}
+	}
+	image->Base = bytes;
+	return true;
+}
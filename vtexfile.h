@@ -0,0 +1,63 @@
+#ifndef VTEXFILE_H
+#define VTEXFILE_H
+
+#include <stddef.h>
+#include <string>
+
+class MappedFile;
+
+// the pre-tiled on-disk form of a virtual texture (.vtex), written offline by BakeVirtualTexture( ):
+//	every mip level (each half the size of the one before, rounding up) is cut into VTEXTILESIZE x VTEXTILESIZE
+//	texel tiles on a grid that is a power of two each way, so the page table can be an ordinary mipmapped texture
+//	each tile is stored with a VTEXBORDER texel apron copied from its neighbours (or repeating the image's edge),
+//	so it can be bilinearly filtered on its own wherever it lands in the tile cache
+//	tiles are uncompressed RGB, bottom row first, and any one of them is a single read at a known offset
+//
+// file layout: a VtexHeader, then a 64-bit file offset for every tile of the grid (level 0 first, each level
+// row by row from the bottom; 0 for tiles wholly past the edge of the image), then the tiles
+
+
+constexpr int VTEXTILESIZE{ 128 };					// texels of the image per tile side
+constexpr int VTEXBORDER{ 4 };						// apron texels on each side
+constexpr int VTEXTILESTRIDE{ VTEXTILESIZE + 2 * VTEXBORDER };		// texels per stored tile side
+constexpr size_t VTEXTILEBYTES{ 3 * VTEXTILESTRIDE * VTEXTILESTRIDE };
+constexpr int VTEXMAXLEVELS{ 16 };
+constexpr unsigned int VTEXFORMATVERSION{ 1 };
+
+
+struct VtexHeader
+{
+	char		Magic[4];		// "VTEX"
+	unsigned int	FormatVersion;
+	unsigned int	Width, Height;		// of the source image
+	unsigned int	TilesX, TilesY;		// level 0 (powers of two)
+	unsigned int	NumLevels;		// until both are down to 1 (level l is ceil( Width / 2^l ) texels wide)
+	unsigned int	TileSize;		// VTEXTILESIZE
+	unsigned int	Border;			// VTEXBORDER
+	unsigned int	Reserved;
+};
+
+
+// where the tiles of a mapped .vtex file are:
+
+struct VtexImage
+{
+	VtexHeader			Header;
+	const unsigned long long*	TileOffsets;
+	int				FirstTile[VTEXMAXLEVELS];	// index of tile (0,0) of each level
+	const unsigned char*		Base;				// the start of the mapped file
+};
+
+
+inline int
+VtexLevelTiles(unsigned int level0Tiles, int level)
+{
+	return (level0Tiles >> level) > 0 ? (int)(level0Tiles >> level) : 1;
+}
+
+
+std::string	VirtualTextureName(const char*);
+bool		BakeVirtualTexture(const char*, const char*);
+bool		ParseVtexFile(const char*, const MappedFile&, VtexImage*);
+
+#endif		// #ifndef VTEXFILE_H